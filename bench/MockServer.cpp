@@ -0,0 +1,533 @@
+#include "MockServer.h"
+#include "Md5.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+thread_local bool server_thread = false;
+
+// Archive bodies repeat this many bytes of pseudo-random data.
+const size_t PATTERN_SIZE = 64 * 1024;
+
+const std::vector<char>& archive_pattern()
+{
+    static const std::vector<char> pattern = [] {
+        std::vector<char> bytes(PATTERN_SIZE);
+        std::mt19937 rng(42);
+        for (auto& b : bytes) {
+            b = static_cast<char>(rng() & 0xff);
+        }
+        return bytes;
+    }();
+    return pattern;
+}
+
+const char* status_text(int status)
+{
+    switch (status) {
+    case 200:
+        return "OK";
+    case 206:
+        return "Partial Content";
+    case 404:
+        return "Not Found";
+    case 416:
+        return "Range Not Satisfiable";
+    case 429:
+        return "Too Many Requests";
+    default:
+        return "Error";
+    }
+}
+
+std::vector<std::string> split_path(const std::string& path)
+{
+    std::vector<std::string> parts;
+    std::stringstream ss(path);
+    std::string part;
+    while (std::getline(ss, part, '/')) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+std::string pattern_md5(uintmax_t size)
+{
+    Md5 md5;
+    const auto& pattern = archive_pattern();
+    for (uintmax_t offset = 0; offset < size; offset += PATTERN_SIZE) {
+        md5.update(pattern.data(), static_cast<size_t>(std::min<uintmax_t>(PATTERN_SIZE, size - offset)));
+    }
+    return md5.hex_digest();
+}
+
+int to_int(const std::string& s)
+{
+    try {
+        return std::stoi(s);
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+// Value of name in a "a=1&b=2" query string, or -1.
+int query_int(const std::string& query, const std::string& name)
+{
+    std::stringstream ss(query);
+    std::string pair;
+    while (std::getline(ss, pair, '&')) {
+        if (pair.rfind(name + "=", 0) == 0) {
+            return to_int(pair.substr(name.size() + 1));
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// Lifecycle
+//----------------------------------------------------------------------------------
+
+MockServer::MockServer(MockServerOptions options)
+    : options_(std::move(options))
+{
+    archive_md5_ = pattern_md5(options_.archive_size);
+    if (options_.large_every > 0) {
+        large_archive_md5_ = pattern_md5(options_.large_archive_size);
+    }
+}
+
+bool MockServer::large_mod(int mod) const
+{
+    return options_.large_every > 0 && mod % options_.large_every == 0;
+}
+
+MockServer::~MockServer()
+{
+    stop();
+}
+
+bool MockServer::start()
+{
+    listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ < 0) {
+        return false;
+    }
+    int yes = 1;
+    ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(listen_fd_, 128) != 0
+        || ::getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    port_ = ntohs(addr.sin_port);
+
+    running_ = true;
+    acceptor_ = std::thread([this] { accept_loop(); });
+    return true;
+}
+
+void MockServer::stop()
+{
+    if (!running_.exchange(false)) {
+        return;
+    }
+    ::shutdown(listen_fd_, SHUT_RDWR);
+    ::close(listen_fd_);
+    acceptor_.join();
+
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        for (int fd : client_fds_) {
+            ::shutdown(fd, SHUT_RDWR);
+        }
+    }
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+}
+
+bool MockServer::on_server_thread()
+{
+    return server_thread;
+}
+
+std::string MockServer::base_url() const
+{
+    return "http://127.0.0.1:" + std::to_string(port_);
+}
+
+void MockServer::accept_loop()
+{
+    server_thread = true;
+    while (running_) {
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            continue; // stop() closes the socket, which ends the loop through running_
+        }
+        int yes = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        client_fds_.insert(fd);
+        workers_.emplace_back([this, fd] { serve(fd); });
+    }
+}
+
+//----------------------------------------------------------------------------------
+// HTTP
+//----------------------------------------------------------------------------------
+
+/**
+ * One keep-alive connection: reads GET requests until the client hangs up or asks to close.
+ */
+void MockServer::serve(int fd)
+{
+    server_thread = true;
+    std::string buffer;
+    char chunk[8192];
+    bool keep_alive = true;
+
+    while (keep_alive && running_) {
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) {
+                keep_alive = false;
+                break;
+            }
+            buffer.append(chunk, static_cast<size_t>(n));
+        }
+        if (!keep_alive) {
+            break;
+        }
+        std::string head = buffer.substr(0, end);
+        buffer.erase(0, end + 4);
+
+        std::istringstream lines(head);
+        std::string method, target, version, line, range;
+        lines >> method >> target >> version;
+        std::getline(lines, line);
+        while (std::getline(lines, line)) {
+            std::string lower = line;
+            std::transform(lower.begin(), lower.end(), lower.begin(),
+                [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            if (lower.rfind("connection:", 0) == 0 && lower.find("close") != std::string::npos) {
+                keep_alive = false;
+            } else if (lower.rfind("range:", 0) == 0) {
+                range = lower.substr(6);
+                range.erase(0, range.find_first_not_of(' '));
+                range.erase(range.find_last_not_of("\r ") + 1);
+            }
+        }
+
+        requests_++;
+        if (options_.latency_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options_.latency_ms));
+        }
+        if (!route(fd, method, target, range, keep_alive)) {
+            break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        client_fds_.erase(fd);
+    }
+    ::close(fd);
+}
+
+bool MockServer::route(int fd, const std::string& method, const std::string& target, const std::string& range,
+    bool& keep_alive)
+{
+    std::string path = target.substr(0, target.find('?'));
+    if (path.rfind("/files/", 0) == 0) {
+        auto parts = split_path(path);
+        int mod = parts.size() > 1 ? to_int(parts[1]) : 0;
+        if (method == "HEAD" || options_.max_downloads <= 0) {
+            return send_archive(fd, mod, range, method == "HEAD", keep_alive);
+        }
+        if (++downloads_ > options_.max_downloads) {
+            downloads_--;
+            throttled_++;
+            Reply reply;
+            reply.status = 429;
+            reply.content_type = "text/plain";
+            reply.headers.push_back("Retry-After: " + std::to_string(options_.retry_after));
+            return send_reply(fd, reply, keep_alive);
+        }
+        bool open = send_archive(fd, mod, range, false, keep_alive);
+        downloads_--;
+        return open;
+    }
+    if (should_throttle()) {
+        throttled_++;
+        Reply reply;
+        reply.status = 429;
+        reply.body = "{\"message\":\"Too Many Requests\"}";
+        reply.headers.push_back("Retry-After: " + std::to_string(options_.retry_after));
+        return send_reply(fd, reply, keep_alive);
+    }
+    auto question = target.find('?');
+    return send_reply(fd, api_reply(path, question == std::string::npos ? "" : target.substr(question + 1)), keep_alive);
+}
+
+bool MockServer::should_throttle()
+{
+    if (options_.throttle_fraction <= 0.0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(rng_mutex_);
+    return std::bernoulli_distribution(options_.throttle_fraction)(rng_);
+}
+
+/**
+ * Synthetic JSON for the API routes. File ids are mod_id * 1000 + n, and every
+ * archive URL points back at this server's /files/ route.
+ */
+MockServer::Reply MockServer::api_reply(const std::string& path, const std::string& query)
+{
+    Reply reply;
+    // Generous limits so the client's rate limiter never has a reason to pace.
+    reply.headers = { "x-rl-daily-limit: 100000000", "x-rl-daily-remaining: 99999999",
+        "x-rl-hourly-limit: 10000000", "x-rl-hourly-remaining: 9999999" };
+
+    auto parts = split_path(path);
+    std::ostringstream body;
+
+    // /nexus/v1/user/tracked_mods.json
+    if (parts.size() == 4 && parts[0] == "nexus" && parts[2] == "user" && parts[3] == "tracked_mods.json") {
+        body << "[";
+        for (int mod = 1; mod <= options_.mods; mod++) {
+            body << (mod > 1 ? "," : "") << "{\"mod_id\":" << mod << ",\"domain_name\":\"" << options_.game_domain << "\"}";
+        }
+        body << "]";
+        reply.body = body.str();
+        return reply;
+    }
+
+    // /nexus/v1/games/<domain>/mods/updated.json?period=<1d|1w|1m>
+    if (parts.size() == 6 && parts[0] == "nexus" && parts[2] == "games" && parts[4] == "mods"
+        && parts[5] == "updated.json") {
+        long long now = static_cast<long long>(std::time(nullptr));
+        body << "[";
+        bool first = true;
+        for (int mod = options_.updated_every; options_.updated_every > 0 && mod <= options_.mods;
+             mod += options_.updated_every) {
+            body << (first ? "" : ",") << "{\"mod_id\":" << mod << ",\"latest_file_update\":" << now
+                 << ",\"latest_mod_activity\":" << now << "}";
+            first = false;
+        }
+        body << "]";
+        reply.body = body.str();
+        return reply;
+    }
+
+    // /nexus/v1/games/<domain>/mods/<mod>[/files.json | /files/<file>/download_link.json]
+    if (parts.size() >= 6 && parts[0] == "nexus" && parts[2] == "games" && parts[4] == "mods") {
+        int mod = to_int(parts[5]);
+        if (mod < 1 || mod > options_.mods) {
+            reply.status = 404;
+            reply.body = "{\"message\":\"No Mod Found\"}";
+            return reply;
+        }
+        if (parts.size() == 6) {
+            body << "{\"mod_id\":" << mod << ",\"name\":\"Bench Mod " << mod << "\",\"domain_name\":\""
+                 << options_.game_domain << "\"}";
+        } else if (parts.size() == 7 && parts[6] == "files.json") {
+            body << "{\"files\":[";
+            for (int n = 0; n < options_.files_per_mod; n++) {
+                int file = mod * 1000 + n;
+                body << (n > 0 ? "," : "") << "{\"file_id\":" << file << ",\"name\":\"Main\",\"file_name\":\"mod_"
+                     << mod << "_" << file << ".zip\",\"category_name\":\"MAIN\",\"md5\":\"" << archive_md5_for(mod)
+                     << "\",\"size_kb\":" << archive_size_for(mod) / 1024 << ",\"size_in_bytes\":" << archive_size_for(mod) << "}";
+            }
+            body << "],\"file_updates\":[]}";
+        } else if (parts.size() == 9 && parts[6] == "files" && parts[8] == "download_link.json") {
+            body << "[{\"name\":\"Bench CDN\",\"short_name\":\"bench\",\"URI\":\"" << base_url() << "/files/"
+                 << mod << "/" << parts[7] << "/mod_" << mod << "_" << parts[7] << ".zip\"}]";
+        } else {
+            reply.status = 404;
+            body << "{\"message\":\"Not Found\"}";
+        }
+        reply.body = body.str();
+        return reply;
+    }
+
+    // /gamebanana/Member/<user>/Subscriptions?_nPage=<n>&_nPerpage=<m>
+    if (parts.size() == 4 && parts[0] == "gamebanana" && parts[1] == "Member" && parts[3] == "Subscriptions") {
+        int per_page = std::max(1, options_.subscriptions_per_page);
+        int asked = query_int(query, "_nPerpage");
+        if (asked > 0) {
+            per_page = std::min(per_page, asked);
+        }
+        int page = std::max(1, query_int(query, "_nPage"));
+        int first = (page - 1) * per_page + 1;
+        int last = std::min(options_.mods, page * per_page);
+        body << "{\"_aMetadata\":{\"_nRecordCount\":" << options_.mods << ",\"_nPerpage\":" << per_page
+             << ",\"_bIsComplete\":" << (last >= options_.mods ? "true" : "false") << "},\"_aRecords\":[";
+        for (int mod = first; mod <= last; mod++) {
+            body << (mod > first ? "," : "") << "{\"_idRow\":" << mod << ",\"_aSubscription\":{\"_sSingularTitle\":\"Mod\","
+                 << "\"_sProfileUrl\":\"https://gamebanana.com/mods/" << mod << "\",\"_sName\":\"Bench Mod " << mod << "\"}}";
+        }
+        body << "]}";
+        reply.body = body.str();
+        return reply;
+    }
+
+    // /gamebanana/Mod/<mod>?_csvProperties=_aFiles
+    if (parts.size() == 3 && parts[0] == "gamebanana" && parts[1] == "Mod") {
+        int mod = to_int(parts[2]);
+        body << "{\"_aFiles\":[";
+        for (int n = 0; n < options_.files_per_mod && mod >= 1; n++) {
+            int file = mod * 1000 + n;
+            body << (n > 0 ? "," : "") << "{\"_idRow\":" << file << ",\"_sFile\":\"gb_" << mod << "_" << file
+                 << ".zip\",\"_nFilesize\":" << archive_size_for(mod) << ",\"_sDownloadUrl\":\"" << base_url() << "/files/" << mod
+                 << "/" << file << "/gb_" << mod << "_" << file << ".zip\",\"_sMd5Checksum\":\"" << archive_md5_for(mod) << "\"}";
+        }
+        body << "]}";
+        reply.body = body.str();
+        return reply;
+    }
+
+    reply.status = 404;
+    reply.body = "{\"message\":\"Not Found\"}";
+    return reply;
+}
+
+/**
+ * Streams an archive body, honouring "bytes=N-" and "bytes=N-M" ranges so resumes and
+ * segmented downloads can be exercised, and pacing each connection's writes when a
+ * bandwidth cap is set (per connection, and for the shared link). A HEAD request gets
+ * the headers alone.
+ */
+bool MockServer::send_archive(int fd, int mod, const std::string& range, bool head_only, bool keep_alive)
+{
+    uintmax_t total = archive_size_for(mod);
+    uintmax_t start = 0;
+    uintmax_t end = total; // exclusive
+    bool ranged = range.rfind("bytes=", 0) == 0;
+    if (ranged) {
+        try {
+            std::string spec = range.substr(6);
+            auto dash = spec.find('-');
+            start = std::stoull(spec.substr(0, dash));
+            if (dash != std::string::npos && dash + 1 < spec.size()) {
+                end = std::min<uintmax_t>(total, std::stoull(spec.substr(dash + 1)) + 1);
+            }
+        } catch (const std::exception&) {
+            start = 0;
+        }
+        if (start >= total || start >= end) {
+            Reply reply;
+            reply.status = 416;
+            reply.content_type = "text/plain";
+            reply.headers.push_back("Content-Range: bytes */" + std::to_string(total));
+            return send_reply(fd, reply, keep_alive);
+        }
+    }
+
+    std::ostringstream head;
+    head << "HTTP/1.1 " << (ranged ? 206 : 200) << " " << status_text(ranged ? 206 : 200) << "\r\n"
+         << "Content-Type: application/octet-stream\r\n"
+         << "Content-Length: " << (end - start) << "\r\n"
+         << "Accept-Ranges: bytes\r\n";
+    if (ranged) {
+        head << "Content-Range: bytes " << start << "-" << (end - 1) << "/" << total << "\r\n";
+    }
+    head << (keep_alive ? "" : "Connection: close\r\n") << "\r\n";
+    std::string header = head.str();
+    if (!send_all(fd, header.data(), header.size())) {
+        return false;
+    }
+    if (head_only) {
+        return keep_alive;
+    }
+
+    const auto& pattern = archive_pattern();
+    auto began = std::chrono::steady_clock::now();
+    uintmax_t sent = 0;
+    for (uintmax_t offset = start; offset < end;) {
+        size_t at = static_cast<size_t>(offset % PATTERN_SIZE);
+        size_t n = static_cast<size_t>(std::min<uintmax_t>(PATTERN_SIZE - at, end - offset));
+        pace_link(n);
+        if (!send_all(fd, pattern.data() + at, n)) {
+            return false;
+        }
+        offset += n;
+        sent += n;
+        if (options_.bandwidth > 0) {
+            auto due = began + std::chrono::microseconds(sent * 1000000 / options_.bandwidth);
+            std::this_thread::sleep_until(due);
+        }
+    }
+    return keep_alive;
+}
+
+/**
+ * Waits for this connection's turn on the shared link, which carries link_bandwidth
+ * bytes per second between all archive transfers, first come first served.
+ */
+void MockServer::pace_link(size_t bytes)
+{
+    if (options_.link_bandwidth == 0) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point due;
+    {
+        std::lock_guard<std::mutex> lock(link_mutex_);
+        due = std::max(now, link_free_);
+        link_free_ = due + std::chrono::microseconds(bytes * 1000000 / options_.link_bandwidth);
+    }
+    std::this_thread::sleep_until(due);
+}
+
+bool MockServer::send_reply(int fd, const Reply& reply, bool keep_alive)
+{
+    std::ostringstream out;
+    out << "HTTP/1.1 " << reply.status << " " << status_text(reply.status) << "\r\n"
+        << "Content-Type: " << reply.content_type << "\r\n"
+        << "Content-Length: " << reply.body.size() << "\r\n";
+    for (const auto& header : reply.headers) {
+        out << header << "\r\n";
+    }
+    out << (keep_alive ? "" : "Connection: close\r\n") << "\r\n"
+        << reply.body;
+    std::string data = out.str();
+    return send_all(fd, data.data(), data.size()) && keep_alive;
+}
+
+bool MockServer::send_all(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        bytes_sent_ += static_cast<uint64_t>(n);
+    }
+    return true;
+}
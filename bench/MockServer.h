@@ -0,0 +1,110 @@
+#ifndef MOCKSERVER_H
+#define MOCKSERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What the stand-in server pretends to host, and how badly it behaves.
+struct MockServerOptions {
+    int mods = 10;                   // mod ids 1..mods, tracked on Nexus and subscribed on GameBanana
+    int files_per_mod = 1;
+    int updated_every = 100;         // updated.json lists every Nth mod as just updated; 0 = none
+    int subscriptions_per_page = 50; // most GameBanana subscriptions per page, whatever _nPerpage asks for
+    uintmax_t archive_size = 4096;   // bytes in every archive body
+    int large_every = 0;             // every Nth mod ships large_archive_size archives instead; 0 = none
+    uintmax_t large_archive_size = 0;
+    int latency_ms = 0;              // added before every response
+    uintmax_t bandwidth = 0;         // bytes per second per connection for archives; 0 = unlimited
+    uintmax_t link_bandwidth = 0;    // bytes per second shared by all archive transfers; 0 = unlimited
+    int max_downloads = 0;           // archive transfers served at once before answering 429; 0 = no limit
+    double throttle_fraction = 0.0;  // share of API requests answered with 429
+    int retry_after = 1;             // seconds, sent with each 429
+    std::string game_domain = "benchgame";
+};
+
+// Minimal HTTP/1.1 server on 127.0.0.1 that answers the NexusMods and GameBanana
+// endpoints this tool uses with synthetic data, plus the archive downloads they
+// point at. API routes live under /nexus/v1 and /gamebanana; archives under /files.
+// Archive bodies are generated on the fly, so multi-GB sizes cost no memory or disk.
+class MockServer {
+public:
+    explicit MockServer(MockServerOptions options);
+    ~MockServer();
+
+    MockServer(const MockServer&) = delete;
+    MockServer& operator=(const MockServer&) = delete;
+
+    // Binds an ephemeral port and starts accepting. False if the socket could not be set up.
+    bool start();
+    void stop();
+
+    std::string base_url() const;
+    std::string nexus_url() const { return base_url() + "/nexus/v1"; }
+    std::string gamebanana_url() const { return base_url() + "/gamebanana"; }
+
+    // MD5 of every archive body, as advertised in files.json and _aFiles.
+    const std::string& archive_md5() const { return archive_md5_; }
+
+    // Size and MD5 of the archives of one mod (see large_every).
+    bool large_mod(int mod) const;
+    uintmax_t archive_size_for(int mod) const { return large_mod(mod) ? options_.large_archive_size : options_.archive_size; }
+    const std::string& archive_md5_for(int mod) const { return large_mod(mod) ? large_archive_md5_ : archive_md5_; }
+
+    uint64_t requests() const { return requests_; }
+
+    // True on the threads that serve connections, so the benchmark can leave the
+    // server's own work out of what it measures.
+    static bool on_server_thread();
+    uint64_t throttled() const { return throttled_; }
+    uint64_t bytes_sent() const { return bytes_sent_; }
+
+private:
+    struct Reply {
+        int status = 200;
+        std::string content_type = "application/json";
+        std::string body;
+        std::vector<std::string> headers;
+    };
+
+    void accept_loop();
+    void serve(int fd);
+    bool route(int fd, const std::string& method, const std::string& target, const std::string& range, bool& keep_alive);
+    Reply api_reply(const std::string& path, const std::string& query);
+    bool send_archive(int fd, int mod, const std::string& range, bool head_only, bool keep_alive);
+    bool send_reply(int fd, const Reply& reply, bool keep_alive);
+    bool send_all(int fd, const char* data, size_t size);
+    bool should_throttle();
+    void pace_link(size_t bytes);
+
+    MockServerOptions options_;
+    std::string archive_md5_;
+    std::string large_archive_md5_;
+    int listen_fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_ { false };
+    std::thread acceptor_;
+
+    std::mutex clients_mutex_;
+    std::set<int> client_fds_;
+    std::vector<std::thread> workers_;
+
+    std::mutex rng_mutex_;
+    std::mt19937 rng_ { 12345 };
+
+    std::mutex link_mutex_;
+    std::chrono::steady_clock::time_point link_free_ {}; // when the shared link has sent everything queued on it
+    std::atomic<int> downloads_ { 0 };
+
+    std::atomic<uint64_t> requests_ { 0 };
+    std::atomic<uint64_t> throttled_ { 0 };
+    std::atomic<uint64_t> bytes_sent_ { 0 };
+};
+
+#endif // MOCKSERVER_H
@@ -0,0 +1,491 @@
+#include "Deploy.h"
+#include "DownloadScheduler.h"
+#include "GameBanana.h"
+#include "LibraryIndex.h"
+#include "Metrics.h"
+#include "MockServer.h"
+#include "NexusMods.h"
+#include "Rename.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Define the global API_KEY declared in NexusMods.h
+std::string API_KEY = "bench";
+
+// Heap allocations made by the client side of the benchmark (the mock server's own
+// threads are left out), counted by the replacement operator new below.
+static std::atomic<uint64_t> allocations { 0 };
+
+void* operator new(std::size_t size)
+{
+    if (!MockServer::on_server_thread()) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+struct BenchOptions {
+    std::vector<int> scales { 10, 1000, 50000 };
+    MockServerOptions server;
+    bool verbose = false;
+    bool keep = false;
+    bool cache = false;
+    bool metadata_only = false; // stop after generate_download_links
+    std::string stats; // directory for stats.json / stats.prom; empty = don't write
+};
+
+struct StageResult {
+    std::string name;
+    double seconds = 0;
+    size_t items = 0;
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t allocations = 0;
+    long peak_rss_kb = 0; // of the whole process, at the end of the stage
+};
+
+// Swallows the library's per-request progress output while a stage is timed.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+};
+
+uintmax_t parse_size(const std::string& text)
+{
+    size_t used = 0;
+    double value = std::stod(text, &used);
+    std::string suffix = text.substr(used);
+    if (suffix == "K" || suffix == "k") {
+        value *= 1024;
+    } else if (suffix == "M" || suffix == "m") {
+        value *= 1024 * 1024;
+    } else if (suffix == "G" || suffix == "g") {
+        value *= 1024.0 * 1024 * 1024;
+    }
+    return static_cast<uintmax_t>(value);
+}
+
+std::vector<int> parse_scales(const std::string& text)
+{
+    std::vector<int> scales;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        scales.push_back(std::stoi(item));
+    }
+    return scales;
+}
+
+void usage()
+{
+    std::cout << "Usage: modular_bench [options]\n"
+                 "  --scales LIST        comma-separated mod counts (default 10,1000,50000)\n"
+                 "  --files-per-mod N    files listed for every mod (default 1)\n"
+                 "  --updated-every N    updated.json lists every Nth mod as just updated (default 100)\n"
+                 "  --per-page N         GameBanana subscriptions per page (default 50)\n"
+                 "  --archive-size SIZE  bytes per archive, K/M/G suffixes allowed (default 4K)\n"
+                 "  --large-every N      every Nth mod ships --large-size archives instead (default none)\n"
+                 "  --large-size SIZE    bytes per archive of those mods (default 64 x --archive-size)\n"
+                 "  --latency-ms N       delay before every response (default 0)\n"
+                 "  --bandwidth SIZE     per-connection archive bandwidth cap per second (default unlimited)\n"
+                 "  --link-bandwidth SIZE  archive bandwidth per second shared by all connections (default unlimited)\n"
+                 "  --max-downloads N    archive transfers served at once before answering 429 (default no limit)\n"
+                 "  --throttle FRACTION  share of API requests answered with 429 (default 0)\n"
+                 "  --retry-after N      seconds sent with each 429 (default 1)\n"
+                 "  --parallel N         sets MODULAR_PARALLEL_DOWNLOADS\n"
+                 "  --stats DIR          write the run's request/stage histograms to DIR\n"
+                 "  --metadata-only      run only the API stages, up to generate_download_links\n"
+                 "  --cache              leave the response cache enabled\n"
+                 "  --keep               keep each run's scratch directory\n"
+                 "  --verbose            show the library's progress output\n";
+}
+
+bool parse_args(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument(arg + " needs a value");
+            }
+            return argv[++i];
+        };
+        if (arg == "--scales") {
+            options.scales = parse_scales(value());
+        } else if (arg == "--files-per-mod") {
+            options.server.files_per_mod = std::stoi(value());
+        } else if (arg == "--updated-every") {
+            options.server.updated_every = std::stoi(value());
+        } else if (arg == "--per-page") {
+            options.server.subscriptions_per_page = std::stoi(value());
+        } else if (arg == "--archive-size") {
+            options.server.archive_size = parse_size(value());
+        } else if (arg == "--large-every") {
+            options.server.large_every = std::stoi(value());
+        } else if (arg == "--large-size") {
+            options.server.large_archive_size = parse_size(value());
+        } else if (arg == "--latency-ms") {
+            options.server.latency_ms = std::stoi(value());
+        } else if (arg == "--bandwidth") {
+            options.server.bandwidth = parse_size(value());
+        } else if (arg == "--link-bandwidth") {
+            options.server.link_bandwidth = parse_size(value());
+        } else if (arg == "--max-downloads") {
+            options.server.max_downloads = std::stoi(value());
+        } else if (arg == "--throttle") {
+            options.server.throttle_fraction = std::stod(value());
+        } else if (arg == "--retry-after") {
+            options.server.retry_after = std::stoi(value());
+        } else if (arg == "--parallel") {
+            setenv("MODULAR_PARALLEL_DOWNLOADS", value().c_str(), 1);
+        } else if (arg == "--stats") {
+            options.stats = value();
+        } else if (arg == "--metadata-only") {
+            options.metadata_only = true;
+        } else if (arg == "--cache") {
+            options.cache = true;
+        } else if (arg == "--keep") {
+            options.keep = true;
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else {
+            usage();
+            return false;
+        }
+    }
+    if (options.server.large_every > 0 && options.server.large_archive_size == 0) {
+        options.server.large_archive_size = options.server.archive_size * 64;
+    }
+    return true;
+}
+
+std::string human_bytes(double bytes)
+{
+    const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+    int unit = 0;
+    while (bytes >= 1024 && unit < 4) {
+        bytes /= 1024;
+        unit++;
+    }
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << " " << units[unit];
+    return out.str();
+}
+
+/**
+ * When each mod's files were all on disk, relative to began: the last write to any
+ * file in its directory.
+ */
+std::string mod_ready_summary(const fs::path& domainDir, fs::file_time_type began)
+{
+    std::vector<double> ready;
+    std::error_code ec;
+    for (const auto& mod : fs::directory_iterator(domainDir, ec)) {
+        if (!mod.is_directory()) {
+            continue;
+        }
+        fs::file_time_type last = began;
+        for (const auto& file : fs::directory_iterator(mod.path(), ec)) {
+            if (file.is_regular_file()) {
+                last = std::max(last, file.last_write_time());
+            }
+        }
+        ready.push_back(std::chrono::duration<double>(last - began).count());
+    }
+    if (ready.empty()) {
+        return "no mods downloaded";
+    }
+    std::sort(ready.begin(), ready.end());
+    auto at = [&](double share) { return ready[static_cast<size_t>(share * static_cast<double>(ready.size() - 1))]; };
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(3) << "half the mods complete after " << at(0.5) << " s, 90% after "
+         << at(0.9) << " s, all after " << ready.back() << " s";
+    return text.str();
+}
+
+void print_results(std::ostream& out, int scale, const std::vector<StageResult>& stages)
+{
+    out << "\n== " << scale << " mods ==\n"
+        << std::left << std::setw(26) << "stage" << std::right << std::setw(10) << "seconds"
+        << std::setw(10) << "items" << std::setw(12) << "items/s" << std::setw(11) << "requests"
+        << std::setw(14) << "transferred" << std::setw(14) << "throughput" << std::setw(12) << "allocs"
+        << std::setw(12) << "peak RSS" << "\n";
+
+    StageResult total { "end-to-end" };
+    auto row = [&](const StageResult& stage) {
+        double seconds = stage.seconds > 0 ? stage.seconds : 1e-9;
+        out << std::left << std::setw(26) << stage.name << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << stage.seconds << std::setw(10) << stage.items << std::setprecision(1)
+            << std::setw(12) << stage.items / seconds << std::setw(11) << stage.requests
+            << std::setw(14) << human_bytes(static_cast<double>(stage.bytes))
+            << std::setw(14) << human_bytes(stage.bytes / seconds) + "/s" << std::setw(12) << stage.allocations
+            << std::setw(12) << human_bytes(static_cast<double>(stage.peak_rss_kb) * 1024) << "\n";
+    };
+    for (const auto& stage : stages) {
+        row(stage);
+        total.seconds += stage.seconds;
+        total.items += stage.items;
+        total.requests += stage.requests;
+        total.bytes += stage.bytes;
+        total.allocations += stage.allocations;
+        total.peak_rss_kb = std::max(total.peak_rss_kb, stage.peak_rss_kb);
+    }
+    row(total);
+    out.flush();
+}
+
+/**
+ * Runs every stage of the NexusMods, GameBanana and Rename sequences once against a
+ * fresh mock server and scratch $HOME holding `scale` mods.
+ */
+std::vector<StageResult> run_scale(int scale, const BenchOptions& options, std::ostream& out)
+{
+    MockServerOptions serverOptions = options.server;
+    serverOptions.mods = scale;
+    MockServer server(serverOptions);
+    if (!server.start()) {
+        out << "Could not start the mock server.\n";
+        return {};
+    }
+
+    char scratchTemplate[] = "/tmp/modular_bench_XXXXXX";
+    if (!mkdtemp(scratchTemplate)) {
+        out << "Could not create a scratch directory.\n";
+        return {};
+    }
+    fs::path home = scratchTemplate;
+    setenv("HOME", home.c_str(), 1);
+    setenv("MODULAR_NEXUS_API_URL", server.nexus_url().c_str(), 1);
+    setenv("MODULAR_GAMEBANANA_API_URL", server.gamebanana_url().c_str(), 1);
+    if (!options.cache) {
+        setenv("MODULAR_NO_CACHE", "1", 1);
+    }
+
+    const std::string domain = serverOptions.game_domain;
+    fs::path domainDir = home / "Games" / "Mods-Lists" / domain;
+    std::vector<StageResult> results;
+
+    NullBuffer nullBuffer;
+    std::streambuf* original = std::cout.rdbuf();
+    auto stage = [&](const std::string& name, const auto& body) {
+        uint64_t requests = server.requests();
+        uint64_t bytes = server.bytes_sent();
+        if (!options.verbose) {
+            std::cout.rdbuf(&nullBuffer);
+        }
+        uint64_t allocated = allocations.load();
+        auto began = std::chrono::steady_clock::now();
+        size_t items = body();
+        auto ended = std::chrono::steady_clock::now();
+        uint64_t stageAllocations = allocations.load() - allocated;
+        std::cout.rdbuf(original);
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        results.push_back({ name, std::chrono::duration<double>(ended - began).count(), items,
+            server.requests() - requests, server.bytes_sent() - bytes, stageAllocations, usage.ru_maxrss });
+    };
+
+    std::vector<int> modIds;
+    std::map<int, std::vector<int>> fileIds;
+    std::map<std::pair<int, int>, std::string> links;
+
+    stage("get_tracked_mods", [&] {
+        modIds = get_tracked_mods();
+        return modIds.size();
+    });
+    stage("get_file_ids", [&] {
+        fileIds = get_file_ids(modIds, domain);
+        size_t files = 0;
+        for (const auto& entry : fileIds) {
+            files += entry.second.size();
+        }
+        return files;
+    });
+    // Nothing synced in between, so only the mods updated.json names are listed again.
+    stage("get_file_ids_delta", [&] {
+        fileIds = get_file_ids(modIds, domain);
+        size_t files = 0;
+        for (const auto& entry : fileIds) {
+            files += entry.second.size();
+        }
+        return files;
+    });
+    stage("generate_download_links", [&] {
+        links = generate_download_links(fileIds, domain);
+        return links.size();
+    });
+    if (options.metadata_only) {
+        server.stop();
+        std::error_code ec;
+        fs::remove_all(home, ec);
+        return results;
+    }
+    auto downloadsBegan = fs::file_time_type::clock::now();
+    stage("download_files", [&] {
+        save_download_links(links, domain);
+        download_files(domain);
+        return links.size();
+    });
+    out << "download_files, " << download_order_name(download_order_from_env())
+        << " order: " << mod_ready_summary(domainDir, downloadsBegan) << "\n";
+
+    fs::path gameBananaDir = home / "GameBanana";
+    stage("downloadSubscribedMods", [&] {
+        auto mods = fetchSubscribedMods("1");
+        downloadSubscribedMods(mods, gameBananaDir.string());
+        return mods.size();
+    });
+
+    fs::path merged = home / "Merged" / domain;
+    stage("combineDirectories", [&] {
+        size_t count = 0;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(domainDir, ec)) {
+            if (entry.is_directory()) {
+                combineDirectories(merged, entry.path());
+                count++;
+            }
+        }
+        return count;
+    });
+
+    // Nothing changed since the first merge, so a differential merge should copy nothing.
+    stage("recombineDirectories", [&] {
+        size_t count = 0;
+        std::error_code ec;
+        for (const auto& entry : fs::directory_iterator(domainDir, ec)) {
+            if (entry.is_directory()) {
+                combineDirectories(merged, entry.path());
+                count++;
+            }
+        }
+        return count;
+    });
+
+    stage("renameModDirectories", [&] {
+        fs::path modsDir = home / "Games" / "Mods-Lists";
+        ModNameCache names(ModNameCache::defaultPath(modsDir));
+        names.load();
+        std::map<std::string, std::string> newNames;
+        for (const auto& [modID, name] : resolveModNames(domain, getModIDs(domainDir), names)) {
+            newNames[modID] = sanitizeFilename(name);
+        }
+        return renameModDirectories(domainDir, newNames);
+    });
+
+    // A cold scan of the library into a new index, then a restart that maps it and only stats directories.
+    fs::path library = home / "Games" / "Mods-Lists";
+    stage("index_full_scan", [&] {
+        LibraryIndex index(library);
+        index.refresh();
+        index.save();
+        return index.size();
+    });
+    stage("index_delta_scan", [&] {
+        LibraryIndex index(library);
+        index.load();
+        index.refresh();
+        return index.size();
+    });
+
+    // Two profiles (every mod, every other mod) linked into one game folder, then switched
+    // between: with both trees built, a switch should only replace the target symlink.
+    DeployProfile everyMod { domain, "all", getModDirectoryNames(domainDir) };
+    DeployProfile halfTheMods { domain, "half", {} };
+    for (size_t i = 0; i < everyMod.mods.size(); i += 2) {
+        halfTheMods.mods.push_back(everyMod.mods[i]);
+    }
+    fs::path gameDir = home / "Game" / "Data";
+    stage("deployProfile", [&] {
+        size_t files = 0;
+        for (const auto* profile : { &everyMod, &halfTheMods }) {
+            if (auto result = deployProfile(*profile, gameDir, DeployLinks::Symlink)) {
+                files += result->files;
+            }
+        }
+        return files;
+    });
+    stage("switchProfile", [&] {
+        size_t files = 0;
+        for (const auto* profile : { &everyMod, &halfTheMods }) {
+            if (auto result = deployProfile(*profile, gameDir, DeployLinks::Symlink)) {
+                files += result->files;
+            }
+        }
+        return files;
+    });
+
+    if (server.throttled() > 0) {
+        out << server.throttled() << " requests were answered with 429.\n";
+    }
+    server.stop();
+
+    if (options.keep) {
+        out << "Scratch directory kept at " << home << "\n";
+    } else {
+        std::error_code ec;
+        fs::remove_all(home, ec);
+    }
+    return results;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    try {
+        if (!parse_args(argc, argv, options)) {
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Invalid arguments: " << e.what() << "\n";
+        usage();
+        return 1;
+    }
+
+    std::ostream& out = std::cout;
+    out << "Archive size " << human_bytes(static_cast<double>(options.server.archive_size)) << ", "
+        << options.server.files_per_mod << " file(s) per mod, latency " << options.server.latency_ms << " ms, "
+        << "429 share " << options.server.throttle_fraction << "\n";
+
+    for (int scale : options.scales) {
+        auto results = run_scale(scale, options, out);
+        if (!results.empty()) {
+            print_results(out, scale, results);
+        }
+    }
+    if (!options.stats.empty() && Metrics::instance().write(options.stats)) {
+        out << "\nStats written to " << options.stats << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+// Fixed-capacity, multi-producer/multi-consumer queue that connects pipeline stages.
+// push() blocks while the queue is full, which is what keeps a fast producer from
+// running arbitrarily far ahead of its consumer. close() marks the end of input:
+// consumers drain what is left and then see std::nullopt.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity_(capacity ? capacity : 1)
+    {
+    }
+
+    // Blocks while full. Returns false (and drops the item) if the queue was closed.
+    bool push(T item)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+            if (closed_) {
+                return false;
+            }
+            items_.push_back(std::move(item));
+        }
+        not_empty_.notify_one();
+        notify_listener();
+        return true;
+    }
+
+    // Blocks while empty and open. std::nullopt once the queue is closed and drained.
+    std::optional<T> pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        return take(lock);
+    }
+
+    // Never blocks. std::nullopt if nothing is queued right now.
+    std::optional<T> try_pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return take(lock);
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+        notify_listener();
+    }
+
+    // True if try_pop() would return an item right now.
+    bool ready() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !items_.empty();
+    }
+
+    // True once the queue is closed and every item has been taken.
+    bool drained() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return closed_ && items_.empty();
+    }
+
+    // Called (outside the lock) after every push and on close, e.g. to wake an event loop.
+    void set_listener(std::function<void()> listener)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        listener_ = std::move(listener);
+    }
+
+private:
+    std::optional<T> take(std::unique_lock<std::mutex>& lock)
+    {
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T item = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return item;
+    }
+
+    void notify_listener()
+    {
+        std::function<void()> listener;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            listener = listener_;
+        }
+        if (listener) {
+            listener();
+        }
+    }
+
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<T> items_;
+    bool closed_ = false;
+    std::function<void()> listener_;
+};
+
+#endif // BOUNDEDQUEUE_H
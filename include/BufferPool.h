@@ -0,0 +1,34 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide free list of the strings HTTP response bodies are received into.
+// A metadata phase makes thousands of similar requests; handing each response a
+// buffer that an earlier one already grew means the body costs no allocation at all
+// once the pool is warm, instead of a fresh string grown by repeated appends.
+class BufferPool {
+public:
+    static BufferPool& instance();
+
+    // An empty string with room for at least capacity bytes, reused when one is free.
+    std::string acquire(size_t capacity = 0);
+
+    // Takes a buffer back for reuse. Very large buffers, and any beyond the pool's
+    // size, are simply freed.
+    void release(std::string&& buffer);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+private:
+    BufferPool() = default;
+
+    std::mutex mutex_;
+    std::vector<std::string> free_;
+};
+
+#endif // BUFFERPOOL_H
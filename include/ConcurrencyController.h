@@ -0,0 +1,125 @@
+#ifndef CONCURRENCYCONTROLLER_H
+#define CONCURRENCYCONTROLLER_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// How one download attempt ended, as far as the controller cares.
+enum class TransferOutcome {
+    Ok,        // the server sent what was asked for
+    Throttled, // 429 or 503: the host wants fewer requests
+    Failed,    // connection error, timeout or other 5xx
+    Other      // anything else (404, checksum mismatch...); says nothing about load
+};
+
+// Limits for the download stage.
+struct ConcurrencyOptions {
+    bool adaptive = true;         // false = keep initial transfers throughout
+    int initial = 4;              // transfers to start with
+    int min = 1;
+    int max = 16;
+    uint64_t rate_limit = 0;      // bytes per second for all downloads together; 0 = none
+    uint64_t host_rate_limit = 0; // bytes per second for each host; 0 = none
+};
+
+// From MODULAR_DOWNLOAD_ADAPTIVE (0 turns adaptation off), MODULAR_PARALLEL_DOWNLOADS_MAX
+// (default 16), MODULAR_DOWNLOAD_RATE and MODULAR_HOST_DOWNLOAD_RATE (bytes per second,
+// with an optional K, M or G suffix), starting at initial transfers.
+ConcurrencyOptions concurrency_options_from_env(int initial);
+
+// Decides how many downloads may run at once, AIMD style, from what the transfers see.
+//
+// Two limits apply. The global one follows aggregate throughput: while every slot is
+// busy it grows by one transfer per control interval as long as that keeps raising the
+// throughput by a few percent, and steps back once it no longer does (the link is
+// full), trying again after a while in case conditions changed. Each host also has its
+// own limit, which starts at the maximum and is halved whenever the host answers with
+// 429/503 (and cut by a quarter when many attempts fail outright), then grows back by
+// one per clean interval up to just below the level that was pushed back on; that
+// level itself is only tried again after a longer quiet spell, since every probe of a
+// host's limit costs a refused request and a retry. A transfer may start when both
+// limits have room.
+//
+// Bandwidth caps are split evenly between the connections running against them and
+// handed out as a per-connection receive speed (CURLOPT_MAX_RECV_SPEED_LARGE).
+//
+// Not thread-safe; the download engine drives it from its event loop.
+class ConcurrencyController {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit ConcurrencyController(ConcurrencyOptions options = concurrency_options_from_env(4));
+
+    // A small id for the host (and port) of url, stable for the controller's lifetime.
+    int host_id(const std::string& url);
+
+    // Whether another transfer slot may be taken for host.
+    bool may_start(int host) const;
+
+    // A transfer slot was taken or given back.
+    void slot_taken(int host);
+    void slot_released(int host);
+
+    // A connection started or ended. Rate caps are divided between connections, of
+    // which a segmented download has several in one slot.
+    void connection_opened(int host);
+    void connection_closed(int host, TransferOutcome outcome);
+
+    // Body bytes that arrived since the last call.
+    void received(uint64_t bytes);
+
+    // Receive speed for one new or running connection to host, in bytes per second; 0 = none.
+    uint64_t speed_cap(int host) const;
+
+    // Re-evaluates the limits once per control interval. True if running connections
+    // should pick up speed_cap() again (connections came or went, or a limit changed).
+    bool tick(Clock::time_point now);
+
+    // Current global limit on transfer slots.
+    int limit() const { return limit_; }
+
+    // When tick() next has something to do.
+    Clock::time_point next_tick() const { return next_tick_; }
+
+private:
+    struct Host {
+        std::string name;
+        int limit = 0;
+        int slots = 0;
+        int connections = 0;
+        int peak = 0; // most slots in use at once this interval
+        int hold = 0; // intervals to wait before raising limit again
+        int ceiling = 0; // slots in use when the host last pushed back; 0 = never did
+        bool saturated = false; // every slot the host may use was busy at some point this interval
+        bool cut = false;       // limit already lowered this interval
+        int ok = 0;
+        int throttled = 0;
+        int failed = 0;
+    };
+
+    void cut_host(Host& h, int in_use, int limit, const char* reason);
+    void change_limit(int limit, const char* reason);
+
+    ConcurrencyOptions options_;
+    std::map<std::string, int> ids_;
+    std::vector<Host> hosts_;
+    int limit_;
+    int slots_ = 0;
+    int connections_ = 0;
+    bool caps_dirty_ = false; // connections came or went since speed caps were last handed out
+
+    // Global probing state
+    bool saturated_ = false; // every slot was busy at some point this interval
+    uint64_t bytes_ = 0;     // this interval
+    Clock::time_point interval_start_ {};
+    Clock::time_point next_tick_ {};
+    bool settling_ = true; // the interval after a change is not measured
+    bool probing_ = false; // the last change was an increase still to be judged
+    double rate_before_ = 0; // throughput before the last increase
+    int hold_ = 0;           // intervals to wait before probing upward again
+};
+
+#endif // CONCURRENCYCONTROLLER_H
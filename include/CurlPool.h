@@ -0,0 +1,62 @@
+#ifndef CURLPOOL_H
+#define CURLPOOL_H
+
+#include <curl/curl.h>
+#include <mutex>
+#include <vector>
+
+// Process-wide pool of reusable easy handles.
+// Every handle is attached to one CURLSH that shares the DNS cache and TLS sessions,
+// so a request to a host we've already talked to skips the lookup and resumes the TLS
+// session. Connections are not shared: libcurl does not support one connection cache
+// used from several threads, so each multi handle (the HttpClient loop, every
+// DownloadEngine) keeps its own pool of keep-alive connections.
+class CurlHandlePool {
+public:
+    // A borrowed handle; goes back to the pool, options reset, when destroyed.
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(CurlHandlePool* pool, CURL* handle);
+        ~Lease();
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+
+        CURL* get() const { return handle_; }
+        explicit operator bool() const { return handle_ != nullptr; }
+
+    private:
+        void release();
+
+        CurlHandlePool* pool_ = nullptr;
+        CURL* handle_ = nullptr;
+    };
+
+    static CurlHandlePool& instance();
+
+    // Borrows a handle with the shared state and default options already applied.
+    // The lease is empty if libcurl could not allocate a handle.
+    Lease acquire();
+
+    ~CurlHandlePool();
+    CurlHandlePool(const CurlHandlePool&) = delete;
+    CurlHandlePool& operator=(const CurlHandlePool&) = delete;
+
+private:
+    CurlHandlePool();
+
+    void give_back(CURL* handle);
+    void apply_defaults(CURL* handle);
+
+    static void lock_cb(CURL* handle, curl_lock_data data, curl_lock_access access, void* userp);
+    static void unlock_cb(CURL* handle, curl_lock_data data, void* userp);
+
+    CURLSH* share_ = nullptr;
+    std::mutex share_locks_[CURL_LOCK_DATA_LAST];
+    std::mutex idle_mutex_;
+    std::vector<CURL*> idle_;
+};
+
+#endif // CURLPOOL_H
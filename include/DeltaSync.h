@@ -0,0 +1,59 @@
+#ifndef DELTASYNC_H
+#define DELTASYNC_H
+
+#include "NexusMods.h"
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Whether NexusMods syncs list only the mods that changed since the last one, from
+// MODULAR_DELTA_SYNC (default on; 0 lists every mod's files.json each run).
+bool delta_sync_enabled();
+
+// Skips files.json for mods that have not changed since the domain was last synced.
+//
+// The files each mod listed are remembered, with the time of the sync, in
+// ~/Games/Mods-Lists/<domain>/delta_sync.json. The next sync asks updated.json once,
+// for the shortest period (1d, 1w, 1m) that reaches back to that time plus an hour of
+// slack, and only the mods on that list, or not remembered yet, are listed again; the
+// others reuse their remembered files, md5s and sizes included. When the last sync is
+// older than a month, the list cannot be fetched, or delta sync is off, every mod is listed.
+//
+// The sync time only moves forward once every tracked mod was looked at, so an
+// interrupted run never hides an update from the next one.
+//
+// Not thread-safe; one metadata stage drives it.
+class DeltaSync {
+public:
+    explicit DeltaSync(const std::string& game_domain);
+
+    // Reads the remembered state and decides, for these tracked mods, which need listing.
+    void begin(const std::vector<int>& mod_ids);
+
+    // The mod's file ids: remembered ones if it is unchanged, else from get_mod_file_ids().
+    std::vector<int> mod_file_ids(int mod_id);
+
+    // Saves what was learned. Returns false if the state could not be written.
+    bool finish();
+
+private:
+    std::filesystem::path state_path() const;
+    bool load();
+    std::string period_for(long long since) const;
+    bool fetch_updated(const std::string& period, long long since);
+
+    std::string game_domain_;
+    std::filesystem::path domain_directory_;
+    long long last_sync_ = 0;  // Unix time of the last complete sync; 0 = none
+    long long started_ = 0;    // when this one asked what changed
+    bool delta_ = false;       // updated.json answered, so unchanged mods may be skipped
+    std::set<int> updated_;    // mods updated.json lists as changed since last_sync_
+    std::set<int> tracked_;    // mods passed to begin()
+    std::set<int> visited_;    // of tracked_, mods mod_file_ids() was asked about
+    std::map<int, std::vector<NexusFileInfo>> files_; // per mod, as last listed
+    size_t listed_ = 0;        // files.json requests made
+};
+
+#endif // DELTASYNC_H
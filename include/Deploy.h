@@ -0,0 +1,64 @@
+#ifndef DEPLOY_H
+#define DEPLOY_H
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+// A named modlist for one game domain: mod folders under ~/Games/Mods-Lists/<domain>,
+// lowest priority first (a later mod's file wins over an earlier one's).
+// Stored as ~/Games/Mods-Lists/.profiles/<domain>/<name>.txt, one folder per line.
+struct DeployProfile {
+    std::string gameDomain;
+    std::string name;
+    std::vector<std::string> mods;
+};
+
+// How deployed files point back at the mod folders.
+enum class DeployLinks {
+    Symlink, // works across filesystems; the game sees a link
+    Hardlink // same filesystem only; falls back to a symlink per file when it fails
+};
+
+// What a deployment did.
+struct DeployStats {
+    size_t files = 0;     // files in the deployed profile
+    size_t linked = 0;    // links created or replaced
+    size_t unchanged = 0; // links the tree already had
+    size_t removed = 0;   // links removed because the profile no longer has the file
+    size_t failed = 0;
+    std::filesystem::path tree; // the directory the target now points at
+};
+
+// Where profiles are kept: ~/Games/Mods-Lists/.profiles/<domain>.
+std::filesystem::path profileDirectory(const std::string& gameDomain);
+
+// Reads a profile. Blank lines and lines starting with '#' are ignored.
+bool loadProfile(const std::string& gameDomain, const std::string& name, DeployProfile& profile);
+bool saveProfile(const DeployProfile& profile);
+
+// Names of the profiles saved for a game domain.
+std::vector<std::string> listProfiles(const std::string& gameDomain);
+
+// DeployLinks::Hardlink if MODULAR_DEPLOY_LINKS is "hard", symlinks otherwise.
+DeployLinks deployLinksFromEnv();
+
+// Default deployment target from MODULAR_DEPLOY_TARGET (empty = ask).
+std::filesystem::path deployTargetFromEnv();
+
+// The profile target currently points at, or an empty string.
+std::string activeProfile(const std::filesystem::path& target);
+
+// Makes target show the profile's files: target becomes a symlink to a tree of links
+// into the mod folders (each mod's "extracted" directory when it has one, else the
+// folder itself). Trees live next to target in .<target name>.modular/, two per
+// profile, and the one not in use is brought up to date by changing only the links
+// that differ from what it held, then swapped in with a single rename() of the target
+// symlink. Switching to a profile whose tree is current therefore touches nothing but
+// that symlink. An existing non-empty real directory at target is left alone (error).
+std::optional<DeployStats> deployProfile(const DeployProfile& profile, const std::filesystem::path& target,
+    DeployLinks links = deployLinksFromEnv());
+
+#endif // DEPLOY_H
@@ -0,0 +1,118 @@
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class DiskWriter;
+
+// A file being downloaded. append() only copies into a large in-memory buffer;
+// full buffers are written by DiskWriter's thread, so the network loop never waits
+// on the disk unless the writer has fallen a long way behind.
+class StagedFile {
+public:
+    // Opens path for appending, creating it if needed. Null if it can't be opened.
+    static std::unique_ptr<StagedFile> open(const std::filesystem::path& path);
+
+    // Opens an existing file for writing from offset onwards, leaving the bytes
+    // around that range alone. Used for one byte range of a segmented download.
+    static std::unique_ptr<StagedFile> open_at(const std::filesystem::path& path, uintmax_t offset);
+    ~StagedFile();
+
+    StagedFile(const StagedFile&) = delete;
+    StagedFile& operator=(const StagedFile&) = delete;
+
+    // Asks the filesystem for room for total_size bytes up front (Linux fallocate,
+    // keeping the visible size), so a large archive lands in few extents.
+    void reserve(uintmax_t total_size);
+
+    // False once a background write has failed; the caller should abort the transfer.
+    bool append(const char* data, size_t size);
+
+    // Throws away everything written so far and starts again at byte 0.
+    bool truncate();
+
+    // Writes out the remaining buffer, waits for every queued write and closes the
+    // file. False if any write failed.
+    bool close();
+
+    // File offset up to which everything appended has been handed to the OS.
+    // Lags behind what append() accepted by whatever is still buffered or queued.
+    uintmax_t written() const;
+
+    // Time the writer thread has spent writing this file.
+    std::chrono::steady_clock::duration write_time() const;
+
+private:
+    friend class DiskWriter;
+
+    // Shared with the writer thread, which may still hold queued buffers for it.
+    struct State {
+        std::FILE* fp = nullptr;
+        std::mutex mutex;
+        std::condition_variable idle;
+        size_t queued = 0;
+        bool failed = false;
+        uintmax_t written = 0;
+        std::chrono::steady_clock::duration write_time {};
+    };
+
+    StagedFile(std::filesystem::path path, std::FILE* fp, uintmax_t size);
+    void flush_buffer();
+    void wait_idle();
+
+    std::filesystem::path path_;
+    std::shared_ptr<State> state_;
+    uintmax_t size_;     // bytes appended so far, including what is still buffered
+    uintmax_t reserved_; // largest size passed to reserve()
+    std::vector<char> buffer_;
+};
+
+// The single background thread that performs every StagedFile write, in order per file.
+class DiskWriter {
+public:
+    // Buffers are this large, and flushed at file offsets that are multiples of it.
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    static DiskWriter& instance();
+    ~DiskWriter();
+
+    DiskWriter(const DiskWriter&) = delete;
+    DiskWriter& operator=(const DiskWriter&) = delete;
+
+    // Queues a buffer that belongs at offset in the file; blocks while more than the
+    // in-flight limit is waiting to be written.
+    void submit(std::shared_ptr<StagedFile::State> file, uintmax_t offset, std::vector<char> data);
+
+    // A cleared buffer with BUFFER_SIZE capacity, reused from earlier writes when possible.
+    std::vector<char> take_buffer();
+
+private:
+    DiskWriter();
+    void run();
+
+    struct Job {
+        std::shared_ptr<StagedFile::State> file;
+        uintmax_t offset = 0;
+        std::vector<char> data;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable has_work_;
+    std::condition_variable has_room_;
+    std::deque<Job> jobs_;
+    size_t queued_bytes_ = 0;
+    std::vector<std::vector<char>> spare_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+#endif // DISKWRITER_H
@@ -0,0 +1,205 @@
+#ifndef DOWNLOADENGINE_H
+#define DOWNLOADENGINE_H
+
+#include "BoundedQueue.h"
+#include "ConcurrencyController.h"
+#include "CurlPool.h"
+#include "DiskWriter.h"
+#include "Md5.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <curl/curl.h>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+class DownloadScheduler;
+
+// A single file to fetch and where to put it.
+struct DownloadJob {
+    std::string url;
+    std::filesystem::path path;
+    int mod_id = 0;
+    int file_id = 0;
+    std::string label; // shown in progress messages; defaults to "Mod ID x, File ID y"
+    std::string expected_md5; // checked against the bytes as they arrive; empty = don't check
+    uintmax_t expected_size = 0; // exact size in bytes; 0 = unknown
+    uintmax_t size_hint = 0;     // approximate size, used only to preallocate disk space
+};
+
+// Outcome of a job once it has either succeeded or run out of attempts.
+struct DownloadResult {
+    DownloadJob job;
+    bool success = false;
+    CURLcode curl_code = CURLE_OK;
+    long http_code = 0;
+    int attempts = 0;
+    std::string md5;       // hash of the finished file, computed while it was written
+    bool verified = false; // true if it matched job.expected_md5
+};
+
+// Number of transfers to start with, from MODULAR_PARALLEL_DOWNLOADS (default 4).
+// The engine adapts it while it runs; see ConcurrencyController.
+int parallel_downloads_from_env();
+
+// Byte ranges fetched in parallel for one large download, from MODULAR_DOWNLOAD_SEGMENTS
+// (default 4; 1 turns segmenting off).
+int download_segments_from_env();
+
+// Smallest body that is split into segments, from MODULAR_SEGMENT_THRESHOLD_MB (default 256).
+uintmax_t segment_threshold_from_env();
+
+// Where a download's bytes are staged until it completes: "<path>.part".
+std::filesystem::path part_path_for(const std::filesystem::path& path);
+
+// Runs many downloads at once on a single curl multi handle.
+// Jobs are queued with add(), started in the order a DownloadScheduler picks
+// (MODULAR_DOWNLOAD_ORDER, MODULAR_DOWNLOAD_PIN), retried on failure, and reported
+// through a completion queue as they finish. How many run at once starts at
+// max_parallel and is then steered by a ConcurrencyController from the throughput
+// and the responses each host gives; a job whose host is at its limit waits for it.
+//
+// Bytes go to "<path>.part". A retry (or a later run) continues from the end of
+// that file with a Range request (a reply resuming anywhere else discards the file and
+// starts over), and the file is renamed onto <path> only once the transfer has completed. Failed attempts back off exponentially with jitter,
+// or for as long as the server's Retry-After asks.
+//
+// Every byte written is also fed to an MD5 as it streams in, so a finished file
+// is checked against the job's expected hash and size without being read back;
+// a mismatch discards the .part file and counts as a failed attempt.
+//
+// A response of at least the segment threshold from a server that advertises
+// Accept-Ranges is abandoned after its headers and fetched instead as several
+// byte ranges at once, all written into the same preallocated .part file. A
+// segment that fails is retried on its own. Progress is kept next to the file in
+// "<path>.part.segments" so a later run resumes each range where it stopped; a
+// segmented file is hashed once, after its last segment has arrived. The segments
+// of one job share its single transfer slot.
+class DownloadEngine {
+public:
+    explicit DownloadEngine(int max_parallel = 4, int max_attempts = 5);
+    ~DownloadEngine();
+
+    DownloadEngine(const DownloadEngine&) = delete;
+    DownloadEngine& operator=(const DownloadEngine&) = delete;
+
+    // Queues a job. It will be started by the next call to run().
+    void add(DownloadJob job);
+
+    // Lets another thread feed jobs while run() is going. Jobs are taken from the
+    // queue only while fewer than the current limit are waiting for a transfer slot, so a
+    // full queue pushes back on its producer and the scheduler still has a few jobs
+    // to choose between; run() does not return until the queue has been closed and drained.
+    void set_source(BoundedQueue<DownloadJob>* source);
+
+    // Drives all queued transfers until every job has completed or failed.
+    // on_complete is called from this thread for each finished job, in completion order.
+    void run(const std::function<void(const DownloadResult&)>& on_complete = {});
+
+    // Returns and clears the results that have not been handed to a callback yet.
+    std::vector<DownloadResult> take_completed();
+
+private:
+    struct SplitJob;
+
+    // Per-job retry state; lives across attempts.
+    struct Transfer {
+        DownloadJob job;
+        std::filesystem::path part;
+        int attempts = 0;
+        std::chrono::steady_clock::time_point not_before {};
+        CurlHandlePool::Lease lease;
+        CURL* easy = nullptr;
+        std::unique_ptr<StagedFile> file;
+        bool no_split = false; // fetch as one stream even if the file is large
+        bool large = false;    // counts against the scheduler's share for large mods
+        int host = 0;          // ConcurrencyController host id
+        bool waiting_for_host = false; // queued only because its host had no slot free
+
+        // Set when this transfer fetches one range of a segmented job
+        std::shared_ptr<SplitJob> split;
+        size_t segment = 0;
+
+        // Reset at the start of every attempt
+        curl_off_t offset = 0; // bytes already in the .part file when the attempt began
+        bool status_checked = false;
+        bool discard_body = false; // error responses are not written into the .part file
+        bool restart = false;      // resumed at the wrong offset; the .part file was dropped
+        bool rejected = false;     // segments: stopped after the status line, not the range asked for
+        Md5 md5;                   // covers every byte in the .part file
+        std::string retry_after;
+        std::string content_range;
+        bool accept_ranges = false;
+        curl_off_t split_above = 0;  // switch to segments if the body is at least this long; 0 = never
+        curl_off_t split_total = 0;  // body length, once the attempt was abandoned to switch
+        curl_off_t received = 0;     // body bytes accepted during this attempt
+        curl_off_t limit = 0;        // segments: file offset the range ends at
+        curl_off_t reported = 0;     // of received, bytes already counted by the controller
+    };
+
+    // One byte range [start, end) of a segmented job; done bytes from start are on disk.
+    struct Segment {
+        uintmax_t start = 0;
+        uintmax_t end = 0;
+        uintmax_t done = 0;
+        const StagedFile* file = nullptr; // while an attempt is writing it
+    };
+
+    // A job being fetched as segments. Its own Transfer is parked here until the last
+    // segment has finished or given up.
+    struct SplitJob {
+        std::unique_ptr<Transfer> owner;
+        uintmax_t total = 0;
+        std::vector<Segment> segments;
+        int outstanding = 0;      // segments running or waiting to retry
+        bool failed = false;      // a segment ran out of attempts
+        bool unsupported = false; // the server stopped honouring Range
+        CURLcode curl_code = CURLE_OK;
+        long http_code = 0;
+    };
+
+    bool start(std::unique_ptr<Transfer>& t);
+    void finish(std::unique_ptr<Transfer> t, CURLcode res);
+    bool release(Transfer& t, CURLcode res, long& http_code);
+    void conclude(std::unique_ptr<Transfer> t, bool complete, CURLcode res, long http_code);
+    void begin_split(std::unique_ptr<Transfer> t, uintmax_t total, std::vector<Segment> segments);
+    bool start_segment(std::unique_ptr<Transfer>& t);
+    void finish_segment(std::unique_ptr<Transfer> t, CURLcode res);
+    void finish_split(const std::shared_ptr<SplitJob>& split);
+    void save_segments(const SplitJob& split) const;
+    void open_connection(Transfer& t);
+    void apply_speed_caps();
+    void start_ready();
+    void drain_completed(const std::function<void(const DownloadResult&)>& on_complete);
+    std::chrono::milliseconds backoff(int attempts, const std::string& retry_after);
+
+    static void configure_handle(Transfer* t);
+    static bool load_segments(const std::filesystem::path& file, uintmax_t& total, std::vector<Segment>& segments);
+    static size_t write_cb(char* ptr, size_t size, size_t nmemb, void* userp);
+    static size_t header_cb(char* buffer, size_t size, size_t nitems, void* userp);
+
+    CURLM* multi_ = nullptr;
+    ConcurrencyController control_;
+    int max_attempts_;
+    int active_ = 0;       // transfer slots in use
+    int parked_ = 0;       // of pending_, new jobs waiting for their host
+    int large_active_ = 0; // of active_, transfers the scheduler started as large
+    int segments_;
+    uintmax_t segment_threshold_;
+    std::unique_ptr<DownloadScheduler> scheduler_;    // jobs not started yet
+    std::deque<std::unique_ptr<Transfer>> pending_; // attempts waiting to be retried or for their host
+    std::deque<std::unique_ptr<Transfer>> pending_segments_; // not limited by the slot count
+    std::vector<Transfer*> running_; // attempts on the multi handle
+    std::vector<std::shared_ptr<SplitJob>> splits_;
+    std::chrono::steady_clock::time_point next_checkpoint_ {};
+    std::deque<DownloadResult> completed_;
+    BoundedQueue<DownloadJob>* source_ = nullptr;
+    std::mt19937 rng_;
+};
+
+#endif // DOWNLOADENGINE_H
@@ -0,0 +1,95 @@
+#ifndef DOWNLOADSCHEDULER_H
+#define DOWNLOADSCHEDULER_H
+
+#include "DownloadEngine.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <vector>
+
+// The order queued downloads are started in.
+enum class DownloadOrder {
+    Listed,        // as queued
+    SmallestFirst, // smallest file first
+    LargestFirst,  // largest file first, so the longest transfers start while the pipes are empty
+    RoundRobin,    // one file from each mod in turn
+    Balanced       // see DownloadScheduler
+};
+
+// From MODULAR_DOWNLOAD_ORDER: "listed", "smallest", "largest", "round-robin" or the
+// default "balanced".
+DownloadOrder download_order_from_env();
+
+const char* download_order_name(DownloadOrder order);
+
+// Mod ids from MODULAR_DOWNLOAD_PIN (comma-separated), started before anything else
+// in the order given.
+std::vector<int> pinned_mods_from_env();
+
+// Fills in size_hint for jobs that know neither their size nor a hint, with a HEAD
+// request each, up to parallel at a time. Returns how many sizes were learned.
+size_t probe_download_sizes(std::vector<DownloadJob>& jobs, int parallel);
+
+// A job picked to start, and whether it counts against the large-transfer share.
+struct ScheduledJob {
+    DownloadJob job;
+    bool large = false;
+};
+
+// Decides which queued download gets the next free transfer slot. Sizes come from
+// the jobs' expected_size or size_hint (0 = unknown, treated as small).
+//
+// Balanced ordering aims to make as many mods usable as early as possible without
+// leaving the big transfers to the end: jobs are grouped by mod, and a mod whose
+// queued files add up to at least the large threshold is "large". Up to a quarter of
+// the slots (at least one, given two or more) go to large mods, biggest first, so the
+// long transfers run from the start; every other slot goes to the mod with the fewest
+// bytes left, one mod at a time, so small mods finish one after another. Large mods
+// take every slot once no small ones are left. Pinned mods always come first,
+// whatever the order.
+class DownloadScheduler {
+public:
+    explicit DownloadScheduler(DownloadOrder order = download_order_from_env(),
+        std::vector<int> pinned = pinned_mods_from_env(), uintmax_t large_threshold = segment_threshold_from_env());
+
+    void push(DownloadJob job);
+
+    // The next job for a free slot, given the engine's slot count and how many of the
+    // running transfers are large. Nothing if no job is queued.
+    std::optional<ScheduledJob> pop(int slots, int large_running);
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    DownloadOrder order() const { return order_; }
+
+private:
+    // Jobs of one mod, smallest first.
+    struct ModQueue {
+        std::multimap<uintmax_t, DownloadJob> files;
+        uintmax_t bytes = 0;
+        uint64_t first_seen = 0;
+    };
+
+    // (bytes left, first seen, mod id): Balanced picks from both ends.
+    using ModKey = std::tuple<uintmax_t, uint64_t, int>;
+
+    ScheduledJob take_from_mod(int mod_id, bool large);
+
+    DownloadOrder order_;
+    std::map<int, size_t> pin_rank_;
+    uintmax_t large_threshold_;
+    size_t size_ = 0;
+    uint64_t seq_ = 0;
+
+    std::multimap<std::pair<size_t, uint64_t>, DownloadJob> pinned_;   // (pin rank, seq)
+    std::multimap<std::pair<uintmax_t, uint64_t>, DownloadJob> queue_; // Listed, SmallestFirst, LargestFirst
+    std::map<int, ModQueue> mods_;                                     // RoundRobin, Balanced
+    std::deque<int> rotation_;                                         // RoundRobin: mods in turn
+    std::set<ModKey> by_bytes_;                                        // Balanced
+};
+
+#endif // DOWNLOADSCHEDULER_H
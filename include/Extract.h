@@ -0,0 +1,90 @@
+#ifndef EXTRACT_H
+#define EXTRACT_H
+
+#include "BoundedQueue.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// What extracting one archive did.
+struct ExtractResult {
+    std::filesystem::path archive;
+    std::filesystem::path destination;
+    bool success = false;
+    size_t written = 0;  // entries written to disk
+    size_t skipped = 0;  // files already present with the archive's size and modification time
+    uintmax_t bytes = 0; // bytes written
+    std::string error;
+};
+
+// True if this build can extract archives (it was built with libarchive).
+bool extraction_available();
+
+// True if downloads should be extracted as they finish: the build supports it and
+// MODULAR_EXTRACT is not set to 0.
+bool extraction_enabled();
+
+// True for the archive types mods are shipped in: .zip, .7z, .rar and (compressed) tarballs.
+bool is_archive(const std::filesystem::path& path);
+
+// Where an archive downloaded into a mod directory is unpacked: "<mod directory>/extracted".
+// Every archive of a mod goes into the same tree, later ones overwriting earlier ones.
+std::filesystem::path extraction_directory_for(const std::filesystem::path& archive);
+
+// Directory extracted mods are merged into as they finish, from MODULAR_MERGE_TARGET
+// (empty = don't merge).
+std::filesystem::path merge_target_from_env();
+
+// Worker threads for extraction, from MODULAR_EXTRACT_THREADS (default: hardware concurrency).
+unsigned extract_threads_from_env();
+
+// Streams every entry of archive straight into destination. Files that already exist
+// with the entry's size and modification time (which extraction restores) are skipped
+// without being decompressed where the format allows it. Entries with absolute paths
+// or ".." components, and writes through symlinks, are refused.
+ExtractResult extract_archive(const std::filesystem::path& archive, const std::filesystem::path& destination);
+
+// Extracts archives on worker threads as they are submitted, so extraction overlaps
+// with the downloads still running. Archives that share a destination (the archives of
+// one mod) are extracted one after another in submission order, so later ones reliably
+// overwrite earlier ones; different destinations run in parallel. When a merge target
+// is given, a destination is merged into it (see combineDirectories) once every archive
+// submitted for it so far is extracted, and nothing writes into it during the merge;
+// merges run one at a time, in the order destinations finish. That order is not fixed,
+// so the merge target is meant for mods that share no files; a merge that replaces a
+// file another mod merged there is reported.
+class ExtractPool {
+public:
+    explicit ExtractPool(std::filesystem::path merge_target = {}, unsigned threads = extract_threads_from_env());
+    ~ExtractPool();
+
+    ExtractPool(const ExtractPool&) = delete;
+    ExtractPool& operator=(const ExtractPool&) = delete;
+
+    // Queues an archive for extraction into extraction_directory_for(archive).
+    void submit(const std::filesystem::path& archive);
+
+    // Waits for every submitted archive and stops the workers. Prints a summary.
+    std::vector<ExtractResult> finish();
+
+private:
+    void work();
+    void extract_into(const std::filesystem::path& destination);
+
+    std::filesystem::path merge_target_;
+    BoundedQueue<std::filesystem::path> queue_; // destinations with archives waiting
+    std::vector<std::thread> workers_;
+    std::mutex mutex_; // guards waiting_ and results_
+    // Per destination that is queued or owned by a worker, its archives not started yet.
+    std::map<std::filesystem::path, std::deque<std::filesystem::path>> waiting_;
+    std::vector<ExtractResult> results_;
+    std::mutex merge_mutex_;
+};
+
+#endif // EXTRACT_H
@@ -1,22 +1,36 @@
 #ifndef GAMEBANANA_H
 #define GAMEBANANA_H
 
+#include "Extract.h"
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <vector>
 
+// One entry of a mod's _aFiles list.
+struct GameBananaFile {
+    std::string url;    // _sDownloadUrl
+    std::string md5;    // _sMd5Checksum, may be empty
+    uintmax_t size = 0; // _nFilesize in bytes, 0 if unknown
+};
+
 // Initializes necessary resources (e.g., cURL).
 void initialize();
 
 // Cleans up resources (e.g., cURL).
 void cleanup();
 
+// Base URL of the API, "https://gamebanana.com/apiv11" unless MODULAR_GAMEBANANA_API_URL is set.
+std::string gameBananaApiBase();
+
 // Performs an HTTP GET request to the specified URL and returns the response as a string.
 std::string httpGet(const std::string& url);
 
 // Downloads a file from the specified URL and saves it to the given output path.
+// Data is staged in "<outputPath>.part" and resumed from there on retries or later runs.
+// If expectedMd5 is given, the data is hashed as it is written and a mismatch fails the attempt.
 // Returns true if the download succeeds, false otherwise.
-bool downloadFile(const std::string& url, const std::string& outputPath);
+bool downloadFile(const std::string& url, const std::string& outputPath, const std::string& expectedMd5 = "");
 
 // Sanitizes a filename by replacing illegal characters with underscores.
 std::string sanitizeFilename(const std::string& name);
@@ -31,13 +45,29 @@ std::string extractFileName(const std::string& downloadUrl);
 // Each mod is represented as a pair where:
 //   - first: the mod's profile URL,
 //   - second: the mod's name.
+// The first page tells how many subscriptions there are; the remaining pages are then
+// requested together (MODULAR_API_CONCURRENCY at a time) and joined in page order.
 std::vector<std::pair<std::string, std::string>> fetchSubscribedMods(const std::string& userId);
 
+// Fetches the downloadable files (URL, MD5 checksum and size) for the specified mod ID.
+// A failed request or malformed response is logged and gives an empty list.
+std::vector<GameBananaFile> fetchModFiles(const std::string& modId);
+
 // Fetches a list of file download URLs for the specified mod ID.
 std::vector<std::string> fetchModFileUrls(const std::string& modId);
 
 // Downloads all mod files for the specified mod.
-// Files will be stored in a subdirectory (based on a sanitized version of modName) under baseDir.
-void downloadModFiles(const std::string& modId, const std::string& modName, const std::string& baseDir);
+// Files will be stored in a subdirectory "<sanitized modName> (<modId>)" under baseDir.
+// If extractor is given, each downloaded archive is handed to it as soon as it is complete.
+void downloadModFiles(const std::string& modId, const std::string& modName, const std::string& baseDir,
+    ExtractPool* extractor = nullptr);
+
+// Downloads the files of every subscribed mod (as returned by fetchSubscribedMods) into
+// per-mod folders under baseDir. File lists are fetched several at a time and each file
+// is queued on one DownloadEngine as soon as it is known, so files of different mods
+// download side by side under the engine's shared, adaptive limit while later lists are
+// still being fetched.
+void downloadSubscribedMods(const std::vector<std::pair<std::string, std::string>>& mods, const std::string& baseDir,
+    ExtractPool* extractor = nullptr);
 
 #endif // GAMEBANANA_H
@@ -0,0 +1,91 @@
+#ifndef HTTPCLIENT_H
+#define HTTPCLIENT_H
+
+#include "CurlPool.h"
+#include <atomic>
+#include <chrono>
+#include <curl/curl.h>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A small utility struct to store HTTP response data
+struct HttpResponse {
+    long status_code;
+    std::string body; // a BufferPool buffer, handed back when the response is destroyed
+    std::map<std::string, std::string> headers; // lower-case names
+
+    // Spelled out because of the destructor; moves must stay moves so the body is never copied.
+    HttpResponse(const HttpResponse&) = default;
+    HttpResponse(HttpResponse&&) = default;
+    HttpResponse& operator=(const HttpResponse&) = default;
+    HttpResponse& operator=(HttpResponse&&) = default;
+    ~HttpResponse();
+};
+
+// How many API requests batch lookups keep in flight at once, from
+// MODULAR_API_CONCURRENCY (default 8).
+unsigned api_concurrency_from_env();
+
+// Asynchronous GET client shared by the NexusMods, GameBanana and Rename code.
+// One background thread drives every request through a single curl multi handle
+// (curl_multi_socket_action on an epoll loop on Linux), so any number of requests
+// can be in flight without a thread per request. Connections to the same host are
+// reused and, where the server speaks HTTP/2, multiplexed onto one connection.
+class HttpClient {
+public:
+    using Callback = std::function<void(HttpResponse)>;
+
+    static HttpClient& instance();
+
+    ~HttpClient();
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    // Starts a GET and returns immediately. A failed transfer yields status_code 0.
+    std::future<HttpResponse> get(const std::string& url, const std::vector<std::string>& headers);
+
+    // Same, but hands the response to on_done on the client's thread. on_done must not
+    // block on another request from this client.
+    void get(const std::string& url, const std::vector<std::string>& headers, Callback on_done);
+
+private:
+    struct Request {
+        CurlHandlePool::Lease lease;
+        curl_slist* headers = nullptr;
+        std::string url;
+        HttpResponse response { 0, "", {} };
+        Callback on_done;
+    };
+
+    HttpClient();
+
+    void loop();
+    void add_incoming();
+    void check_completed();
+    void complete(CURL* easy, CURLcode res);
+    void wake();
+
+    static int socket_cb(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp);
+    static int timer_cb(CURLM* multi, long timeout_ms, void* userp);
+
+    CURLM* multi_ = nullptr;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    bool timer_armed_ = false; // curl asked to be called back at timer_deadline_
+    std::chrono::steady_clock::time_point timer_deadline_ {};
+    std::atomic<bool> stop_ { false };
+
+    std::mutex incoming_mutex_;
+    std::deque<std::unique_ptr<Request>> incoming_;
+    std::map<CURL*, std::unique_ptr<Request>> active_;
+    std::thread thread_;
+};
+
+#endif // HTTPCLIENT_H
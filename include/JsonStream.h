@@ -0,0 +1,30 @@
+#ifndef JSONSTREAM_H
+#define JSONSTREAM_H
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+// Location of an object inside a document: object keys, with "*" standing for
+// "any element" of an array. {"files", "*"} is every element of the top-level "files" array.
+using JsonPath = std::vector<std::string>;
+
+// The scalar fields picked out of one matching object, by key.
+using JsonFields = std::map<std::string, nlohmann::json>;
+
+// Walks a JSON document with nlohmann's SAX interface and, for every object found at
+// one of the given paths, hands its requested scalar fields to on_object. No DOM is
+// built; nested containers and unrequested keys are skipped as they stream past.
+// Returns the number of matching objects. Throws std::runtime_error on malformed input.
+size_t stream_json_objects(const std::string& body, const std::vector<JsonPath>& paths,
+    const std::vector<std::string>& fields, const std::function<void(const JsonFields&)>& on_object);
+
+// Same, also telling on_object which of the paths the object was found at. A target
+// nested inside another is reported first, and its fields are not the outer object's.
+size_t stream_json_objects(const std::string& body, const std::vector<JsonPath>& paths,
+    const std::vector<std::string>& fields, const std::function<void(size_t, const JsonFields&)>& on_object);
+
+#endif // JSONSTREAM_H
@@ -0,0 +1,146 @@
+#ifndef LIBRARYINDEX_H
+#define LIBRARYINDEX_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// One file or directory as the index last saw it.
+struct IndexEntry {
+    std::string name;
+    bool directory = false;
+    uintmax_t size = 0;  // files only
+    long long mtime = 0; // last_write_time in raw file_clock ticks, like ManifestEntry::mtime
+};
+
+// Compact record of every game domain, mod, file, size and mtime under the library
+// directory (~/Games/Mods-Lists), so the rename, merge and sync paths don't have to
+// walk and stat the whole tree on every run.
+//
+// The index lives in <root>/.cache/library.idx as one flat array of fixed-size
+// records (children of a directory stored next to each other, sorted by name) plus
+// a string table, and is memory-mapped on load. refresh() brings it up to date:
+//   - while the process has inotify watches on the tree, only directories that
+//     reported changes are re-read;
+//   - otherwise each directory is stat()ed and only re-read (getdents64, using d_type
+//     so subdirectories need no stat) when its mtime moved.
+// Directory mtimes only move when entries are added, removed or renamed, which is how
+// downloads (.part + rename), extraction and merges write. A file rewritten in place
+// without touching its directory is only noticed while the watches are active.
+// Hidden entries at the top level (.cache, .stats) and symlinks to directories are
+// not indexed. Safe to share between threads.
+class LibraryIndex {
+public:
+    explicit LibraryIndex(std::filesystem::path root);
+    ~LibraryIndex();
+
+    LibraryIndex(const LibraryIndex&) = delete;
+    LibraryIndex& operator=(const LibraryIndex&) = delete;
+
+    const std::filesystem::path& root() const { return root_; }
+
+    // True if path is the root or lies below it.
+    bool covers(const std::filesystem::path& path) const;
+
+    // Maps <root>/.cache/library.idx. A missing or unreadable file is an empty index.
+    bool load();
+
+    // Writes the index back if it changed since it was loaded or last saved.
+    bool save();
+
+    // Brings the part of the index under dir (the whole library when empty) up to date.
+    void refresh(const std::filesystem::path& dir = {});
+
+    // Children of dir, sorted by name. Nothing if dir is not a directory in the index.
+    std::optional<std::vector<IndexEntry>> list(const std::filesystem::path& dir) const;
+
+    // Everything below dir as (path relative to dir, entry), each directory before its contents.
+    std::optional<std::vector<std::pair<std::filesystem::path, IndexEntry>>> walk(const std::filesystem::path& dir) const;
+
+    // The entry for path, if the index has one.
+    std::optional<IndexEntry> find(const std::filesystem::path& path) const;
+
+    // Files and directories in the index.
+    size_t size() const;
+
+private:
+    // On-disk record; 40 bytes. Node 0 is the root.
+    struct Node {
+        uint64_t size;
+        int64_t mtime;        // directories: mtime when last read, 0 = read again next time
+        uint32_t name_offset; // into the string table
+        uint32_t name_length;
+        uint32_t first_child;
+        uint32_t child_count;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+
+    // A directory as just read from disk.
+    struct Listing {
+        long long mtime = 0;
+        std::vector<IndexEntry> entries;
+    };
+
+    using Listings = std::map<std::string, Listing>;
+
+    static bool valid_image(const char* data, size_t size);
+    bool relative(const std::filesystem::path& path, std::string& rel) const;
+    std::optional<uint32_t> lookup(const std::string& rel) const;
+    std::optional<uint32_t> child(uint32_t dir, std::string_view name) const;
+    std::string_view name_at(uint32_t node) const;
+    IndexEntry entry_at(uint32_t node) const;
+    bool save_locked();
+
+    void collect_changed(const std::string& rel, std::optional<uint32_t> node, Listings& fresh, long long racy_after);
+    void collect_reported(const std::string& scope, Listings& fresh, long long racy_after);
+    bool read_into(const std::string& rel, long long mtime, Listings& fresh, long long racy_after);
+    void rebuild(const Listings& fresh);
+    void unmap();
+
+    bool watching(const std::string& rel) const;
+    void watch(const std::string& rel);
+    void drain_events();
+    void stop_watching();
+
+    std::filesystem::path root_;
+    std::filesystem::path file_;
+    mutable std::mutex mutex_;
+
+    // Current image: either the mapped file or owned_nodes_/owned_names_.
+    const Node* nodes_ = nullptr;
+    uint32_t count_ = 0;
+    const char* names_ = nullptr;
+    std::vector<Node> owned_nodes_;
+    std::string owned_names_;
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    bool changed_ = false;
+    std::chrono::steady_clock::time_point next_save_ {};
+
+    // inotify state; fd -1 when not watching.
+    int inotify_ = -1;
+    bool watch_disabled_ = false;
+    std::unordered_map<int, std::string> watch_paths_; // watch descriptor -> relative directory
+    std::map<std::string, int> watches_;               // relative directory -> watch descriptor
+    std::set<std::string> reported_;                   // directories with pending events
+};
+
+// True unless MODULAR_LIBRARY_INDEX is set to 0.
+bool library_index_enabled();
+
+// The process-wide index of ~/Games/Mods-Lists for the current $HOME, loaded on first use.
+// Null if the index is disabled or path is outside the library.
+LibraryIndex* library_index_for(const std::filesystem::path& path);
+
+#endif // LIBRARYINDEX_H
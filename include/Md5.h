@@ -0,0 +1,33 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Incremental MD5 (RFC 1321), used to check archives against the md5 values the
+// mod sites publish. Feed data with update() in any chunk sizes, then call hex_digest().
+class Md5 {
+public:
+    Md5();
+
+    void update(const void* data, size_t length);
+
+    // Finishes the hash and returns it as 32 lower-case hex characters.
+    // The object must not be updated afterwards.
+    std::string hex_digest();
+
+private:
+    void transform(const uint8_t block[64]);
+
+    uint32_t state_[4];
+    uint64_t length_ = 0; // total bytes hashed
+    uint8_t buffer_[64];
+    size_t buffered_ = 0;
+};
+
+// MD5 of a whole file on disk, or an empty string if it can't be read.
+std::string md5_file(const std::filesystem::path& path);
+
+#endif // MD5_H
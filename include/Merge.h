@@ -0,0 +1,73 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// How file contents get from a mod directory into the merged target.
+enum class MergeStrategy {
+    Auto,          // choose per target filesystem (see pickMergeStrategy)
+    Reflink,       // FICLONE: shares extents copy-on-write (btrfs, xfs)
+    Hardlink,      // new directory entry for the same inode; source and target must share a filesystem.
+                   // Opt-in only: the target and the library then share one file, so anything that
+                   // edits a merged file in place (a game rewriting its INI, saves, config) also edits
+                   // the mod's source, and since size and mtime change on both names, later
+                   // differential merges and syncs cannot tell that it happened.
+    CopyFileRange, // in-kernel copy, no round trip through user space
+    Copy           // plain std::filesystem::copy
+};
+
+// Whether files the target already has are placed again.
+enum class MergeMode {
+    Full,        // place every source file
+    Differential // skip files whose size and modification time already match, remove files the source dropped
+};
+
+struct MergeOptions {
+    MergeStrategy strategy = MergeStrategy::Auto;
+    MergeMode mode = MergeMode::Differential;
+    bool compareContents = false; // differential: MD5 same-size files whose times differ before replacing them
+    unsigned threads = 0;         // workers; 0 = hardware concurrency
+};
+
+// What a merge did. Files that could not use the requested strategy fall back to
+// the next cheaper one (reflink -> copy_file_range -> copy, hardlink -> copy_file_range -> copy).
+struct MergeStats {
+    size_t files = 0;
+    size_t reflinked = 0;
+    size_t hardlinked = 0;
+    size_t rangeCopied = 0;
+    size_t copied = 0;
+    size_t failed = 0;
+    uintmax_t bytes = 0;
+    size_t unchanged = 0;       // files the target already had
+    uintmax_t skippedBytes = 0; // their total size, i.e. what was not copied
+    size_t deleted = 0;         // files removed because the source no longer has them
+    size_t overwritten = 0;     // files another source merged into the target had placed there
+};
+
+const char* mergeStrategyName(MergeStrategy strategy);
+
+// Picks the cheapest strategy that keeps target and source independent: reflinks on a
+// btrfs/xfs target shared with the source, copy_file_range otherwise (which still shares
+// extents where the filesystem can). Never picks Hardlink. Non-Linux builds always copy.
+MergeStrategy pickMergeStrategy(const std::filesystem::path& target, const std::filesystem::path& source);
+
+// Options from MODULAR_MERGE_MODE ("full" or the default "differential"),
+// MODULAR_MERGE_VERIFY=1 (compareContents) and MODULAR_MERGE_STRATEGY (a
+// mergeStrategyName(): "auto" by default, "hardlink" only if the risk above is acceptable).
+MergeOptions mergeOptionsFromEnv();
+
+// Merges source into target (creating it if needed), overwriting files that exist in both.
+// The source is listed first (from the library index when it is part of the library,
+// otherwise by walking its directories in parallel); in differential mode each target
+// file is then compared and only what changed is placed, with the chosen strategy, on
+// all workers. Placed copies keep the source's modification time. Which files came from
+// which source is recorded per target under ~/Games/Mods-Lists/.cache/merges, so files
+// a source no longer has are removed unless another source merged into the target has them,
+// and replacing a file another source placed is counted in MergeStats::overwritten.
+MergeStats mergeDirectories(const std::filesystem::path& target, const std::filesystem::path& source,
+    const MergeOptions& options = {});
+
+#endif // MERGE_H
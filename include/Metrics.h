@@ -0,0 +1,106 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <curl/curl.h>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using MetricLabels = std::map<std::string, std::string>;
+
+// Cumulative-bucket histogram in the Prometheus sense: counts[i] is the number of
+// observations <= bounds[i]; the last slot counts everything above the top bound.
+struct Histogram {
+    std::vector<double> bounds;
+    std::vector<uint64_t> counts;
+    uint64_t count = 0;
+    double sum = 0;
+
+    explicit Histogram(std::vector<double> upper_bounds);
+    void observe(double value);
+};
+
+// Process-wide registry of histograms and counters, keyed by name and labels.
+// Everything is cheap enough to record per request; export happens with write().
+class Metrics {
+public:
+    static Metrics& instance();
+
+    void observe_seconds(const std::string& name, double seconds, const MetricLabels& labels = {});
+    void observe_bytes(const std::string& name, double bytes, const MetricLabels& labels = {});
+    void add(const std::string& name, double value, const MetricLabels& labels = {});
+
+    std::string to_json() const;
+    std::string to_prometheus() const;
+
+    // Writes stats.json and stats.prom into directory (each via a temporary file and rename).
+    bool write(const std::filesystem::path& directory) const;
+
+private:
+    Metrics() = default;
+
+    struct Series {
+        std::string name;
+        MetricLabels labels;
+        Histogram histogram;
+    };
+    struct Counter {
+        std::string name;
+        MetricLabels labels;
+        double value = 0;
+    };
+
+    void observe(const std::string& name, double value, const MetricLabels& labels, const std::vector<double>& bounds);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Series> histograms_;
+    std::map<std::string, Counter> counters_;
+};
+
+// Records curl's timing breakdown (DNS, connect, TLS, time to first byte, total),
+// body size and speed for a finished transfer, labelled by kind ("api", "download") and host.
+void record_curl_transfer(CURL* easy, const std::string& kind);
+
+// Adds the time between construction and destruction to a seconds histogram.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(std::string name, MetricLabels labels = {});
+    ~ScopedTimer();
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    std::string name_;
+    MetricLabels labels_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Where stats files go: MODULAR_STATS_DIR, or ~/Games/Mods-Lists/.stats.
+std::filesystem::path stats_directory();
+
+// Writes the stats files now and, if MODULAR_STATS_INTERVAL (seconds) is set, every
+// interval until destroyed, so long runs can be watched while they are going.
+class StatsExporter {
+public:
+    StatsExporter();
+    ~StatsExporter();
+    StatsExporter(const StatsExporter&) = delete;
+    StatsExporter& operator=(const StatsExporter&) = delete;
+
+    // Writes the current numbers immediately, e.g. at the end of a run.
+    void flush();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+#endif // METRICS_H
@@ -1,6 +1,8 @@
 #ifndef NEXUSMODS_H
 #define NEXUSMODS_H
 
+#include "DownloadEngine.h"
+#include "HttpClient.h"
 #include <chrono>
 #include <cstdlib>
 #include <curl/curl.h>
@@ -9,6 +11,7 @@
 #include <iostream>
 #include <map>
 #include <nlohmann/json.hpp>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -19,14 +22,29 @@ using json = nlohmann::json;
 
 extern std::string API_KEY;
 
-// A small utility struct to store HTTP response data
-struct HttpResponse {
-    long status_code;
-    std::string body;
+// What files.json says about one file. get_file_ids() remembers these for the rest of
+// the run so that later stages can verify downloads against them.
+struct NexusFileInfo {
+    int mod_id = 0;
+    int file_id = 0;
+    std::string file_name;
+    std::string md5;
+    uintmax_t size_bytes = 0; // from size_in_bytes when present, else size_kb * 1024
+    bool size_exact = false;  // true if size_bytes came from size_in_bytes
 };
 
+// Looks up what get_file_ids() learned about a file during this run.
+std::optional<NexusFileInfo> find_file_info(int mod_id, int file_id);
+
+// Adds what an earlier run learned about a file (see DeltaSync.h), for find_file_info().
+void remember_file_info(const NexusFileInfo& info);
+
+// Base URL of the API, "https://api.nexusmods.com/v1" unless MODULAR_NEXUS_API_URL is set.
+std::string nexus_api_base();
+
 // Function declarations (exactly as in the original code)
-HttpResponse http_get(const std::string& url, const std::vector<std::string>& headers);
+// With revalidate, a cached response is never served as fresh, only revalidated.
+HttpResponse http_get(const std::string& url, const std::vector<std::string>& headers, bool revalidate = false);
 std::string escape_spaces(const std::string& url);
 std::vector<int> get_tracked_mods();
 std::map<int, std::vector<int>> get_file_ids(const std::vector<int>& mod_ids, const std::string& game_domain);
@@ -34,4 +52,10 @@ std::map<std::pair<int, int>, std::string> generate_download_links(const std::ma
 void save_download_links(const std::map<std::pair<int, int>, std::string>& download_links, const std::string& game_domain);
 void download_files(const std::string& game_domain);
 
+// Per-item steps the batch functions above are built from, for callers that stream
+// work between stages instead of finishing one stage before starting the next.
+std::vector<int> get_mod_file_ids(int mod_id, const std::string& game_domain, bool revalidate = false);
+std::optional<std::string> generate_download_link(int mod_id, int file_id, const std::string& game_domain);
+DownloadJob make_download_job(int mod_id, int file_id, const std::string& url, const fs::path& base_directory);
+
 #endif // NEXUSMODS_H
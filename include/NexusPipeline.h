@@ -0,0 +1,16 @@
+#ifndef NEXUSPIPELINE_H
+#define NEXUSPIPELINE_H
+
+#include <string>
+#include <vector>
+
+// Runs the NexusMods sync for one domain as three overlapping stages instead of three
+// passes: a metadata thread fetches files.json per mod, a link thread turns each file
+// that is not already synced into a download link, and the calling thread downloads
+// them as the links arrive. Stages are connected by bounded queues, so links are
+// requested only shortly before they are used and a slow stage throttles the one
+// feeding it. download_links.txt and the domain manifest are written as before.
+// Finished archives go to an ExtractPool (see Extract.h) while the rest download.
+void sync_domain_pipelined(const std::vector<int>& mod_ids, const std::string& game_domain);
+
+#endif // NEXUSPIPELINE_H
@@ -0,0 +1,47 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Token bucket sized from the server's own rate-limit headers.
+// While plenty of budget remains, acquire() returns immediately so requests go out
+// back to back. Once the remaining budget drops into the reserve, requests are spread
+// evenly until the window resets, and a 429's Retry-After blocks everyone until it passes.
+class RateLimiter {
+public:
+    // reserve_fraction: share of the window's limit below which pacing kicks in.
+    explicit RateLimiter(double reserve_fraction = 0.05);
+
+    // Blocks until the caller may send one request, then consumes a token.
+    void acquire();
+
+    // Feeds a response back into the bucket. Header names must be lower-case.
+    void update(long status_code, const std::map<std::string, std::string>& headers);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // How long the caller must wait before it may take a token; zero means go now.
+    Clock::duration wait_time(Clock::time_point now);
+
+    std::mutex mutex_;
+    double reserve_fraction_;
+    bool known_ = false; // true once we've seen rate-limit headers
+    double tokens_ = 0;
+    double limit_ = 0;
+    Clock::time_point reset_at_ {};
+    Clock::time_point last_grant_ {};
+    Clock::time_point blocked_until_ {};
+};
+
+// The limiter shared by every request to api.nexusmods.com.
+RateLimiter& nexus_rate_limiter();
+
+// Parses a Retry-After value (delta-seconds or HTTP-date) into seconds from now, capped
+// at a day; -1 if absent/invalid.
+long parse_retry_after(const std::string& value);
+
+#endif // RATELIMITER_H
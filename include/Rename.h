@@ -2,25 +2,70 @@
 #define RENAME_H
 
 #include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
 // Given a base folder (e.g. "~/Games/Mods-Lists"), returns a list of game domains.
+// Hidden directories such as ".cache" are skipped.
 std::vector<std::string> getGameDomainNames(const std::filesystem::path& modsListsDir);
 
 // Given a game domain folder, returns a list of mod IDs (subdirectory names).
+// Folders that were already renamed, or that are otherwise not numeric, are skipped.
 std::vector<std::string> getModIDs(const std::filesystem::path& gameDomainPath);
 
+// Given a game domain folder, returns every mod folder in it, numbered or already
+// renamed. Hidden directories are skipped.
+std::vector<std::string> getModDirectoryNames(const std::filesystem::path& gameDomainPath);
+
 // Using the game domain and mod ID, performs a GET request to the Nexus Mods API.
 // (For example: https://api.nexusmods.com/v1/games/<game_domain>/mods/<mod_id>)
-// Returns the JSON response as a string.
+// The request goes through http_get(), so it is rate limited and served from the
+// response cache when possible. Uses the API_KEY global (see NexusMods.h).
+// Returns the JSON response as a string, or "" (after logging the HTTP status) when the
+// request did not succeed.
 std::string fetchModName(const std::string& gameDomain, const std::string& modID);
 
 // Given the JSON response from the API, extracts the mod name.
 // (This function assumes that the JSON object has a "name" field.)
 std::string extractModName(const std::string& jsonResponse);
 
-// Given a target directory and a source directory, recursively copies (merges) the files.
+// Persistent (game domain, mod ID) -> mod name map, so a name is only ever looked up once.
+// Stored as JSON in <modsListsDir>/.cache/mod_names.json. Safe to share between threads.
+class ModNameCache {
+public:
+    explicit ModNameCache(std::filesystem::path file);
+    static std::filesystem::path defaultPath(const std::filesystem::path& modsListsDir);
+
+    bool load();
+    bool save() const;
+
+    std::optional<std::string> find(const std::string& gameDomain, const std::string& modID) const;
+    void store(const std::string& gameDomain, const std::string& modID, const std::string& name);
+
+private:
+    std::filesystem::path file_;
+    mutable std::mutex mutex_;
+    std::map<std::string, std::map<std::string, std::string>> names_; // domain -> mod ID -> name
+};
+
+// Returns mod ID -> mod name for every ID whose name is known. Cached names are used
+// as they are; the rest are fetched concurrently (MODULAR_API_CONCURRENCY requests at
+// a time, default 8) within the shared Nexus rate limit, and added to the cache.
+std::map<std::string, std::string> resolveModNames(const std::string& gameDomain,
+    const std::vector<std::string>& modIDs, ModNameCache& cache);
+
+// Renames <gameDomainPath>/<mod ID> to <gameDomainPath>/<name> for every entry of
+// newNames (names must already be safe file names) and updates the domain's sync
+// manifest once for the whole batch. Returns how many folders were renamed.
+size_t renameModDirectories(const std::filesystem::path& gameDomainPath,
+    const std::map<std::string, std::string>& newNames);
+
+// Given a target directory and a source directory, recursively merges the files.
+// Uses mergeDirectories() with the strategy picked for the target filesystem and
+// mergeOptionsFromEnv() (differential unless MODULAR_MERGE_MODE=full), see Merge.h.
 void combineDirectories(const std::filesystem::path& target, const std::filesystem::path& source);
 
 #endif // RENAME_H
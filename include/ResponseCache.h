@@ -0,0 +1,67 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+
+// One stored API response plus the validators needed to revalidate it.
+struct CacheEntry {
+    std::string url;
+    std::string body;
+    std::string etag;
+    std::string last_modified;
+    long long stored_at = 0; // Unix time of the last 200 or 304 for this URL
+
+    long long age_seconds() const;
+};
+
+// Persistent cache of successful GET responses, one JSON file per key.
+// Fresh entries (younger than their TTL) are served without touching the network;
+// stale ones are revalidated with If-None-Match / If-Modified-Since so that an
+// unchanged resource comes back as a body-less 304. prune() keeps the directory
+// bounded in age and size.
+class ResponseCache {
+public:
+    explicit ResponseCache(std::filesystem::path directory);
+
+    std::optional<CacheEntry> load(const std::string& key);
+    void store(const std::string& key, const CacheEntry& entry);
+
+    // Marks an entry as just revalidated (after a 304).
+    void touch(const std::string& key, CacheEntry entry);
+
+    // Drops the entry for this key, if there is one.
+    void erase(const std::string& key);
+
+    // Deletes entries not written for max_age_seconds, then the least recently written
+    // ones until the directory holds at most max_bytes. Returns how many were deleted.
+    size_t prune(long long max_age_seconds, uintmax_t max_bytes);
+
+    const std::filesystem::path& directory() const { return directory_; }
+
+private:
+    std::filesystem::path path_for(const std::string& key) const;
+
+    std::filesystem::path directory_;
+    std::mutex mutex_;
+};
+
+// Cache for api.nexusmods.com responses: ~/Games/Mods-Lists/.cache/nexus.
+// Pruned once per process when first used, to MODULAR_CACHE_MAX_AGE seconds
+// (default 2592000, 30 days) and MODULAR_CACHE_MAX_MB megabytes (default 256).
+ResponseCache& nexus_response_cache();
+
+// How long a response for this URL may be served without revalidation, in seconds.
+//   tracked_mods.json   MODULAR_CACHE_TTL_TRACKED (default 900)
+//   files.json          MODULAR_CACHE_TTL_FILES   (default 21600)
+//   download_link.json  MODULAR_CACHE_TTL_LINKS   (default 0: always revalidate)
+//   updated.json        MODULAR_CACHE_TTL_UPDATED (default 0: always revalidate)
+//   anything else       MODULAR_CACHE_TTL_MODS    (default 21600)
+// Returns -1 (don't cache at all) when MODULAR_NO_CACHE is set. Responses with a TTL of
+// 0 are only stored if they carry an ETag or Last-Modified to revalidate them with.
+long long cache_ttl_for(const std::string& url);
+
+#endif // RESPONSECACHE_H
@@ -0,0 +1,67 @@
+#ifndef SYNCMANIFEST_H
+#define SYNCMANIFEST_H
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class LibraryIndex;
+
+// One completed download as recorded in a domain's manifest.
+struct ManifestEntry {
+    int mod_id = 0;
+    int file_id = 0;
+    std::string path; // relative to the domain directory, e.g. "1234/archive.7z"
+    uintmax_t size = 0;
+    std::string md5;
+    long long mtime = 0; // last_write_time when recorded, in raw file_clock ticks
+};
+
+// Per-domain record of every file the NexusMods sequence has finished downloading,
+// stored as ~/Games/Mods-Lists/<domain>/manifest.json. A file counts as already
+// synced while it is still on disk with the size and mtime it was recorded with.
+class SyncManifest {
+public:
+    explicit SyncManifest(std::filesystem::path domain_directory);
+
+    // The manifest for a NexusMods game domain under ~/Games/Mods-Lists.
+    static SyncManifest for_domain(const std::string& game_domain);
+
+    // Reads the manifest from disk. A missing file is an empty manifest. Also brings the
+    // library index up to date for the domain, which is_current() then answers from.
+    bool load();
+    bool save() const;
+
+    // Saves if nothing has been written for a second (longer for big manifests).
+    // Rewriting the whole file after every download is quadratic in the number of
+    // files, so long runs checkpoint with this and call save() once at the end.
+    bool checkpoint();
+
+    const ManifestEntry* find(int mod_id, int file_id) const;
+
+    // True if (mod_id, file_id) was downloaded before and the file is unchanged on disk.
+    bool is_current(int mod_id, int file_id) const;
+
+    // Records a finished download. file must live under the domain directory.
+    void record(int mod_id, int file_id, const std::filesystem::path& file, const std::string& md5);
+
+    // Rewrites entries after mod directories were renamed (old name -> new name, e.g. by the
+    // Rename sequence), in one pass over the entries.
+    void rename_directories(const std::map<std::string, std::string>& renames);
+
+    const std::filesystem::path& domain_directory() const { return domain_directory_; }
+
+private:
+    std::filesystem::path manifest_path() const;
+
+    std::filesystem::path domain_directory_;
+    LibraryIndex* index_ = nullptr; // null outside the library or with the index disabled
+    std::map<std::pair<int, int>, ManifestEntry> entries_;
+    std::chrono::steady_clock::time_point next_checkpoint_ = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+};
+
+#endif // SYNCMANIFEST_H
@@ -0,0 +1,61 @@
+#include "BufferPool.h"
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+// Buffers kept for reuse; about one per request that can be in flight at once.
+const size_t MAX_FREE = 64;
+
+// Larger buffers (a 50,000-mod tracked list) are rare enough to free rather than hold on to.
+const size_t MAX_RETAINED = 1 << 20;
+
+} // namespace
+
+BufferPool& BufferPool::instance()
+{
+    // Never destroyed: responses may still be released while statics are torn down.
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+/**
+ * Prefers the smallest free buffer that is already big enough; failing that, the
+ * biggest one, which then only has to grow the rest of the way.
+ */
+std::string BufferPool::acquire(size_t capacity)
+{
+    std::string buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            auto best = free_.end();
+            for (auto it = free_.begin(); it != free_.end(); ++it) {
+                bool fits = it->capacity() >= capacity;
+                if (best == free_.end()
+                    || (fits && (best->capacity() < capacity || it->capacity() < best->capacity()))
+                    || (!fits && best->capacity() < capacity && it->capacity() > best->capacity())) {
+                    best = it;
+                }
+            }
+            std::iter_swap(best, free_.end() - 1);
+            buffer = std::move(free_.back());
+            free_.pop_back();
+        }
+    }
+    buffer.reserve(capacity);
+    return buffer;
+}
+
+void BufferPool::release(std::string&& buffer)
+{
+    // A string with no heap storage has nothing worth keeping.
+    if (buffer.capacity() <= std::string().capacity() || buffer.capacity() > MAX_RETAINED) {
+        return;
+    }
+    buffer.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.size() < MAX_FREE) {
+        free_.push_back(std::move(buffer));
+    }
+}
@@ -0,0 +1,293 @@
+#include "ConcurrencyController.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+// How often the limits are re-evaluated.
+const std::chrono::milliseconds CONTROL_INTERVAL(1000);
+
+// An increase is kept only if throughput rose by at least this share.
+const double MIN_GAIN = 0.05;
+
+// Intervals to wait after a probe that did not pay off, before trying one more transfer again.
+const int PROBE_HOLD = 10;
+
+// Intervals a host's limit stays put after it was cut.
+const int HOST_HOLD = 3;
+
+// Clean intervals before a host is offered the level it last pushed back on.
+const int CEILING_HOLD = 30;
+
+uint64_t rate_from_env(const char* name)
+{
+    const char* env = std::getenv(name);
+    if (!env || !*env) {
+        return 0;
+    }
+    char* end = nullptr;
+    double value = std::strtod(env, &end);
+    if (end && (*end == 'K' || *end == 'k')) {
+        value *= 1024;
+    } else if (end && (*end == 'M' || *end == 'm')) {
+        value *= 1024 * 1024;
+    } else if (end && (*end == 'G' || *end == 'g')) {
+        value *= 1024.0 * 1024 * 1024;
+    }
+    return value > 0 ? static_cast<uint64_t>(value) : 0;
+}
+
+/**
+ * "host:port" of a URL, the unit a CDN throttles by.
+ */
+std::string authority_of(const std::string& url)
+{
+    auto start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+    auto end = url.find_first_of("/?#", start);
+    std::string authority = url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    auto at = authority.rfind('@');
+    return at == std::string::npos ? authority : authority.substr(at + 1);
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// Configuration
+//----------------------------------------------------------------------------------
+
+ConcurrencyOptions concurrency_options_from_env(int initial)
+{
+    ConcurrencyOptions options;
+    options.initial = std::max(1, initial);
+    const char* adaptive = std::getenv("MODULAR_DOWNLOAD_ADAPTIVE");
+    options.adaptive = !(adaptive && std::string(adaptive) == "0");
+    const char* max = std::getenv("MODULAR_PARALLEL_DOWNLOADS_MAX");
+    if (max && std::atoi(max) > 0) {
+        options.max = std::atoi(max);
+    }
+    options.max = std::max(options.max, options.initial);
+    options.rate_limit = rate_from_env("MODULAR_DOWNLOAD_RATE");
+    options.host_rate_limit = rate_from_env("MODULAR_HOST_DOWNLOAD_RATE");
+    return options;
+}
+
+//----------------------------------------------------------------------------------
+// ConcurrencyController
+//----------------------------------------------------------------------------------
+
+ConcurrencyController::ConcurrencyController(ConcurrencyOptions options)
+    : options_(options)
+{
+    options_.min = std::max(1, options_.min);
+    options_.max = std::max(options_.min, options_.max);
+    options_.initial = std::clamp(options_.initial, options_.min, options_.max);
+    limit_ = options_.initial;
+}
+
+int ConcurrencyController::host_id(const std::string& url)
+{
+    std::string name = authority_of(url);
+    auto it = ids_.find(name);
+    if (it != ids_.end()) {
+        return it->second;
+    }
+    int id = static_cast<int>(hosts_.size());
+    Host host;
+    host.name = name;
+    host.limit = options_.max;
+    hosts_.push_back(host);
+    ids_.emplace(name, id);
+    return id;
+}
+
+bool ConcurrencyController::may_start(int host) const
+{
+    return slots_ < limit_ && hosts_[host].slots < hosts_[host].limit;
+}
+
+void ConcurrencyController::slot_taken(int host)
+{
+    Host& h = hosts_[host];
+    slots_++;
+    h.slots++;
+    saturated_ = saturated_ || slots_ >= limit_;
+    h.peak = std::max(h.peak, h.slots);
+    h.saturated = h.saturated || h.slots >= h.limit;
+}
+
+void ConcurrencyController::slot_released(int host)
+{
+    slots_--;
+    hosts_[host].slots--;
+}
+
+void ConcurrencyController::connection_opened(int host)
+{
+    connections_++;
+    hosts_[host].connections++;
+    caps_dirty_ = options_.rate_limit > 0 || options_.host_rate_limit > 0;
+}
+
+void ConcurrencyController::connection_closed(int host, TransferOutcome outcome)
+{
+    Host& h = hosts_[host];
+    connections_--;
+    h.connections--;
+    caps_dirty_ = options_.rate_limit > 0 || options_.host_rate_limit > 0;
+    switch (outcome) {
+    case TransferOutcome::Ok:
+        h.ok++;
+        break;
+    case TransferOutcome::Throttled:
+        // Acted on at once: until the limit drops, each freed slot would just be refused again.
+        h.throttled++;
+        if (options_.adaptive && !h.cut) {
+            int in_use = std::max(1, std::min(h.limit, h.peak));
+            cut_host(h, in_use, in_use / 2, "throttled");
+        }
+        break;
+    case TransferOutcome::Failed:
+        h.failed++;
+        break;
+    case TransferOutcome::Other:
+        break;
+    }
+}
+
+void ConcurrencyController::received(uint64_t bytes)
+{
+    bytes_ += bytes;
+}
+
+uint64_t ConcurrencyController::speed_cap(int host) const
+{
+    uint64_t cap = 0;
+    if (options_.rate_limit > 0) {
+        cap = std::max<uint64_t>(1, options_.rate_limit / static_cast<uint64_t>(std::max(1, connections_)));
+    }
+    if (options_.host_rate_limit > 0) {
+        uint64_t host_cap = std::max<uint64_t>(1,
+            options_.host_rate_limit / static_cast<uint64_t>(std::max(1, hosts_[host].connections)));
+        cap = cap > 0 ? std::min(cap, host_cap) : host_cap;
+    }
+    return cap;
+}
+
+void ConcurrencyController::cut_host(Host& h, int in_use, int limit, const char* reason)
+{
+    limit = std::max(options_.min, limit);
+    h.cut = true;
+    h.hold = HOST_HOLD;
+    h.ceiling = in_use;
+    if (limit >= h.limit) {
+        return;
+    }
+    std::cout << "Parallel downloads from " << h.name << ": " << in_use << " -> " << limit << " (" << reason << ")"
+              << std::endl;
+    Metrics::instance().add("modular_download_concurrency_changes_total", 1,
+        { { "direction", "down" }, { "reason", reason } });
+    h.limit = limit;
+}
+
+void ConcurrencyController::change_limit(int limit, const char* reason)
+{
+    limit = std::clamp(limit, options_.min, options_.max);
+    if (limit == limit_) {
+        return;
+    }
+    std::cout << "Parallel downloads: " << limit_ << " -> " << limit << " (" << reason << ")" << std::endl;
+    Metrics::instance().add("modular_download_concurrency_changes_total", 1,
+        { { "direction", limit > limit_ ? "up" : "down" }, { "reason", reason } });
+    limit_ = limit;
+    settling_ = true;
+}
+
+/**
+ * One control step. Hosts come first: a host that pushed back this interval has its
+ * limit cut from what it was actually given (a 429 already did that when it arrived),
+ * and the global limit is not probed upward in the same step. Otherwise the global limit climbs one transfer at a time
+ * for as long as each step buys more throughput; the interval right after a change
+ * is skipped because new connections are still ramping up.
+ */
+bool ConcurrencyController::tick(Clock::time_point now)
+{
+    bool refresh = caps_dirty_;
+    caps_dirty_ = false;
+    if (interval_start_ == Clock::time_point {}) {
+        interval_start_ = now;
+        next_tick_ = now + CONTROL_INTERVAL;
+        return refresh;
+    }
+    if (now < next_tick_) {
+        return refresh;
+    }
+
+    double seconds = std::chrono::duration<double>(now - interval_start_).count();
+    double rate = seconds > 0 ? static_cast<double>(bytes_) / seconds : 0;
+    int before = limit_;
+    bool pushed_back = false;
+
+    if (options_.adaptive) {
+        for (Host& h : hosts_) {
+            int attempts = h.ok + h.throttled + h.failed;
+            if (!h.cut && h.failed >= 2 && h.failed * 4 >= attempts) {
+                int in_use = std::max(1, std::min(h.limit, h.peak));
+                cut_host(h, in_use, in_use * 3 / 4, "errors");
+            }
+            if (h.cut) {
+                pushed_back = true;
+            } else if (h.hold > 0) {
+                h.hold--;
+            } else if (h.saturated && h.limit < options_.max) {
+                if (h.ceiling > 0 && h.limit + 1 >= h.ceiling) {
+                    // Just below where the host pushed back: stay a while before trying it.
+                    h.hold = CEILING_HOLD;
+                    h.ceiling = 0;
+                } else {
+                    h.limit++;
+                }
+            }
+        }
+
+        if (pushed_back) {
+            // The hosts' own limits do the backing off; don't read a throttled interval as a plateau.
+            probing_ = false;
+            settling_ = true;
+        } else if (settling_) {
+            settling_ = false;
+        } else if (probing_) {
+            probing_ = false;
+            if (!saturated_) {
+                // Not enough work to fill the extra slot, so nothing to learn yet.
+            } else if (rate >= rate_before_ * (1 + MIN_GAIN)) {
+                rate_before_ = rate;
+                probing_ = true;
+                change_limit(limit_ + 1, "throughput rising");
+            } else {
+                hold_ = PROBE_HOLD;
+                change_limit(limit_ - 1, "throughput flat");
+            }
+        } else if (hold_ > 0) {
+            hold_--;
+        } else if (saturated_ && limit_ < options_.max) {
+            rate_before_ = rate;
+            probing_ = true;
+            change_limit(limit_ + 1, "probing");
+        }
+    }
+
+    bytes_ = 0;
+    saturated_ = slots_ >= limit_;
+    for (Host& h : hosts_) {
+        h.peak = h.slots;
+        h.ok = h.throttled = h.failed = 0;
+        h.cut = false;
+        h.saturated = h.slots >= h.limit;
+    }
+    interval_start_ = now;
+    next_tick_ = now + CONTROL_INTERVAL;
+    return refresh || limit_ != before;
+}
@@ -0,0 +1,134 @@
+#include "CurlPool.h"
+#include <utility>
+
+//----------------------------------------------------------------------------------
+// Lease
+//----------------------------------------------------------------------------------
+
+CurlHandlePool::Lease::Lease(CurlHandlePool* pool, CURL* handle)
+    : pool_(pool)
+    , handle_(handle)
+{
+}
+
+CurlHandlePool::Lease::~Lease()
+{
+    release();
+}
+
+CurlHandlePool::Lease::Lease(Lease&& other) noexcept
+    : pool_(std::exchange(other.pool_, nullptr))
+    , handle_(std::exchange(other.handle_, nullptr))
+{
+}
+
+CurlHandlePool::Lease& CurlHandlePool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other) {
+        release();
+        pool_ = std::exchange(other.pool_, nullptr);
+        handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+}
+
+void CurlHandlePool::Lease::release()
+{
+    if (pool_ && handle_) {
+        pool_->give_back(handle_);
+    }
+    pool_ = nullptr;
+    handle_ = nullptr;
+}
+
+//----------------------------------------------------------------------------------
+// CurlHandlePool
+//----------------------------------------------------------------------------------
+
+CurlHandlePool& CurlHandlePool::instance()
+{
+    static CurlHandlePool pool;
+    return pool;
+}
+
+CurlHandlePool::CurlHandlePool()
+{
+    // Reference-counted by libcurl, so this pairs safely with initialize()/cleanup().
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+
+    share_ = curl_share_init();
+    if (share_) {
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lock_cb);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlock_cb);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+}
+
+CurlHandlePool::~CurlHandlePool()
+{
+    for (CURL* handle : idle_) {
+        curl_easy_cleanup(handle);
+    }
+    idle_.clear();
+    if (share_) {
+        curl_share_cleanup(share_);
+    }
+    curl_global_cleanup();
+}
+
+void CurlHandlePool::lock_cb(CURL*, curl_lock_data data, curl_lock_access, void* userp)
+{
+    static_cast<CurlHandlePool*>(userp)->share_locks_[data].lock();
+}
+
+void CurlHandlePool::unlock_cb(CURL*, curl_lock_data data, void* userp)
+{
+    static_cast<CurlHandlePool*>(userp)->share_locks_[data].unlock();
+}
+
+/**
+ * Options every pooled request starts from. curl_easy_reset() clears them on return,
+ * so they are applied again on each acquire().
+ */
+void CurlHandlePool::apply_defaults(CURL* handle)
+{
+    if (share_) {
+        curl_easy_setopt(handle, CURLOPT_SHARE, share_);
+    }
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 30L);
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(handle, CURLOPT_SSL_VERIFYHOST, 2L);
+}
+
+CurlHandlePool::Lease CurlHandlePool::acquire()
+{
+    CURL* handle = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(idle_mutex_);
+        if (!idle_.empty()) {
+            handle = idle_.back();
+            idle_.pop_back();
+        }
+    }
+    if (!handle) {
+        handle = curl_easy_init();
+        if (!handle) {
+            return Lease();
+        }
+    }
+    apply_defaults(handle);
+    return Lease(this, handle);
+}
+
+void CurlHandlePool::give_back(CURL* handle)
+{
+    // Only options are cleared; acquire() attaches the shared DNS and TLS caches again.
+    curl_easy_reset(handle);
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    idle_.push_back(handle);
+}
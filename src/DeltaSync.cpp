@@ -0,0 +1,274 @@
+#include "DeltaSync.h"
+#include "JsonStream.h"
+#include "SyncManifest.h"
+#include <algorithm>
+#include <ctime>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace {
+
+// Allowance for clock differences between this machine and the API, and for updates
+// that land while a sync is running.
+const long long SLACK_SECONDS = 3600;
+
+const long long DAY_SECONDS = 24 * 3600;
+
+// The periods updated.json accepts. A month is taken as four weeks, so a month-old
+// sync is never assumed to be covered when it is not.
+const std::pair<long long, const char*> PERIODS[] = {
+    { DAY_SECONDS, "1d" },
+    { 7 * DAY_SECONDS, "1w" },
+    { 28 * DAY_SECONDS, "1m" },
+};
+
+} // namespace
+
+bool delta_sync_enabled()
+{
+    const char* env = std::getenv("MODULAR_DELTA_SYNC");
+    return !(env && std::string(env) == "0");
+}
+
+//----------------------------------------------------------------------------------
+// DeltaSync
+//----------------------------------------------------------------------------------
+
+DeltaSync::DeltaSync(const std::string& game_domain)
+    : game_domain_(game_domain)
+    , domain_directory_(SyncManifest::for_domain(game_domain).domain_directory())
+{
+}
+
+fs::path DeltaSync::state_path() const
+{
+    return domain_directory_ / "delta_sync.json";
+}
+
+/**
+ * A missing or unreadable state is the same as never having synced.
+ */
+bool DeltaSync::load()
+{
+    last_sync_ = 0;
+    files_.clear();
+    std::ifstream ifs(state_path().string());
+    if (!ifs.is_open()) {
+        return true;
+    }
+    try {
+        json data = json::parse(ifs);
+        last_sync_ = data.value("last_sync", 0LL);
+        json mods = data.value("mods", json::object());
+        for (const auto& [key, list] : mods.items()) {
+            int mod_id = std::stoi(key);
+            std::vector<NexusFileInfo>& files = files_[mod_id];
+            for (const auto& item : list) {
+                NexusFileInfo info;
+                info.mod_id = mod_id;
+                info.file_id = item.value("file_id", 0);
+                info.file_name = item.value("file_name", "");
+                info.md5 = item.value("md5", "");
+                info.size_bytes = item.value("size", uintmax_t { 0 });
+                info.size_exact = item.value("size_exact", false);
+                files.push_back(info);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in " << state_path().string() << ": " << e.what() << std::endl;
+        last_sync_ = 0;
+        files_.clear();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The shortest period that covers everything since `since`, or "" if none does.
+ */
+std::string DeltaSync::period_for(long long since) const
+{
+    long long elapsed = started_ - since + SLACK_SECONDS;
+    for (const auto& [seconds, period] : PERIODS) {
+        if (elapsed <= seconds) {
+            return period;
+        }
+    }
+    return "";
+}
+
+/**
+ * A mod counts as changed if its files or its page were updated after `since`, less
+ * the slack. False if the list could not be had, in which case nothing is skipped.
+ */
+bool DeltaSync::fetch_updated(const std::string& period, long long since)
+{
+    std::string url = nexus_api_base() + "/games/" + game_domain_ + "/mods/updated.json?period=" + period;
+    std::vector<std::string> local_headers = {
+        "accept: application/json",
+        "apikey: " + API_KEY
+    };
+
+    HttpResponse resp = http_get(url, local_headers, true);
+    if (resp.status_code != 200) {
+        std::cout << "Error fetching updated mods for " << game_domain_ << ": " << resp.status_code << std::endl;
+        return false;
+    }
+
+    updated_.clear();
+    try {
+        stream_json_objects(resp.body, { { "*" } }, { "mod_id", "latest_file_update", "latest_mod_activity" },
+            [&](const JsonFields& mod) {
+                auto id = mod.find("mod_id");
+                if (id == mod.end() || !id->second.is_number()) {
+                    return;
+                }
+                long long latest = 0;
+                for (const char* field : { "latest_file_update", "latest_mod_activity" }) {
+                    auto it = mod.find(field);
+                    if (it != mod.end() && it->second.is_number()) {
+                        latest = std::max(latest, it->second.get<long long>());
+                    }
+                }
+                if (latest >= since - SLACK_SECONDS) {
+                    updated_.insert(id->second.get<int>());
+                }
+            });
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in updated.json for " << game_domain_ << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void DeltaSync::begin(const std::vector<int>& mod_ids)
+{
+    tracked_ = std::set<int>(mod_ids.begin(), mod_ids.end());
+    visited_.clear();
+    updated_.clear();
+    listed_ = 0;
+    delta_ = false;
+    started_ = static_cast<long long>(std::time(nullptr));
+    if (!delta_sync_enabled()) {
+        return;
+    }
+
+    load();
+    if (last_sync_ <= 0) {
+        std::cout << "Delta sync for " << game_domain_ << ": no earlier sync, listing every mod." << std::endl;
+        return;
+    }
+    std::string period = period_for(last_sync_);
+    if (period.empty()) {
+        std::cout << "Delta sync for " << game_domain_ << ": last sync is over a month old, listing every mod."
+                  << std::endl;
+        return;
+    }
+    delta_ = fetch_updated(period, last_sync_);
+    if (!delta_) {
+        return;
+    }
+
+    size_t relist = 0;
+    for (int mod_id : tracked_) {
+        relist += (updated_.count(mod_id) || !files_.count(mod_id)) ? 1 : 0;
+    }
+    std::cout << "Delta sync for " << game_domain_ << ": " << relist << " of " << tracked_.size()
+              << " mods changed or new since the last sync (period " << period << ")." << std::endl;
+}
+
+std::vector<int> DeltaSync::mod_file_ids(int mod_id)
+{
+    visited_.insert(mod_id);
+    auto known = files_.find(mod_id);
+    bool changed = updated_.count(mod_id) > 0;
+    if (delta_ && !changed && known != files_.end()) {
+        std::vector<int> file_ids;
+        for (const auto& info : known->second) {
+            remember_file_info(info);
+            file_ids.push_back(info.file_id);
+        }
+        return file_ids;
+    }
+
+    listed_++;
+    // A changed mod's cached list may predate the change.
+    std::vector<int> file_ids = get_mod_file_ids(mod_id, game_domain_, changed);
+    if (file_ids.empty()) {
+        // Failed or empty: not remembered, so the mod is listed again next time.
+        files_.erase(mod_id);
+        return file_ids;
+    }
+    std::vector<NexusFileInfo>& files = files_[mod_id];
+    files.clear();
+    for (int file_id : file_ids) {
+        NexusFileInfo info;
+        if (auto found = find_file_info(mod_id, file_id)) {
+            info = *found;
+        }
+        info.mod_id = mod_id;
+        info.file_id = file_id;
+        files.push_back(info);
+    }
+    return file_ids;
+}
+
+/**
+ * Untracked mods are forgotten. Mods not visited this run keep what they had, but then
+ * the sync time stays where it was, since their updates were never looked for.
+ */
+bool DeltaSync::finish()
+{
+    if (!delta_sync_enabled()) {
+        return true;
+    }
+    for (auto it = files_.begin(); it != files_.end();) {
+        it = tracked_.count(it->first) ? std::next(it) : files_.erase(it);
+    }
+    bool complete = std::includes(visited_.begin(), visited_.end(), tracked_.begin(), tracked_.end());
+    if (complete) {
+        last_sync_ = started_;
+    }
+
+    json mods = json::object();
+    for (const auto& [mod_id, files] : files_) {
+        json list = json::array();
+        for (const auto& info : files) {
+            list.push_back({
+                { "file_id", info.file_id },
+                { "file_name", info.file_name },
+                { "md5", info.md5 },
+                { "size", info.size_bytes },
+                { "size_exact", info.size_exact } });
+        }
+        mods[std::to_string(mod_id)] = list;
+    }
+
+    std::error_code ec;
+    fs::create_directories(domain_directory_, ec);
+    fs::path tmp = state_path();
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return false;
+        }
+        ofs << json { { "last_sync", last_sync_ }, { "mods", mods } }.dump();
+    }
+    fs::rename(tmp, state_path(), ec);
+    if (ec) {
+        std::cerr << "Failed to save " << state_path().string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    if (delta_) {
+        std::cout << "Delta sync for " << game_domain_ << ": listed " << listed_ << " of " << tracked_.size()
+                  << " mods." << std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,456 @@
+#include "Deploy.h"
+#include "LibraryIndex.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <nlohmann/json.hpp>
+#include <system_error>
+#include <utility>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace {
+
+// What a tree holds at one path: the mod file it links to, with that file's size and
+// modification time when it was linked (a hardlink keeps pointing at the old inode
+// when a mod update replaces the file, so the path alone is not enough).
+struct LinkState {
+    std::string source;
+    uintmax_t size = 0;
+    long long mtime = 0;
+
+    bool operator==(const LinkState& other) const
+    {
+        return source == other.source && size == other.size && mtime == other.mtime;
+    }
+};
+
+// Relative path in the tree -> what is linked there.
+using TreeState = std::map<std::string, LinkState>;
+
+fs::path libraryDirectory()
+{
+    std::string homeDir = std::string(std::getenv("HOME") ? std::getenv("HOME") : "");
+    return fs::path(homeDir) / "Games" / "Mods-Lists";
+}
+
+bool validProfileName(const std::string& name)
+{
+    return !name.empty() && name[0] != '.' && name.find_first_of("/\\") == std::string::npos;
+}
+
+fs::path normalTarget(const fs::path& target)
+{
+    fs::path normal = fs::absolute(target).lexically_normal();
+    if (normal.filename().empty()) {
+        normal = normal.parent_path();
+    }
+    return normal;
+}
+
+/**
+ * Where the trees for target live: a hidden directory next to it, so the target
+ * symlink can point at them with a short relative path and hardlinks stay on the
+ * target's filesystem.
+ */
+fs::path deployDirectory(const fs::path& target)
+{
+    return target.parent_path() / ("." + target.filename().string() + ".modular");
+}
+
+/**
+ * The files a mod contributes: its "extracted" directory when the archives were
+ * unpacked, otherwise the mod folder itself.
+ */
+fs::path modRoot(const fs::path& domainDir, const std::string& mod)
+{
+    fs::path folder = domainDir / mod;
+    std::error_code ec;
+    if (fs::is_directory(folder / "extracted", ec)) {
+        return folder / "extracted";
+    }
+    return folder;
+}
+
+/**
+ * Adds every file below root to plan, replacing what earlier mods put at the same path.
+ */
+void addFiles(const fs::path& root, TreeState& plan)
+{
+    if (LibraryIndex* index = library_index_for(root)) {
+        index->refresh(root);
+        auto entries = index->walk(root);
+        if (entries) {
+            for (const auto& [rel, entry] : *entries) {
+                if (!entry.directory) {
+                    plan[rel.generic_string()] = { (root / rel).string(), entry.size, entry.mtime };
+                }
+            }
+            return;
+        }
+    }
+
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied, ec);
+         it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) {
+            std::cerr << "Failed to read " << root.string() << ": " << ec.message() << std::endl;
+            break;
+        }
+        std::error_code entryEc;
+        if (!it->is_regular_file(entryEc)) {
+            continue;
+        }
+        LinkState state;
+        state.source = it->path().string();
+        state.size = it->file_size(entryEc);
+        state.mtime = it->last_write_time(entryEc).time_since_epoch().count();
+        plan[it->path().lexically_relative(root).generic_string()] = std::move(state);
+    }
+}
+
+struct SlotRecord {
+    unsigned long long generation = 0; // 0 = no usable record
+    TreeState files;
+};
+
+fs::path recordPath(const fs::path& tree)
+{
+    fs::path path = tree;
+    path += ".json";
+    return path;
+}
+
+SlotRecord loadRecord(const fs::path& tree)
+{
+    SlotRecord record;
+    std::ifstream ifs(recordPath(tree).string());
+    if (!ifs.is_open()) {
+        return record;
+    }
+    try {
+        json data = json::parse(ifs);
+        for (const auto& [rel, link] : data.at("files").items()) {
+            record.files[rel] = { link.at(0).get<std::string>(), link.at(1).get<uintmax_t>(), link.at(2).get<long long>() };
+        }
+        record.generation = data.at("generation").get<unsigned long long>();
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in " << recordPath(tree).string() << ": " << e.what() << std::endl;
+        record = SlotRecord();
+    }
+    return record;
+}
+
+bool saveRecord(const fs::path& tree, const std::string& profile, const SlotRecord& record)
+{
+    json files = json::object();
+    for (const auto& [rel, link] : record.files) {
+        files[rel] = json::array({ link.source, link.size, link.mtime });
+    }
+    fs::path path = recordPath(tree);
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return false;
+        }
+        ofs << json { { "profile", profile }, { "generation", record.generation }, { "files", files } }.dump();
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        std::cerr << "Failed to save " << path.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool placeLink(const std::string& source, const fs::path& link, DeployLinks links)
+{
+    std::error_code ec;
+    if (links == DeployLinks::Hardlink) {
+        fs::create_hard_link(source, link, ec);
+        if (!ec) {
+            return true;
+        }
+        ec.clear();
+    }
+    fs::create_symlink(source, link, ec);
+    return !ec;
+}
+
+/**
+ * Removes the link at rel and the directories that leaves empty, up to the tree root.
+ */
+bool removeLink(const fs::path& tree, const std::string& rel)
+{
+    std::error_code ec;
+    fs::path link = tree / rel;
+    if (!fs::remove(link, ec)) {
+        return false;
+    }
+    for (fs::path dir = link.parent_path(); dir != tree && fs::is_empty(dir, ec); dir = dir.parent_path()) {
+        fs::remove(dir, ec);
+    }
+    return true;
+}
+
+/**
+ * Points target at tree with one rename() of a fresh symlink over it, so anything
+ * reading through target sees either the old tree or the new one, never a mix.
+ */
+bool swapIn(const fs::path& target, const fs::path& tree)
+{
+    fs::path next = target;
+    next += ".modular-next";
+    std::error_code ec;
+    fs::remove(next, ec);
+    fs::create_directory_symlink(tree.lexically_relative(target.parent_path()), next, ec);
+    if (ec) {
+        std::cerr << "Failed to create " << next.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    fs::rename(next, target, ec);
+    if (ec) {
+        std::cerr << "Failed to switch " << target.string() << ": " << ec.message() << std::endl;
+        fs::remove(next, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The tree target points at when it is one of ours (a symlink into its deploy directory).
+ */
+std::string activeTree(const fs::path& target)
+{
+    std::error_code ec;
+    if (!fs::is_symlink(target, ec)) {
+        return "";
+    }
+    fs::path link = fs::read_symlink(target, ec);
+    if (ec || link.parent_path().filename() != deployDirectory(target).filename()) {
+        return "";
+    }
+    return link.filename().string();
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// Profiles
+//----------------------------------------------------------------------------------
+
+fs::path profileDirectory(const std::string& gameDomain)
+{
+    return libraryDirectory() / ".profiles" / gameDomain;
+}
+
+bool loadProfile(const std::string& gameDomain, const std::string& name, DeployProfile& profile)
+{
+    if (!validProfileName(name)) {
+        return false;
+    }
+    std::ifstream ifs((profileDirectory(gameDomain) / (name + ".txt")).string());
+    if (!ifs.is_open()) {
+        return false;
+    }
+    profile = DeployProfile();
+    profile.gameDomain = gameDomain;
+    profile.name = name;
+    std::string line;
+    while (std::getline(ifs, line)) {
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (!line.empty() && line[0] != '#') {
+            profile.mods.push_back(line);
+        }
+    }
+    return true;
+}
+
+bool saveProfile(const DeployProfile& profile)
+{
+    if (!validProfileName(profile.name)) {
+        std::cerr << "Invalid profile name: '" << profile.name << "'" << std::endl;
+        return false;
+    }
+    fs::path dir = profileDirectory(profile.gameDomain);
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    fs::path path = dir / (profile.name + ".txt");
+    std::ofstream ofs(path.string(), std::ios::trunc);
+    if (!ofs.is_open()) {
+        std::cerr << "Failed to open file for writing: " << path.string() << std::endl;
+        return false;
+    }
+    ofs << "# Mod folders in ~/Games/Mods-Lists/" << profile.gameDomain
+        << ", lowest priority first: a later mod's files win.\n";
+    for (const auto& mod : profile.mods) {
+        ofs << mod << "\n";
+    }
+    return true;
+}
+
+std::vector<std::string> listProfiles(const std::string& gameDomain)
+{
+    std::vector<std::string> names;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(profileDirectory(gameDomain), ec)) {
+        if (entry.path().extension() == ".txt" && validProfileName(entry.path().stem().string())) {
+            names.push_back(entry.path().stem().string());
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+//----------------------------------------------------------------------------------
+// Configuration
+//----------------------------------------------------------------------------------
+
+DeployLinks deployLinksFromEnv()
+{
+    const char* env = std::getenv("MODULAR_DEPLOY_LINKS");
+    return (env && std::string(env) == "hard") ? DeployLinks::Hardlink : DeployLinks::Symlink;
+}
+
+fs::path deployTargetFromEnv()
+{
+    const char* env = std::getenv("MODULAR_DEPLOY_TARGET");
+    return (env && *env) ? fs::path(env) : fs::path();
+}
+
+//----------------------------------------------------------------------------------
+// Deployment
+//----------------------------------------------------------------------------------
+
+std::string activeProfile(const fs::path& target)
+{
+    std::string tree = activeTree(normalTarget(target));
+    size_t dot = tree.rfind('.');
+    return dot == std::string::npos ? "" : tree.substr(0, dot);
+}
+
+std::optional<DeployStats> deployProfile(const DeployProfile& profile, const fs::path& rawTarget, DeployLinks links)
+{
+    if (!validProfileName(profile.name)) {
+        std::cerr << "Invalid profile name: '" << profile.name << "'" << std::endl;
+        return std::nullopt;
+    }
+    ScopedTimer timer("modular_deploy_seconds");
+    fs::path target = normalTarget(rawTarget);
+
+    // The target must end up as our symlink; never replace a directory with files in it.
+    std::error_code ec;
+    fs::file_status status = fs::symlink_status(target, ec);
+    if (fs::is_directory(status)) {
+        if (!fs::is_empty(target, ec) || !fs::remove(target, ec)) {
+            std::cerr << target.string() << " is a directory with files in it; move them into a mod folder "
+                      << "and add that to the profile, then deploy again." << std::endl;
+            return std::nullopt;
+        }
+    } else if (fs::exists(status) && !fs::is_symlink(status)) {
+        std::cerr << target.string() << " exists and is not a directory." << std::endl;
+        return std::nullopt;
+    }
+
+    // The profile's files, later mods overriding earlier ones.
+    fs::path domainDir = libraryDirectory() / profile.gameDomain;
+    TreeState plan;
+    for (const auto& mod : profile.mods) {
+        fs::path root = modRoot(domainDir, mod);
+        if (!fs::is_directory(root, ec)) {
+            std::cerr << "Mod folder not found, skipping: " << root.string() << std::endl;
+            continue;
+        }
+        addFiles(root, plan);
+    }
+
+    // Two trees per profile; bring the one target is not using up to date, preferring
+    // the more recently deployed one since it should need the fewest changes.
+    fs::path deployDir = deployDirectory(target);
+    fs::create_directories(deployDir, ec);
+    std::string active = activeTree(target);
+    std::string slots[2] = { profile.name + ".0", profile.name + ".1" };
+    SlotRecord records[2] = { loadRecord(deployDir / slots[0]), loadRecord(deployDir / slots[1]) };
+    int slot;
+    if (active == slots[0] || active == slots[1]) {
+        slot = active == slots[0] ? 1 : 0;
+    } else {
+        slot = records[1].generation > records[0].generation ? 1 : 0;
+    }
+    fs::path tree = deployDir / slots[slot];
+    unsigned long long generation = std::max(records[0].generation, records[1].generation) + 1;
+    SlotRecord record = std::move(records[slot]);
+
+    // Without a record the tree's contents are unknown; start it over.
+    if (record.generation == 0) {
+        fs::remove_all(tree, ec);
+        record.files.clear();
+    }
+
+    DeployStats stats;
+    stats.files = plan.size();
+    stats.tree = tree;
+    if (record.generation != 0 && record.files == plan) {
+        // Already what the profile asks for; only the target symlink needs to change.
+        stats.unchanged = plan.size();
+    } else {
+        // Nothing in the tree can be trusted to match its record while it is being changed.
+        fs::remove(recordPath(tree), ec);
+        fs::create_directories(tree, ec);
+        if (ec) {
+            std::cerr << "Failed to create " << tree.string() << ": " << ec.message() << std::endl;
+            return std::nullopt;
+        }
+
+        // Removals first, so a file can give way to a directory of the same name and back.
+        for (auto it = record.files.begin(); it != record.files.end();) {
+            if (plan.count(it->first) == 0) {
+                if (removeLink(tree, it->first)) {
+                    stats.removed++;
+                }
+                it = record.files.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        for (const auto& [rel, want] : plan) {
+            auto have = record.files.find(rel);
+            if (have != record.files.end() && have->second == want) {
+                stats.unchanged++;
+                continue;
+            }
+            fs::path link = tree / rel;
+            fs::create_directories(link.parent_path(), ec);
+            fs::remove(link, ec);
+            if (placeLink(want.source, link, links)) {
+                record.files[rel] = want;
+                stats.linked++;
+            } else {
+                record.files.erase(rel);
+                stats.failed++;
+                std::cerr << "Failed to link " << link.string() << " to " << want.source << std::endl;
+            }
+        }
+
+        record.generation = generation;
+        saveRecord(tree, profile.name, record);
+    }
+
+    if (!swapIn(target, tree)) {
+        return std::nullopt;
+    }
+
+    Metrics& metrics = Metrics::instance();
+    metrics.add("modular_deploy_links_total", static_cast<double>(stats.linked), { { "result", "linked" } });
+    metrics.add("modular_deploy_links_total", static_cast<double>(stats.unchanged), { { "result", "unchanged" } });
+    metrics.add("modular_deploy_links_total", static_cast<double>(stats.removed), { { "result", "removed" } });
+    return stats;
+}
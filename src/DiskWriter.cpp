@@ -0,0 +1,278 @@
+#include "DiskWriter.h"
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// How much data may wait for the disk before producers are made to wait.
+const size_t MAX_QUEUED_BYTES = 64 * DiskWriter::BUFFER_SIZE;
+
+// Spare buffers kept around for reuse.
+const size_t MAX_SPARE_BUFFERS = 16;
+
+std::FILE* open_unbuffered(const fs::path& path, const char* mode)
+{
+    std::FILE* fp = std::fopen(path.string().c_str(), mode);
+    if (fp) {
+        // Writes already arrive in BUFFER_SIZE pieces; stdio buffering would only add a copy.
+        std::setvbuf(fp, nullptr, _IONBF, 0);
+    }
+    return fp;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// StagedFile
+//----------------------------------------------------------------------------------
+
+std::unique_ptr<StagedFile> StagedFile::open(const fs::path& path)
+{
+    std::FILE* fp = open_unbuffered(path, "ab");
+    if (!fp) {
+        return nullptr;
+    }
+    std::error_code ec;
+    uintmax_t size = fs::file_size(path, ec);
+    return std::unique_ptr<StagedFile>(new StagedFile(path, fp, ec ? 0 : size));
+}
+
+std::unique_ptr<StagedFile> StagedFile::open_at(const fs::path& path, uintmax_t offset)
+{
+    std::FILE* fp = open_unbuffered(path, "r+b");
+    if (!fp) {
+        return nullptr;
+    }
+    if (fseeko(fp, static_cast<off_t>(offset), SEEK_SET) != 0) {
+        std::fclose(fp);
+        return nullptr;
+    }
+    auto file = std::unique_ptr<StagedFile>(new StagedFile(path, fp, offset));
+    // Whatever lies past offset belongs to someone else; never reserve over it from here.
+    file->reserved_ = UINTMAX_MAX;
+    return file;
+}
+
+StagedFile::StagedFile(fs::path path, std::FILE* fp, uintmax_t size)
+    : path_(std::move(path))
+    , state_(std::make_shared<State>())
+    , size_(size)
+    , reserved_(size)
+    , buffer_(DiskWriter::instance().take_buffer())
+{
+    state_->fp = fp;
+    state_->written = size;
+}
+
+StagedFile::~StagedFile()
+{
+    if (state_->fp) {
+        close();
+    }
+}
+
+void StagedFile::reserve(uintmax_t total_size)
+{
+    if (total_size <= reserved_ || !state_->fp) {
+        return;
+    }
+    reserved_ = total_size;
+#ifdef __linux__
+    // KEEP_SIZE: the file still looks exactly as long as what has been written, which
+    // is what a later resume goes by. Filesystems without fallocate just say no.
+    ::fallocate(fileno(state_->fp), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(total_size));
+#endif
+}
+
+bool StagedFile::append(const char* data, size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->failed) {
+            return false;
+        }
+    }
+    while (size > 0) {
+        // The first buffer after a resume is cut short so every later write starts
+        // on a BUFFER_SIZE boundary of the file.
+        uintmax_t buffer_start = size_ - buffer_.size();
+        size_t limit = DiskWriter::BUFFER_SIZE - static_cast<size_t>(buffer_start % DiskWriter::BUFFER_SIZE);
+        size_t n = std::min(size, limit - buffer_.size());
+        buffer_.insert(buffer_.end(), data, data + n);
+        size_ += n;
+        data += n;
+        size -= n;
+        if (buffer_.size() == limit) {
+            flush_buffer();
+        }
+    }
+    return true;
+}
+
+void StagedFile::flush_buffer()
+{
+    if (buffer_.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->queued++;
+    }
+    DiskWriter& writer = DiskWriter::instance();
+    writer.submit(state_, size_ - buffer_.size(), std::move(buffer_));
+    buffer_ = writer.take_buffer();
+}
+
+void StagedFile::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->idle.wait(lock, [this] { return state_->queued == 0; });
+}
+
+bool StagedFile::truncate()
+{
+    buffer_.clear();
+    wait_idle();
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (state_->fp) {
+        std::fclose(state_->fp);
+    }
+    state_->fp = open_unbuffered(path_, "wb");
+    state_->failed = (state_->fp == nullptr);
+    state_->written = 0;
+    size_ = 0;
+    reserved_ = 0;
+    return !state_->failed;
+}
+
+bool StagedFile::close()
+{
+    flush_buffer();
+    wait_idle();
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    if (state_->fp && std::fclose(state_->fp) != 0) {
+        state_->failed = true;
+    }
+    state_->fp = nullptr;
+    return !state_->failed;
+}
+
+uintmax_t StagedFile::written() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->written;
+}
+
+std::chrono::steady_clock::duration StagedFile::write_time() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return state_->write_time;
+}
+
+//----------------------------------------------------------------------------------
+// DiskWriter
+//----------------------------------------------------------------------------------
+
+DiskWriter& DiskWriter::instance()
+{
+    static DiskWriter writer;
+    return writer;
+}
+
+DiskWriter::DiskWriter()
+    : thread_([this] { run(); })
+{
+}
+
+DiskWriter::~DiskWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    has_work_.notify_all();
+    thread_.join();
+}
+
+void DiskWriter::submit(std::shared_ptr<StagedFile::State> file, uintmax_t offset, std::vector<char> data)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    has_room_.wait(lock, [this] { return queued_bytes_ < MAX_QUEUED_BYTES || jobs_.empty(); });
+    queued_bytes_ += data.size();
+    jobs_.push_back({ std::move(file), offset, std::move(data) });
+    lock.unlock();
+    has_work_.notify_one();
+}
+
+std::vector<char> DiskWriter::take_buffer()
+{
+    std::vector<char> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!spare_.empty()) {
+            buffer = std::move(spare_.back());
+            spare_.pop_back();
+        }
+    }
+    buffer.clear();
+    buffer.reserve(BUFFER_SIZE);
+    return buffer;
+}
+
+/**
+ * Writes queued buffers in submission order, which keeps each file's pieces in sequence.
+ * Remaining work is finished before the thread exits.
+ */
+void DiskWriter::run()
+{
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            has_work_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+
+        StagedFile::State& file = *job.file;
+        bool failed;
+        {
+            std::lock_guard<std::mutex> lock(file.mutex);
+            failed = file.failed || !file.fp;
+        }
+        auto began = std::chrono::steady_clock::now();
+        if (!failed && std::fwrite(job.data.data(), 1, job.data.size(), file.fp) != job.data.size()) {
+            failed = true;
+            std::cerr << "Write to a download file failed; the transfer will be retried." << std::endl;
+        }
+        auto took = std::chrono::steady_clock::now() - began;
+
+        {
+            std::lock_guard<std::mutex> lock(file.mutex);
+            file.failed = file.failed || failed;
+            if (!failed) {
+                file.written = job.offset + job.data.size();
+            }
+            file.write_time += took;
+            file.queued--;
+        }
+        file.idle.notify_all();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued_bytes_ -= job.data.size();
+        if (spare_.size() < MAX_SPARE_BUFFERS) {
+            spare_.push_back(std::move(job.data));
+        }
+        has_room_.notify_all();
+    }
+}
@@ -0,0 +1,1093 @@
+#include "DownloadEngine.h"
+#include "DiskWriter.h"
+#include "DownloadScheduler.h"
+#include "Metrics.h"
+#include "RateLimiter.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+//----------------------------------------------------------------------------------
+// Configuration
+//----------------------------------------------------------------------------------
+
+int parallel_downloads_from_env()
+{
+    const char* env = std::getenv("MODULAR_PARALLEL_DOWNLOADS");
+    if (env) {
+        int value = std::atoi(env);
+        if (value > 0) {
+            return value;
+        }
+    }
+    return 4;
+}
+
+int download_segments_from_env()
+{
+    const char* env = std::getenv("MODULAR_DOWNLOAD_SEGMENTS");
+    if (env) {
+        int value = std::atoi(env);
+        if (value > 0) {
+            return std::min(value, 64);
+        }
+    }
+    return 4;
+}
+
+uintmax_t segment_threshold_from_env()
+{
+    const char* env = std::getenv("MODULAR_SEGMENT_THRESHOLD_MB");
+    if (env) {
+        long long value = std::atoll(env);
+        if (value > 0) {
+            return static_cast<uintmax_t>(value) << 20;
+        }
+    }
+    return uintmax_t { 256 } << 20;
+}
+
+fs::path part_path_for(const fs::path& path)
+{
+    fs::path part = path;
+    part += ".part";
+    return part;
+}
+
+static fs::path segments_path_for(const fs::path& part)
+{
+    fs::path file = part;
+    file += ".segments";
+    return file;
+}
+
+static bool same_hash(const std::string& a, const std::string& b)
+{
+    return a.size() == b.size()
+        && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y) {
+               return std::tolower(x) == std::tolower(y);
+           });
+}
+
+static std::string describe(const DownloadJob& job)
+{
+    if (!job.label.empty()) {
+        return job.label;
+    }
+    return "Mod ID " + std::to_string(job.mod_id) + ", File ID " + std::to_string(job.file_id);
+}
+
+/**
+ * Total length from a Content-Range value such as "bytes 0-99/1234"; -1 if unknown.
+ */
+static curl_off_t content_range_total(const std::string& value)
+{
+    auto slash = value.rfind('/');
+    if (slash == std::string::npos || slash + 1 >= value.size() || value[slash + 1] == '*') {
+        return -1;
+    }
+    try {
+        return static_cast<curl_off_t>(std::stoll(value.substr(slash + 1)));
+    } catch (const std::exception&) {
+        return -1;
+    }
+}
+
+/**
+ * First byte of a Content-Range value such as "bytes 100-199/1234"; -1 if unknown.
+ */
+static curl_off_t content_range_start(const std::string& value)
+{
+    auto space = value.find(' ');
+    if (space == std::string::npos || value.compare(0, space, "bytes") != 0) {
+        return -1;
+    }
+    errno = 0;
+    char* end = nullptr;
+    long long start = std::strtoll(value.c_str() + space + 1, &end, 10);
+    if (errno == ERANGE || end == value.c_str() + space + 1 || *end != '-' || start < 0) {
+        return -1;
+    }
+    return static_cast<curl_off_t>(start);
+}
+
+/**
+ * What an attempt's result says about the load on its host. A write error is one the
+ * engine caused itself (an attempt abandoned to switch to segments, a full disk).
+ */
+static TransferOutcome outcome_of(CURLcode res, long http_code)
+{
+    if (res == CURLE_WRITE_ERROR || res == CURLE_ABORTED_BY_CALLBACK) {
+        return TransferOutcome::Other;
+    }
+    if (res != CURLE_OK) {
+        return TransferOutcome::Failed;
+    }
+    if (http_code == 429 || http_code == 503) {
+        return TransferOutcome::Throttled;
+    }
+    if (http_code >= 500) {
+        return TransferOutcome::Failed;
+    }
+    return (http_code == 200 || http_code == 206) ? TransferOutcome::Ok : TransferOutcome::Other;
+}
+
+//----------------------------------------------------------------------------------
+// DownloadEngine
+//----------------------------------------------------------------------------------
+
+DownloadEngine::DownloadEngine(int max_parallel, int max_attempts)
+    : multi_(curl_multi_init())
+    , control_(concurrency_options_from_env(max_parallel))
+    , max_attempts_(std::max(1, max_attempts))
+    , segments_(download_segments_from_env())
+    , segment_threshold_(segment_threshold_from_env())
+    , scheduler_(std::make_unique<DownloadScheduler>())
+    , rng_(std::random_device {}())
+{
+}
+
+DownloadEngine::~DownloadEngine()
+{
+    if (source_) {
+        source_->set_listener({});
+    }
+    if (multi_) {
+        curl_multi_cleanup(multi_);
+    }
+}
+
+void DownloadEngine::add(DownloadJob job)
+{
+    scheduler_->push(std::move(job));
+}
+
+void DownloadEngine::set_source(BoundedQueue<DownloadJob>* source)
+{
+    if (source_) {
+        source_->set_listener({});
+    }
+    source_ = source;
+    if (source_) {
+        // Wake the event loop as soon as a job arrives instead of at the next poll timeout.
+        CURLM* multi = multi_;
+        source_->set_listener([multi] { curl_multi_wakeup(multi); });
+    }
+}
+
+std::vector<DownloadResult> DownloadEngine::take_completed()
+{
+    std::vector<DownloadResult> out(completed_.begin(), completed_.end());
+    completed_.clear();
+    return out;
+}
+
+/**
+ * Feed the first length bytes of an existing file into a hash.
+ */
+static bool hash_prefix(const fs::path& path, Md5& md5, curl_off_t length)
+{
+    std::FILE* fp = std::fopen(path.string().c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    std::vector<char> chunk(1 << 20);
+    curl_off_t remaining = length;
+    while (remaining > 0) {
+        size_t want = static_cast<size_t>(std::min<curl_off_t>(remaining, static_cast<curl_off_t>(chunk.size())));
+        size_t got = std::fread(chunk.data(), 1, want, fp);
+        if (got == 0) {
+            break;
+        }
+        md5.update(chunk.data(), got);
+        remaining -= static_cast<curl_off_t>(got);
+    }
+    std::fclose(fp);
+    return remaining == 0;
+}
+
+/**
+ * Write callback: append the body to the .part file and to the running hash.
+ * The first chunk decides what to do with the body: a 200 in answer to a Range
+ * request means the server is sending the whole file again, so the .part file is
+ * truncated; a 206 that starts anywhere but the end of the .part file can't be
+ * appended, so the file is truncated and the attempt abandoned for finish() to start
+ * over; anything other than 200/206 is an error page and is thrown away.
+ * Once the body's length is known the rest of the file is reserved on disk, unless
+ * it is long enough to be worth fetching in segments, in which case the attempt is
+ * abandoned here and finish() switches the job over.
+ *
+ * A segment only reads a 206 for exactly its range and never writes past the end of
+ * it. Any other response is abandoned before its body, so a server that ignores Range
+ * doesn't send the whole file once per segment.
+ */
+size_t DownloadEngine::write_cb(char* ptr, size_t size, size_t nmemb, void* userp)
+{
+    auto* t = static_cast<Transfer*>(userp);
+    size_t totalSize = size * nmemb;
+
+    if (!t->status_checked && t->split) {
+        t->status_checked = true;
+        long code = 0;
+        curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 206 || content_range_start(t->content_range) != t->offset) {
+            t->rejected = true;
+            return 0;
+        }
+    }
+
+    if (!t->status_checked) {
+        t->status_checked = true;
+        long code = 0;
+        curl_off_t length = -1;
+        curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &code);
+        curl_easy_getinfo(t->easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        if (t->split_above > 0 && code == 200 && t->accept_ranges && length >= t->split_above) {
+            t->split_total = length;
+            return 0;
+        }
+        if (code == 200 && t->offset > 0) {
+            t->offset = 0;
+            t->md5 = Md5();
+            if (!t->file->truncate()) {
+                return 0;
+            }
+        }
+        if (code == 206 && t->offset > 0 && content_range_start(t->content_range) != t->offset) {
+            t->restart = true;
+            t->offset = 0;
+            t->md5 = Md5();
+            t->file->truncate();
+            return 0;
+        }
+        t->discard_body = (code != 200 && code != 206);
+        if (!t->discard_body && length > 0) {
+            t->file->reserve(static_cast<uintmax_t>(t->offset + length));
+        }
+    }
+
+    if (t->discard_body) {
+        return totalSize;
+    }
+    if (t->split && t->offset + t->received + static_cast<curl_off_t>(totalSize) > t->limit) {
+        return 0;
+    }
+    if (!t->file->append(ptr, totalSize)) {
+        return 0;
+    }
+    if (!t->split) {
+        t->md5.update(ptr, totalSize);
+    }
+    t->received += static_cast<curl_off_t>(totalSize);
+    return totalSize;
+}
+
+/**
+ * Header callback: keep the few response headers the retry logic needs.
+ */
+size_t DownloadEngine::header_cb(char* buffer, size_t size, size_t nitems, void* userp)
+{
+    auto* t = static_cast<Transfer*>(userp);
+    size_t totalSize = size * nitems;
+    std::string line(buffer, totalSize);
+
+    auto value_of = [&line](size_t colon) {
+        auto first = line.find_first_not_of(" \t", colon + 1);
+        auto last = line.find_last_not_of(" \t\r\n");
+        return (first == std::string::npos || last < first) ? std::string() : line.substr(first, last - first + 1);
+    };
+
+    if (line.rfind("HTTP/", 0) == 0) {
+        // Only the final response after redirects counts.
+        t->accept_ranges = false;
+        t->content_range.clear();
+        return totalSize;
+    }
+
+    auto colon = line.find(':');
+    if (colon != std::string::npos) {
+        std::string name = line.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(),
+            [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (name == "retry-after") {
+            t->retry_after = value_of(colon);
+        } else if (name == "content-range") {
+            t->content_range = value_of(colon);
+        } else if (name == "accept-ranges") {
+            t->accept_ranges = value_of(colon).find("bytes") != std::string::npos;
+        }
+    }
+    return totalSize;
+}
+
+/**
+ * Delay before the next attempt: exponential from 2s, capped at 2 minutes, with the
+ * lower half randomised so parallel failures don't retry in lockstep. A server's
+ * Retry-After wins if it asks for longer.
+ */
+std::chrono::milliseconds DownloadEngine::backoff(int attempts, const std::string& retry_after)
+{
+    const long long base_ms = 2000;
+    const long long cap_ms = 120000;
+    long long delay = std::min(cap_ms, base_ms << std::min(attempts - 1, 16));
+    std::uniform_int_distribution<long long> jitter(delay / 2, delay);
+    delay = jitter(rng_);
+
+    long server_wait = parse_retry_after(retry_after);
+    if (server_wait >= 0) {
+        delay = std::max(delay, static_cast<long long>(server_wait) * 1000);
+    }
+    return std::chrono::milliseconds(delay);
+}
+
+/**
+ * Options shared by whole-file and segment attempts; the caller adds any Range.
+ */
+void DownloadEngine::configure_handle(Transfer* t)
+{
+    curl_easy_setopt(t->easy, CURLOPT_URL, t->job.url.c_str());
+    curl_easy_setopt(t->easy, CURLOPT_WRITEFUNCTION, write_cb);
+    curl_easy_setopt(t->easy, CURLOPT_WRITEDATA, t);
+    curl_easy_setopt(t->easy, CURLOPT_HEADERFUNCTION, header_cb);
+    curl_easy_setopt(t->easy, CURLOPT_HEADERDATA, t);
+    curl_easy_setopt(t->easy, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(t->easy, CURLOPT_PRIVATE, t);
+}
+
+/**
+ * Reads a .part.segments record. False if it is missing or doesn't describe a
+ * sensible set of ranges.
+ */
+bool DownloadEngine::load_segments(const fs::path& file, uintmax_t& total, std::vector<Segment>& segments)
+{
+    std::ifstream ifs(file.string());
+    if (!ifs.is_open()) {
+        return false;
+    }
+    try {
+        json data = json::parse(ifs);
+        total = data.at("size").get<uintmax_t>();
+        segments.clear();
+        for (const auto& item : data.at("segments")) {
+            Segment seg;
+            seg.start = item.at("start").get<uintmax_t>();
+            seg.end = item.at("end").get<uintmax_t>();
+            seg.done = item.at("done").get<uintmax_t>();
+            if (seg.start >= seg.end || seg.end > total || seg.done > seg.end - seg.start) {
+                return false;
+            }
+            segments.push_back(seg);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in " << file.string() << ": " << e.what() << std::endl;
+        return false;
+    }
+    return !segments.empty();
+}
+
+/**
+ * Open the .part file and hand a pooled easy handle for this attempt to the multi handle.
+ * If the .part file already has data the request asks only for the remaining bytes.
+ * A .part file with a segment record is picked up in segments instead.
+ * On success the multi handle owns the transfer until finish() takes it back.
+ */
+bool DownloadEngine::start(std::unique_ptr<Transfer>& t)
+{
+    if (t->split) {
+        return start_segment(t);
+    }
+
+    t->attempts++;
+    t->status_checked = false;
+    t->discard_body = false;
+    t->restart = false;
+    t->retry_after.clear();
+    t->content_range.clear();
+    t->accept_ranges = false;
+    t->split_total = 0;
+    t->received = 0;
+    t->reported = 0;
+
+    // A segmented .part file has holes in it, so its length says nothing; only the
+    // segment record knows which bytes are there.
+    std::error_code ec;
+    fs::path segments_file = segments_path_for(t->part);
+    if (fs::exists(segments_file, ec)) {
+        uintmax_t total = 0;
+        std::vector<Segment> segments;
+        if (!t->no_split && load_segments(segments_file, total, segments)
+            && (t->job.expected_size == 0 || t->job.expected_size == total)) {
+            begin_split(std::move(t), total, std::move(segments));
+            return true;
+        }
+        fs::remove(segments_file, ec);
+        fs::remove(t->part, ec);
+    }
+
+    t->offset = fs::exists(t->part, ec) ? static_cast<curl_off_t>(fs::file_size(t->part, ec)) : 0;
+    if (ec) {
+        t->offset = 0;
+    }
+
+    // A resumed file's hash has to cover the bytes already on disk; that prefix is
+    // the only data ever read back.
+    t->md5 = Md5();
+    if (t->offset > 0 && !hash_prefix(t->part, t->md5, t->offset)) {
+        t->offset = 0;
+        t->md5 = Md5();
+        fs::remove(t->part, ec);
+    }
+
+    if (t->offset > 0) {
+        std::cout << "Resuming " << describe(t->job) << " from byte " << t->offset
+                  << " (Attempt " << t->attempts << ")..." << std::endl;
+    } else {
+        std::cout << "Downloading " << describe(t->job)
+                  << " (Attempt " << t->attempts << ")..." << std::endl;
+    }
+
+    t->file = StagedFile::open(t->part);
+    if (!t->file) {
+        std::cerr << "Failed to open file for writing: " << t->part.string() << std::endl;
+        return false;
+    }
+    // Until the response says how long it is, the job's own size is the best guess.
+    t->file->reserve(std::max(t->job.expected_size, t->job.size_hint));
+    // Only a fresh start is split; a resumed stream already has its bytes in order.
+    bool may_split = !t->no_split && segments_ > 1 && t->offset == 0;
+    t->split_above = may_split ? static_cast<curl_off_t>(segment_threshold_) : 0;
+
+    t->lease = CurlHandlePool::instance().acquire();
+    t->easy = t->lease.get();
+    if (!t->easy) {
+        std::cerr << "Failed to initialize CURL for download." << std::endl;
+        t->file.reset();
+        return false;
+    }
+
+    configure_handle(t.get());
+    if (t->offset > 0) {
+        std::string range = std::to_string(t->offset) + "-";
+        curl_easy_setopt(t->easy, CURLOPT_RANGE, range.c_str());
+    }
+
+    open_connection(*t);
+    active_++;
+    control_.slot_taken(t->host);
+    large_active_ += t->large ? 1 : 0;
+    t.release();
+    return true;
+}
+
+/**
+ * Hand a configured attempt to the multi handle, at the receive speed the controller
+ * allows one more connection to its host.
+ */
+void DownloadEngine::open_connection(Transfer& t)
+{
+    control_.connection_opened(t.host);
+    curl_easy_setopt(t.easy, CURLOPT_MAX_RECV_SPEED_LARGE, static_cast<curl_off_t>(control_.speed_cap(t.host)));
+    curl_multi_add_handle(multi_, t.easy);
+    running_.push_back(&t);
+}
+
+/**
+ * Re-apply the controller's speed caps to every running attempt. libcurl reads the
+ * limit as it goes, so a running transfer speeds up or slows down without restarting.
+ */
+void DownloadEngine::apply_speed_caps()
+{
+    for (Transfer* t : running_) {
+        curl_easy_setopt(t->easy, CURLOPT_MAX_RECV_SPEED_LARGE, static_cast<curl_off_t>(control_.speed_cap(t->host)));
+    }
+}
+
+/**
+ * Hand an attempt's easy handle back to the pool and close its file. Everything the
+ * writer thread still holds is on disk by the time this returns. Returns the HTTP
+ * status and whether every write succeeded.
+ */
+bool DownloadEngine::release(Transfer& t, CURLcode res, long& http_code)
+{
+    http_code = 0;
+    if (t.easy) {
+        curl_easy_getinfo(t.easy, CURLINFO_RESPONSE_CODE, &http_code);
+        record_curl_transfer(t.easy, "download");
+        curl_multi_remove_handle(multi_, t.easy);
+        running_.erase(std::remove(running_.begin(), running_.end(), &t), running_.end());
+        control_.received(static_cast<uint64_t>(t.received - t.reported));
+        t.reported = t.received;
+        control_.connection_closed(t.host, outcome_of(res, http_code));
+        t.lease = CurlHandlePool::Lease();
+        t.easy = nullptr;
+    }
+    bool written = true;
+    if (t.file) {
+        written = t.file->close();
+        Metrics::instance().observe_seconds("modular_disk_write_seconds",
+            std::chrono::duration<double>(t.file->write_time()).count(), { { "kind", "download" } });
+    }
+    return written;
+}
+
+void DownloadEngine::finish(std::unique_ptr<Transfer> t, CURLcode res)
+{
+    if (t->split) {
+        finish_segment(std::move(t), res);
+        return;
+    }
+
+    long http_code = 0;
+    if (t->easy) {
+        active_--;
+        control_.slot_released(t->host);
+        large_active_ -= t->large ? 1 : 0;
+    }
+    bool written = release(*t, res, http_code);
+    t->file.reset();
+
+    // Abandoned on purpose after the headers: the body is big enough to fetch in pieces.
+    if (t->split_total > 0) {
+        uintmax_t total = static_cast<uintmax_t>(t->split_total);
+        begin_split(std::move(t), total, {});
+        return;
+    }
+
+    // Abandoned because the server resumed somewhere other than where the .part file
+    // ends; its bytes can't be trusted to line up, so the job starts over from zero.
+    if (t->restart) {
+        std::cerr << "Server resumed " << describe(t->job) << " at the wrong offset ("
+                  << t->content_range << "); starting it over." << std::endl;
+        std::error_code ec;
+        fs::remove(t->part, ec);
+        t->not_before = {};
+        pending_.push_front(std::move(t));
+        return;
+    }
+
+    bool complete = (res == CURLE_OK && (http_code == 200 || http_code == 206) && written);
+
+    // 416 on a resume usually means the .part file already holds the whole body
+    // (e.g. we stopped between the last byte and the rename). Otherwise start over.
+    if (res == CURLE_OK && http_code == 416 && t->offset > 0) {
+        if (content_range_total(t->content_range) == t->offset) {
+            complete = true;
+        } else {
+            std::error_code ec;
+            fs::remove(t->part, ec);
+        }
+    }
+
+    conclude(std::move(t), complete, res, http_code);
+}
+
+/**
+ * Check a finished file against the job's hash and size and move it into place, or
+ * report the failure and schedule another attempt if one is worth making.
+ */
+void DownloadEngine::conclude(std::unique_ptr<Transfer> t, bool complete, CURLcode res, long http_code)
+{
+    const DownloadJob& job = t->job;
+    bool corrupt = false;
+    std::string md5;
+    if (complete) {
+        md5 = t->md5.hex_digest();
+        std::error_code ec;
+        uintmax_t size = fs::file_size(t->part, ec);
+        if (!job.expected_md5.empty() && !same_hash(md5, job.expected_md5)) {
+            std::cerr << "Checksum mismatch for " << describe(job) << ": expected "
+                      << job.expected_md5 << ", got " << md5 << std::endl;
+            corrupt = true;
+        } else if (job.expected_size > 0 && !ec && size != job.expected_size) {
+            std::cerr << "Size mismatch for " << describe(job) << ": expected "
+                      << job.expected_size << " bytes, got " << size << std::endl;
+            corrupt = true;
+        }
+        if (corrupt) {
+            // Nothing in the .part file can be trusted; the next attempt starts from zero.
+            fs::remove(t->part, ec);
+            fs::remove(segments_path_for(t->part), ec);
+            complete = false;
+        }
+    }
+
+    if (complete) {
+        DownloadResult result { job, true, res, http_code, t->attempts, md5, !job.expected_md5.empty() };
+        std::error_code ec;
+        fs::rename(t->part, job.path, ec);
+        if (ec) {
+            std::cerr << "Failed to move " << t->part.string() << " to "
+                      << job.path.string() << ": " << ec.message() << std::endl;
+            result.success = false;
+            completed_.push_back(std::move(result));
+            return;
+        }
+        fs::remove(segments_path_for(t->part), ec);
+        std::cout << "Downloaded " << job.path.filename().string()
+                  << " to " << job.path.parent_path().string()
+                  << (result.verified ? " (MD5 verified)" : "") << std::endl;
+        completed_.push_back(std::move(result));
+        return;
+    }
+
+    if (!corrupt) {
+        std::cerr << "Error downloading " << describe(job) << ": CURL code " << res
+                  << ", HTTP code " << http_code << std::endl;
+    }
+
+    // Client errors other than timeouts, range mismatches and rate limiting won't fix themselves.
+    bool retryable = corrupt || res != CURLE_OK || http_code == 408 || http_code == 416
+        || http_code == 429 || http_code >= 500;
+
+    if (retryable && t->attempts < max_attempts_) {
+        auto delay = backoff(t->attempts, t->retry_after);
+        std::cout << "Retrying in " << (delay.count() + 999) / 1000 << "s..." << std::endl;
+        t->not_before = std::chrono::steady_clock::now() + delay;
+        pending_.push_back(std::move(t));
+    } else {
+        std::cerr << "Failed to download " << describe(job) << " after "
+                  << t->attempts << " attempts." << std::endl;
+        completed_.push_back({ job, false, res, http_code, t->attempts, "", false });
+    }
+}
+
+//----------------------------------------------------------------------------------
+// Segmented downloads
+//----------------------------------------------------------------------------------
+
+static std::string describe_segment(const DownloadJob& job, size_t index, size_t count)
+{
+    return "segment " + std::to_string(index + 1) + "/" + std::to_string(count) + " of " + describe(job);
+}
+
+/**
+ * Park a job's transfer and queue a transfer for every range that is not yet on disk.
+ * Without saved segments the body is cut into equal ranges on DiskWriter buffer
+ * boundaries and the whole file is reserved up front.
+ */
+void DownloadEngine::begin_split(std::unique_ptr<Transfer> t, uintmax_t total, std::vector<Segment> segments)
+{
+    if (segments.empty()) {
+        uintmax_t count = static_cast<uintmax_t>(segments_);
+        uintmax_t step = (total + count - 1) / count;
+        step = (step + DiskWriter::BUFFER_SIZE - 1) / DiskWriter::BUFFER_SIZE * DiskWriter::BUFFER_SIZE;
+        for (uintmax_t start = 0; start < total; start += step) {
+            segments.push_back({ start, std::min(total, start + step), 0 });
+        }
+        if (auto file = StagedFile::open(t->part)) {
+            file->reserve(total);
+        }
+    }
+
+    auto split = std::make_shared<SplitJob>();
+    split->owner = std::move(t);
+    split->total = total;
+    split->segments = std::move(segments);
+    save_segments(*split);
+
+    const DownloadJob& job = split->owner->job;
+    uintmax_t remaining = 0;
+    for (size_t i = 0; i < split->segments.size(); i++) {
+        const Segment& seg = split->segments[i];
+        if (seg.done == seg.end - seg.start) {
+            continue;
+        }
+        remaining += seg.end - seg.start - seg.done;
+        auto s = std::make_unique<Transfer>();
+        s->job = job;
+        s->part = split->owner->part;
+        s->split = split;
+        s->segment = i;
+        s->host = split->owner->host;
+        pending_segments_.push_back(std::move(s));
+        split->outstanding++;
+    }
+    std::cout << "Fetching " << describe(job) << " in " << split->segments.size() << " segments ("
+              << remaining << " of " << total << " bytes to go)..." << std::endl;
+
+    splits_.push_back(split);
+    active_++;
+    control_.slot_taken(split->owner->host);
+    large_active_ += split->owner->large ? 1 : 0;
+    if (split->outstanding == 0) {
+        finish_split(split);
+    }
+}
+
+/**
+ * Like start(), for one range of a segmented job: the request asks for the bytes
+ * between the end of what the segment already has and the end of its range. If the
+ * job has already been given up on, the transfer just stands down.
+ */
+bool DownloadEngine::start_segment(std::unique_ptr<Transfer>& t)
+{
+    std::shared_ptr<SplitJob> split = t->split;
+    auto stand_down = [&] {
+        t.reset();
+        if (--split->outstanding == 0) {
+            finish_split(split);
+        }
+        return true;
+    };
+    if (split->failed || split->unsupported) {
+        return stand_down();
+    }
+
+    Segment& seg = split->segments[t->segment];
+    t->attempts++;
+    t->status_checked = false;
+    t->rejected = false;
+    t->retry_after.clear();
+    t->content_range.clear();
+    t->received = 0;
+    t->reported = 0;
+    t->offset = static_cast<curl_off_t>(seg.start + seg.done);
+    t->limit = static_cast<curl_off_t>(seg.end);
+
+    if (t->attempts > 1) {
+        std::cout << "Resuming " << describe_segment(t->job, t->segment, split->segments.size())
+                  << " from byte " << t->offset << " (Attempt " << t->attempts << ")..." << std::endl;
+    }
+
+    t->file = StagedFile::open_at(t->part, seg.start + seg.done);
+    if (!t->file) {
+        std::cerr << "Failed to open file for writing: " << t->part.string() << std::endl;
+        split->failed = true;
+        split->curl_code = CURLE_WRITE_ERROR;
+        return stand_down();
+    }
+    t->lease = CurlHandlePool::instance().acquire();
+    t->easy = t->lease.get();
+    if (!t->easy) {
+        std::cerr << "Failed to initialize CURL for download." << std::endl;
+        t->file.reset();
+        split->failed = true;
+        split->curl_code = CURLE_FAILED_INIT;
+        return stand_down();
+    }
+    seg.file = t->file.get();
+
+    configure_handle(t.get());
+    std::string range = std::to_string(t->offset) + "-" + std::to_string(seg.end - 1);
+    curl_easy_setopt(t->easy, CURLOPT_RANGE, range.c_str());
+
+    open_connection(*t);
+    t.release();
+    return true;
+}
+
+/**
+ * Record how far a segment got and retry it alone if it fell short. A server that
+ * answers a range with the whole file, or with some other range, can't be fetched in
+ * segments at all, so the job is handed back to be fetched as one stream.
+ */
+void DownloadEngine::finish_segment(std::unique_ptr<Transfer> t, CURLcode res)
+{
+    std::shared_ptr<SplitJob> split = t->split;
+    Segment& seg = split->segments[t->segment];
+    long http_code = 0;
+    // Abandoned on purpose after the status line; the status says what happened.
+    if (t->rejected && res == CURLE_WRITE_ERROR) {
+        res = CURLE_OK;
+    }
+    release(*t, res, http_code);
+
+    // Only what actually reached the file counts, whatever curl received.
+    uintmax_t length = seg.end - seg.start;
+    seg.done = std::min(length, std::max(seg.done, t->file->written() - seg.start));
+    seg.file = nullptr;
+    t->file.reset();
+    save_segments(*split);
+    split->outstanding--;
+
+    const DownloadJob& job = t->job;
+    if (seg.done == length) {
+        if (split->outstanding == 0) {
+            finish_split(split);
+        }
+        return;
+    }
+
+    if (res == CURLE_OK && (http_code == 200 || (t->rejected && http_code == 206))) {
+        if (!split->unsupported) {
+            std::cerr << "Server ignored the range request for " << describe(job)
+                      << "; fetching it as a single stream." << std::endl;
+        }
+        split->unsupported = true;
+    } else if (!split->failed && !split->unsupported) {
+        std::string name = describe_segment(job, t->segment, split->segments.size());
+        std::cerr << "Error downloading " << name << ": CURL code " << res
+                  << ", HTTP code " << http_code << std::endl;
+
+        // A short 206 is retried like a dropped connection.
+        bool retryable = res != CURLE_OK || http_code == 206 || http_code == 408 || http_code == 416
+            || http_code == 429 || http_code >= 500;
+        if (retryable && t->attempts < max_attempts_) {
+            auto delay = backoff(t->attempts, t->retry_after);
+            std::cout << "Retrying " << name << " in " << (delay.count() + 999) / 1000 << "s..." << std::endl;
+            t->not_before = std::chrono::steady_clock::now() + delay;
+            pending_segments_.push_back(std::move(t));
+            split->outstanding++;
+            return;
+        }
+        split->failed = true;
+        split->curl_code = res;
+        split->http_code = http_code;
+    }
+
+    if (split->outstanding == 0) {
+        finish_split(split);
+    }
+}
+
+/**
+ * Called once no segment of a job is running or waiting. A complete file is hashed
+ * from disk, since its segments arrived out of order, and then treated like any
+ * other finished download. A failed one keeps its .part and segment record so the
+ * next run only fetches what is missing.
+ */
+void DownloadEngine::finish_split(const std::shared_ptr<SplitJob>& split)
+{
+    splits_.erase(std::remove(splits_.begin(), splits_.end(), split), splits_.end());
+    active_--;
+
+    std::unique_ptr<Transfer> t = std::move(split->owner);
+    control_.slot_released(t->host);
+    large_active_ -= t->large ? 1 : 0;
+    std::error_code ec;
+    if (split->unsupported) {
+        fs::remove(t->part, ec);
+        fs::remove(segments_path_for(t->part), ec);
+        t->no_split = true;
+        t->not_before = {};
+        pending_.push_front(std::move(t));
+        return;
+    }
+    if (split->failed) {
+        std::cerr << "Failed to download " << describe(t->job) << " after "
+                  << t->attempts << " attempts." << std::endl;
+        completed_.push_back({ t->job, false, split->curl_code, split->http_code, t->attempts, "", false });
+        return;
+    }
+
+    t->md5 = Md5();
+    if (!hash_prefix(t->part, t->md5, static_cast<curl_off_t>(split->total))) {
+        fs::remove(t->part, ec);
+        fs::remove(segments_path_for(t->part), ec);
+        conclude(std::move(t), false, CURLE_PARTIAL_FILE, 206);
+        return;
+    }
+    conclude(std::move(t), true, CURLE_OK, 206);
+}
+
+/**
+ * Write the segment record for a split job, counting the bytes running segments
+ * have already got onto disk.
+ */
+void DownloadEngine::save_segments(const SplitJob& split) const
+{
+    json ranges = json::array();
+    for (const Segment& seg : split.segments) {
+        uintmax_t done = seg.done;
+        if (seg.file) {
+            done = std::min(seg.end - seg.start, std::max(done, seg.file->written() - seg.start));
+        }
+        ranges.push_back({ { "start", seg.start }, { "end", seg.end }, { "done", done } });
+    }
+
+    fs::path path = segments_path_for(split.owner->part);
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return;
+        }
+        ofs << json { { "size", split.total }, { "segments", ranges } }.dump(2);
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        std::cerr << "Failed to save " << path.string() << ": " << ec.message() << std::endl;
+    }
+}
+
+/**
+ * Start every pending job whose retry delay has elapsed and whose host has a slot
+ * free, within the controller's limits. Retries go first so a job that already made
+ * progress isn't starved by new ones.
+ */
+void DownloadEngine::start_ready()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    // Segments run inside their job's slot, so they don't wait for one.
+    for (size_t i = 0; i < pending_segments_.size();) {
+        if (pending_segments_[i]->not_before > now) {
+            i++;
+            continue;
+        }
+        std::unique_ptr<Transfer> t = std::move(pending_segments_[i]);
+        pending_segments_.erase(pending_segments_.begin() + i);
+        start_segment(t);
+    }
+
+    for (size_t i = 0; i < pending_.size() && active_ < control_.limit();) {
+        if (pending_[i]->not_before > now || !control_.may_start(pending_[i]->host)) {
+            i++;
+            continue;
+        }
+        std::unique_ptr<Transfer> t = std::move(pending_[i]);
+        pending_.erase(pending_.begin() + i);
+        if (t->waiting_for_host) {
+            t->waiting_for_host = false;
+            parked_--;
+        }
+        if (!start(t)) {
+            // Could not even begin the attempt (e.g. unwritable path); retrying won't help.
+            completed_.push_back({ t->job, false, CURLE_FAILED_INIT, 0, t->attempts, "", false });
+        }
+    }
+
+    // Then pull fresh work from the producer, keeping only a slot's worth waiting per slot.
+    while (source_ && scheduler_->size() < static_cast<size_t>(control_.limit())) {
+        std::optional<DownloadJob> job = source_->try_pop();
+        if (!job) {
+            break;
+        }
+        scheduler_->push(std::move(*job));
+    }
+
+    // New jobs go into the free slots in the scheduler's order. One whose host is at its
+    // limit waits with the retries, and only a slot's worth of those are set aside.
+    while (active_ < control_.limit() && parked_ < control_.limit()) {
+        std::optional<ScheduledJob> next = scheduler_->pop(control_.limit(), large_active_);
+        if (!next) {
+            break;
+        }
+        auto t = std::make_unique<Transfer>();
+        t->job = std::move(next->job);
+        t->part = part_path_for(t->job.path);
+        t->large = next->large;
+        t->host = control_.host_id(t->job.url);
+        if (!control_.may_start(t->host)) {
+            t->waiting_for_host = true;
+            parked_++;
+            pending_.push_back(std::move(t));
+            continue;
+        }
+        if (!start(t)) {
+            completed_.push_back({ t->job, false, CURLE_FAILED_INIT, 0, t->attempts, "", false });
+        }
+    }
+}
+
+void DownloadEngine::drain_completed(const std::function<void(const DownloadResult&)>& on_complete)
+{
+    if (!on_complete) {
+        return;
+    }
+    while (!completed_.empty()) {
+        DownloadResult result = std::move(completed_.front());
+        completed_.pop_front();
+        on_complete(result);
+    }
+}
+
+void DownloadEngine::run(const std::function<void(const DownloadResult&)>& on_complete)
+{
+    if (!multi_) {
+        std::cerr << "Failed to initialize CURL multi handle." << std::endl;
+        return;
+    }
+
+    auto has_work = [this] {
+        return active_ > 0 || !pending_.empty() || !pending_segments_.empty() || !scheduler_->empty()
+            || (source_ && !source_->drained());
+    };
+
+    while (has_work()) {
+        start_ready();
+
+        int running = 0;
+        curl_multi_perform(multi_, &running);
+
+        CURLMsg* msg = nullptr;
+        int msgs_left = 0;
+        while ((msg = curl_multi_info_read(multi_, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            Transfer* raw = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &raw);
+            CURLcode res = msg->data.result;
+            finish(std::unique_ptr<Transfer>(raw), res);
+        }
+
+        drain_completed(on_complete);
+
+        // Count what arrived since the last pass and let the controller adjust the limits.
+        for (Transfer* t : running_) {
+            control_.received(static_cast<uint64_t>(t->received - t->reported));
+            t->reported = t->received;
+        }
+        if (control_.tick(std::chrono::steady_clock::now())) {
+            apply_speed_caps();
+        }
+
+        // Keep segment records of long downloads current in case the run is cut short.
+        if (!splits_.empty() && std::chrono::steady_clock::now() >= next_checkpoint_) {
+            for (const auto& split : splits_) {
+                save_segments(*split);
+            }
+            next_checkpoint_ = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        }
+
+        if (!has_work()) {
+            break;
+        }
+
+        // Wake up for socket activity, when the next delayed retry becomes due, or for
+        // the controller's next step. A free slot with a job queued for it doesn't wait
+        // at all, nor does one whose job is still in the source: its wake-up may already
+        // have been used up. A job waiting for its host is woken by that host's transfers finishing.
+        auto now = std::chrono::steady_clock::now();
+        int timeout_ms = static_cast<int>(std::clamp<long long>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(control_.next_tick() - now).count(), 0, 1000));
+        if (active_ < control_.limit() && parked_ < control_.limit()
+            && (!scheduler_->empty() || (source_ && source_->ready()))) {
+            timeout_ms = 0;
+        } else if (active_ < control_.limit()) {
+            for (const auto& t : pending_) {
+                if (!control_.may_start(t->host)) {
+                    continue;
+                }
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(t->not_before - now).count();
+                timeout_ms = static_cast<int>(std::clamp<long long>(wait, 0, timeout_ms));
+                if (timeout_ms == 0) {
+                    break; // something is ready now; no need to look at the rest of a long queue
+                }
+            }
+        }
+        for (const auto& t : pending_segments_) {
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                t->not_before - std::chrono::steady_clock::now()).count();
+            timeout_ms = static_cast<int>(std::clamp<long long>(wait, 0, timeout_ms));
+        }
+        curl_multi_poll(multi_, nullptr, 0, timeout_ms, nullptr);
+    }
+
+    drain_completed(on_complete);
+}
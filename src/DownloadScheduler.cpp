@@ -0,0 +1,271 @@
+#include "DownloadScheduler.h"
+#include "CurlPool.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace {
+
+// HEAD requests a probe keeps in flight per allowed parallel download.
+const int PROBES_PER_SLOT = 4;
+
+uintmax_t job_size(const DownloadJob& job)
+{
+    return job.expected_size > 0 ? job.expected_size : job.size_hint;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// Configuration
+//----------------------------------------------------------------------------------
+
+DownloadOrder download_order_from_env()
+{
+    const char* env = std::getenv("MODULAR_DOWNLOAD_ORDER");
+    std::string value = env ? env : "";
+    if (value == "listed") {
+        return DownloadOrder::Listed;
+    }
+    if (value == "smallest") {
+        return DownloadOrder::SmallestFirst;
+    }
+    if (value == "largest") {
+        return DownloadOrder::LargestFirst;
+    }
+    if (value == "round-robin") {
+        return DownloadOrder::RoundRobin;
+    }
+    return DownloadOrder::Balanced;
+}
+
+const char* download_order_name(DownloadOrder order)
+{
+    switch (order) {
+    case DownloadOrder::Listed:
+        return "listed";
+    case DownloadOrder::SmallestFirst:
+        return "smallest";
+    case DownloadOrder::LargestFirst:
+        return "largest";
+    case DownloadOrder::RoundRobin:
+        return "round-robin";
+    case DownloadOrder::Balanced:
+        return "balanced";
+    }
+    return "unknown";
+}
+
+std::vector<int> pinned_mods_from_env()
+{
+    std::vector<int> mods;
+    const char* env = std::getenv("MODULAR_DOWNLOAD_PIN");
+    std::stringstream ss(env ? env : "");
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int mod_id = std::atoi(item.c_str());
+        if (mod_id > 0) {
+            mods.push_back(mod_id);
+        }
+    }
+    return mods;
+}
+
+//----------------------------------------------------------------------------------
+// Size probes
+//----------------------------------------------------------------------------------
+
+size_t probe_download_sizes(std::vector<DownloadJob>& jobs, int parallel)
+{
+    std::vector<size_t> unknown;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (job_size(jobs[i]) == 0) {
+            unknown.push_back(i);
+        }
+    }
+    if (unknown.empty()) {
+        return 0;
+    }
+    CURLM* multi = curl_multi_init();
+    if (!multi) {
+        return 0;
+    }
+    ScopedTimer timer("modular_download_probe_seconds");
+
+    std::map<CURL*, std::pair<size_t, CurlHandlePool::Lease>> running;
+    size_t next = 0;
+    size_t learned = 0;
+    size_t window = static_cast<size_t>(std::max(1, parallel) * PROBES_PER_SLOT);
+    while (next < unknown.size() || !running.empty()) {
+        while (next < unknown.size() && running.size() < window) {
+            size_t index = unknown[next++];
+            CurlHandlePool::Lease lease = CurlHandlePool::instance().acquire();
+            CURL* easy = lease.get();
+            if (!easy) {
+                continue;
+            }
+            curl_easy_setopt(easy, CURLOPT_URL, jobs[index].url.c_str());
+            curl_easy_setopt(easy, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(easy, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_multi_add_handle(multi, easy);
+            running.emplace(easy, std::make_pair(index, std::move(lease)));
+        }
+
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+        CURLMsg* msg = nullptr;
+        int msgs_left = 0;
+        while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL* easy = msg->easy_handle;
+            long http_code = 0;
+            curl_off_t length = -1;
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+            curl_easy_getinfo(easy, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+            auto it = running.find(easy);
+            if (msg->data.result == CURLE_OK && http_code == 200 && length > 0 && it != running.end()) {
+                jobs[it->second.first].size_hint = static_cast<uintmax_t>(length);
+                learned++;
+            }
+            curl_multi_remove_handle(multi, easy);
+            if (it != running.end()) {
+                running.erase(it);
+            }
+        }
+        if (!running.empty()) {
+            curl_multi_poll(multi, nullptr, 0, 100, nullptr);
+        }
+    }
+    curl_multi_cleanup(multi);
+
+    Metrics::instance().add("modular_download_probes_total", static_cast<double>(unknown.size()));
+    std::cout << "Learned the size of " << learned << " of " << unknown.size() << " download(s) with HEAD requests."
+              << std::endl;
+    return learned;
+}
+
+//----------------------------------------------------------------------------------
+// DownloadScheduler
+//----------------------------------------------------------------------------------
+
+DownloadScheduler::DownloadScheduler(DownloadOrder order, std::vector<int> pinned, uintmax_t large_threshold)
+    : order_(order)
+    , large_threshold_(std::max<uintmax_t>(1, large_threshold))
+{
+    for (size_t i = 0; i < pinned.size(); i++) {
+        pin_rank_.emplace(pinned[i], i);
+    }
+}
+
+void DownloadScheduler::push(DownloadJob job)
+{
+    uintmax_t size = job_size(job);
+    uint64_t seq = seq_++;
+    size_++;
+
+    auto pin = pin_rank_.find(job.mod_id);
+    if (pin != pin_rank_.end()) {
+        pinned_.emplace(std::make_pair(pin->second, seq), std::move(job));
+        return;
+    }
+
+    switch (order_) {
+    case DownloadOrder::Listed:
+        queue_.emplace(std::make_pair(uintmax_t { 0 }, seq), std::move(job));
+        return;
+    case DownloadOrder::SmallestFirst:
+        queue_.emplace(std::make_pair(size, seq), std::move(job));
+        return;
+    case DownloadOrder::LargestFirst:
+        queue_.emplace(std::make_pair(std::numeric_limits<uintmax_t>::max() - size, seq), std::move(job));
+        return;
+    case DownloadOrder::RoundRobin:
+    case DownloadOrder::Balanced:
+        break;
+    }
+
+    int mod_id = job.mod_id;
+    auto [it, inserted] = mods_.try_emplace(mod_id);
+    ModQueue& mod = it->second;
+    if (inserted) {
+        mod.first_seen = seq;
+        if (order_ == DownloadOrder::RoundRobin) {
+            rotation_.push_back(mod_id);
+        }
+    } else if (order_ == DownloadOrder::Balanced) {
+        by_bytes_.erase({ mod.bytes, mod.first_seen, mod_id });
+    }
+    mod.bytes += size;
+    mod.files.emplace(size, std::move(job));
+    if (order_ == DownloadOrder::Balanced) {
+        by_bytes_.insert({ mod.bytes, mod.first_seen, mod_id });
+    }
+}
+
+/**
+ * Removes one file of a mod: its largest for the large share, otherwise its smallest.
+ */
+ScheduledJob DownloadScheduler::take_from_mod(int mod_id, bool large)
+{
+    auto it = mods_.find(mod_id);
+    ModQueue& mod = it->second;
+    if (order_ == DownloadOrder::Balanced) {
+        by_bytes_.erase({ mod.bytes, mod.first_seen, mod_id });
+    }
+    auto node = mod.files.extract(large ? std::prev(mod.files.end()) : mod.files.begin());
+    mod.bytes -= node.key();
+    if (mod.files.empty()) {
+        mods_.erase(it);
+    } else if (order_ == DownloadOrder::Balanced) {
+        by_bytes_.insert({ mod.bytes, mod.first_seen, mod_id });
+    }
+    size_--;
+    return { std::move(node.mapped()), large };
+}
+
+std::optional<ScheduledJob> DownloadScheduler::pop(int slots, int large_running)
+{
+    if (size_ == 0) {
+        return std::nullopt;
+    }
+
+    if (!pinned_.empty() || !queue_.empty()) {
+        auto& from = pinned_.empty() ? queue_ : pinned_;
+        auto node = from.extract(from.begin());
+        size_--;
+        bool large = job_size(node.mapped()) >= large_threshold_;
+        return ScheduledJob { std::move(node.mapped()), large };
+    }
+
+    if (order_ == DownloadOrder::RoundRobin) {
+        int mod_id = rotation_.front();
+        rotation_.pop_front();
+        ScheduledJob next = take_from_mod(mod_id, false);
+        if (mods_.count(mod_id)) {
+            rotation_.push_back(mod_id);
+        }
+        next.large = job_size(next.job) >= large_threshold_;
+        return next;
+    }
+
+    // Balanced: the biggest mod if it is large and the large share has room (or nothing
+    // small is left), otherwise the mod closest to done. One slot has nothing to overlap,
+    // so it simply goes smallest mod first.
+    const ModKey& smallest = *by_bytes_.begin();
+    const ModKey& biggest = *by_bytes_.rbegin();
+    bool have_large = std::get<0>(biggest) >= large_threshold_;
+    bool have_small = std::get<0>(smallest) < large_threshold_;
+    int large_share = slots > 1 ? std::max(1, slots / 4) : 0;
+    if (have_large && (!have_small || large_running < large_share)) {
+        return take_from_mod(std::get<2>(biggest), true);
+    }
+    return take_from_mod(std::get<2>(smallest), false);
+}
@@ -0,0 +1,366 @@
+#include "Extract.h"
+#include "Merge.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <system_error>
+
+#ifdef MODULAR_HAVE_LIBARCHIVE
+#include <archive.h>
+#include <archive_entry.h>
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Destinations waiting for a worker; far more than downloads can finish in one go, so
+// handing an archive over never stalls the download loop in practice.
+const size_t QUEUE_CAPACITY = 4096;
+
+// libarchive's read block size.
+const size_t READ_BLOCK_SIZE = 1 << 20;
+
+std::string lower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return s;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// Configuration
+//----------------------------------------------------------------------------------
+
+bool extraction_available()
+{
+#ifdef MODULAR_HAVE_LIBARCHIVE
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool extraction_enabled()
+{
+    const char* env = std::getenv("MODULAR_EXTRACT");
+    return extraction_available() && !(env && std::string(env) == "0");
+}
+
+bool is_archive(const fs::path& path)
+{
+    std::string name = lower(path.filename().string());
+    for (const char* suffix : { ".zip", ".7z", ".rar", ".tar", ".tar.gz", ".tgz", ".tar.bz2", ".tar.xz", ".tar.zst" }) {
+        std::string s = suffix;
+        if (name.size() > s.size() && name.compare(name.size() - s.size(), s.size(), s) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+fs::path extraction_directory_for(const fs::path& archive)
+{
+    return archive.parent_path() / "extracted";
+}
+
+fs::path merge_target_from_env()
+{
+    const char* env = std::getenv("MODULAR_MERGE_TARGET");
+    return (env && *env) ? fs::path(env) : fs::path();
+}
+
+unsigned extract_threads_from_env()
+{
+    const char* env = std::getenv("MODULAR_EXTRACT_THREADS");
+    if (env) {
+        int value = std::atoi(env);
+        if (value > 0) {
+            return static_cast<unsigned>(value);
+        }
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//----------------------------------------------------------------------------------
+// Extraction
+//----------------------------------------------------------------------------------
+
+#ifdef MODULAR_HAVE_LIBARCHIVE
+
+/**
+ * An entry name that stays inside the destination: relative, with no ".." parts.
+ */
+static bool safe_entry_path(const fs::path& name)
+{
+    if (name.empty() || name.has_root_path()) {
+        return false;
+    }
+    for (const auto& part : name) {
+        if (part == "..") {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * True if target is a regular file with the entry's size and modification time,
+ * i.e. what an earlier extraction of the same entry left behind, or a directory
+ * that already exists.
+ */
+static bool already_extracted(const fs::path& target, struct archive_entry* entry)
+{
+    if (archive_entry_filetype(entry) == AE_IFDIR) {
+        std::error_code ec;
+        return fs::is_directory(target, ec);
+    }
+    if (archive_entry_filetype(entry) != AE_IFREG || !archive_entry_size_is_set(entry)
+        || !archive_entry_mtime_is_set(entry)) {
+        return false;
+    }
+    struct stat st;
+    if (::stat(target.string().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    return st.st_size == archive_entry_size(entry) && st.st_mtime == archive_entry_mtime(entry);
+}
+
+static int copy_data(struct archive* reader, struct archive* writer, uintmax_t& bytes)
+{
+    const void* block;
+    size_t size;
+    la_int64_t offset;
+    for (;;) {
+        int r = archive_read_data_block(reader, &block, &size, &offset);
+        if (r == ARCHIVE_EOF) {
+            return ARCHIVE_OK;
+        }
+        if (r < ARCHIVE_OK) {
+            return r;
+        }
+        if (archive_write_data_block(writer, block, size, offset) < ARCHIVE_OK) {
+            return ARCHIVE_FAILED;
+        }
+        bytes += size;
+    }
+}
+
+ExtractResult extract_archive(const fs::path& archive, const fs::path& destination)
+{
+    ExtractResult result;
+    result.archive = archive;
+    result.destination = destination;
+    ScopedTimer timer("modular_extract_seconds");
+
+    std::error_code ec;
+    fs::create_directories(destination, ec);
+    if (ec) {
+        result.error = "cannot create " + destination.string() + ": " + ec.message();
+        return result;
+    }
+
+    struct archive* reader = archive_read_new();
+    archive_read_support_filter_all(reader);
+    archive_read_support_format_all(reader);
+    struct archive* writer = archive_write_disk_new();
+    // Paths are checked and prefixed here, so libarchive's absolute-path guard can't be used.
+    archive_write_disk_set_options(writer, ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_SECURE_NODOTDOT
+            | ARCHIVE_EXTRACT_SECURE_SYMLINKS | ARCHIVE_EXTRACT_UNLINK);
+    archive_write_disk_set_standard_lookup(writer);
+
+    if (archive_read_open_filename(reader, archive.string().c_str(), READ_BLOCK_SIZE) != ARCHIVE_OK) {
+        result.error = archive_error_string(reader) ? archive_error_string(reader) : "cannot open archive";
+        archive_read_free(reader);
+        archive_write_free(writer);
+        return result;
+    }
+
+    struct archive_entry* entry;
+    int r;
+    bool failed = false;
+    while ((r = archive_read_next_header(reader, &entry)) == ARCHIVE_OK || r == ARCHIVE_WARN) {
+        const char* raw = archive_entry_pathname(entry);
+        fs::path name = fs::path(raw ? raw : "").lexically_normal();
+        if (!safe_entry_path(name)) {
+            std::cerr << "Skipping unsafe entry '" << (raw ? raw : "") << "' in " << archive.string() << std::endl;
+            archive_read_data_skip(reader);
+            continue;
+        }
+        fs::path target = destination / name;
+        if (already_extracted(target, entry)) {
+            archive_read_data_skip(reader);
+            if (archive_entry_filetype(entry) == AE_IFREG) {
+                result.skipped++;
+            }
+            continue;
+        }
+
+        archive_entry_set_pathname(entry, target.string().c_str());
+        if (const char* link = archive_entry_hardlink(entry)) {
+            fs::path link_name = fs::path(link).lexically_normal();
+            if (!safe_entry_path(link_name)) {
+                archive_read_data_skip(reader);
+                continue;
+            }
+            archive_entry_set_hardlink(entry, (destination / link_name).string().c_str());
+        }
+
+        if (archive_write_header(writer, entry) < ARCHIVE_WARN
+            || (archive_entry_size(entry) > 0 && copy_data(reader, writer, result.bytes) != ARCHIVE_OK)
+            || archive_write_finish_entry(writer) < ARCHIVE_WARN) {
+            const char* why = archive_error_string(writer) ? archive_error_string(writer) : archive_error_string(reader);
+            result.error = name.string() + ": " + (why ? why : "write failed");
+            failed = true;
+            break;
+        }
+        result.written++;
+    }
+    if (!failed && r != ARCHIVE_EOF) {
+        result.error = archive_error_string(reader) ? archive_error_string(reader) : "corrupt archive";
+        failed = true;
+    }
+
+    archive_read_free(reader);
+    archive_write_free(writer);
+    result.success = !failed;
+
+    Metrics& metrics = Metrics::instance();
+    metrics.add("modular_extract_entries_total", static_cast<double>(result.written), { { "result", "written" } });
+    metrics.add("modular_extract_entries_total", static_cast<double>(result.skipped), { { "result", "skipped" } });
+    metrics.add("modular_extract_bytes_total", static_cast<double>(result.bytes));
+    return result;
+}
+
+#else
+
+ExtractResult extract_archive(const fs::path& archive, const fs::path& destination)
+{
+    ExtractResult result;
+    result.archive = archive;
+    result.destination = destination;
+    result.error = "this build has no archive support (libarchive was not found)";
+    return result;
+}
+
+#endif
+
+//----------------------------------------------------------------------------------
+// ExtractPool
+//----------------------------------------------------------------------------------
+
+ExtractPool::ExtractPool(fs::path merge_target, unsigned threads)
+    : merge_target_(std::move(merge_target))
+    , queue_(QUEUE_CAPACITY)
+{
+    for (unsigned i = 0; i < std::max(1u, threads); i++) {
+        workers_.emplace_back([this] { work(); });
+    }
+}
+
+ExtractPool::~ExtractPool()
+{
+    finish();
+}
+
+/**
+ * A destination is queued only when it has no worker yet; otherwise the archive just
+ * joins its list, and the worker that owns it gets to it in order.
+ */
+void ExtractPool::submit(const fs::path& archive)
+{
+    fs::path destination = extraction_directory_for(archive);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto [it, fresh] = waiting_.try_emplace(destination);
+        it->second.push_back(archive);
+        if (!fresh) {
+            return;
+        }
+    }
+    queue_.push(destination);
+}
+
+void ExtractPool::work()
+{
+    while (auto destination = queue_.pop()) {
+        extract_into(*destination);
+    }
+}
+
+/**
+ * Extract a destination's archives one by one, merge the result, and repeat while
+ * more arrived in the meantime. The destination stays in waiting_ until the worker is
+ * completely done with it, so no other worker can write into it until then.
+ */
+void ExtractPool::extract_into(const fs::path& destination)
+{
+    for (;;) {
+        bool extracted = false;
+        for (;;) {
+            fs::path archive;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                auto& archives = waiting_[destination];
+                if (archives.empty()) {
+                    break;
+                }
+                archive = std::move(archives.front());
+                archives.pop_front();
+            }
+
+            ExtractResult result = extract_archive(archive, destination);
+            if (result.success) {
+                std::cout << "Extracted " << archive.filename().string() << ": " << result.written
+                          << " written, " << result.skipped << " unchanged." << std::endl;
+                extracted = true;
+            } else {
+                std::cerr << "Failed to extract " << archive.string() << ": " << result.error << std::endl;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            results_.push_back(std::move(result));
+        }
+
+        if (extracted && !merge_target_.empty()) {
+            std::lock_guard<std::mutex> lock(merge_mutex_);
+            MergeStats stats = mergeDirectories(merge_target_, destination, mergeOptionsFromEnv());
+            if (stats.overwritten > 0) {
+                std::cerr << "Warning: merging " << destination.string() << " replaced " << stats.overwritten
+                          << " file(s) another mod had merged into " << merge_target_.string()
+                          << "; which one is kept depends on which finished last." << std::endl;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = waiting_.find(destination);
+        if (it->second.empty()) {
+            waiting_.erase(it);
+            return;
+        }
+    }
+}
+
+std::vector<ExtractResult> ExtractPool::finish()
+{
+    queue_.close();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!results_.empty()) {
+        size_t failed = static_cast<size_t>(std::count_if(results_.begin(), results_.end(),
+            [](const ExtractResult& r) { return !r.success; }));
+        std::cout << "Extracted " << results_.size() - failed << " archive(s)"
+                  << (merge_target_.empty() ? "" : " and merged them into " + merge_target_.string())
+                  << ", " << failed << " failed." << std::endl;
+    }
+    std::vector<ExtractResult> out;
+    out.swap(results_);
+    return out;
+}
@@ -1,22 +1,65 @@
 #include "GameBanana.h"
+#include "BoundedQueue.h"
+#include "BufferPool.h"
+#include "DownloadEngine.h"
+#include "HttpClient.h"
+#include "JsonStream.h"
 #include "nlohmann/json.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <curl/curl.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 using json = nlohmann::json;
 namespace fs = std::filesystem;
 
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
+namespace {
+
+// Subscriptions asked for per page; the most the API hands out at once.
+const int SUBSCRIPTIONS_PER_PAGE = 50;
+
+// What one page of /Member/<id>/Subscriptions held.
+struct SubscriptionPage {
+    bool fetched = false;
+    std::vector<std::pair<std::string, std::string>> mods;
+    long long recordCount = -1; // _aMetadata._nRecordCount; -1 if not reported
+    int perPage = 0;            // _aMetadata._nPerpage; 0 if not reported
+    bool complete = false;      // _aMetadata._bIsComplete: no pages after this one
+    size_t records = 0;         // _aRecords entries of any kind, with a subscription or not
+};
+
+/**
+ * Calls work(0) ... work(count - 1) on up to MODULAR_API_CONCURRENCY threads. The
+ * requests they make block in the shared HttpClient, which multiplexes them, so the
+ * thread count only bounds how many are outstanding at once.
+ */
+void forEachConcurrently(size_t count, const std::function<void(size_t)>& work)
 {
-    size_t totalSize = size * nmemb;
-    std::string* str = static_cast<std::string*>(userp);
-    str->append(static_cast<char*>(contents), totalSize);
-    return totalSize;
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            work(i);
+        }
+    };
+    size_t threads = std::min<size_t>(api_concurrency_from_env(), count);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
 }
 
+} // namespace
+
 void initialize()
 {
     curl_global_init(CURL_GLOBAL_DEFAULT);
@@ -27,50 +70,36 @@ void cleanup()
     curl_global_cleanup();
 }
 
-std::string httpGet(const std::string& url)
+std::string gameBananaApiBase()
 {
-    CURL* curl = curl_easy_init();
-    std::string response;
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-        CURLcode res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            std::cerr << "Error: curl_easy_perform() failed for URL " << url << "\n"
-                      << "       " << curl_easy_strerror(res) << std::endl;
-        }
-        curl_easy_cleanup(curl);
+    const char* env = std::getenv("MODULAR_GAMEBANANA_API_URL");
+    std::string base = (env && *env) ? std::string(env) : "https://gamebanana.com/apiv11";
+    while (!base.empty() && base.back() == '/') {
+        base.pop_back();
     }
-    return response;
+    return base;
 }
 
-size_t WriteFileCallback(void* ptr, size_t size, size_t nmemb, void* stream)
+std::string httpGet(const std::string& url)
 {
-    return fwrite(ptr, size, nmemb, (FILE*)stream);
+    // Same event loop and connection cache as the NexusMods requests; the client logs failures.
+    return HttpClient::instance().get(url, {}).get().body;
 }
 
-bool downloadFile(const std::string& url, const std::string& outputPath)
+bool downloadFile(const std::string& url, const std::string& outputPath, const std::string& expectedMd5)
 {
-    CURL* curl = curl_easy_init();
-    if (curl) {
-        FILE* fp = fopen(outputPath.c_str(), "wb");
-        if (!fp) {
-            std::cerr << "Error: Could not open file " << outputPath << " for writing." << std::endl;
-            curl_easy_cleanup(curl);
-            return false;
-        }
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteFileCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-        CURLcode res = curl_easy_perform(curl);
-        fclose(fp);
-        curl_easy_cleanup(curl);
-        return res == CURLE_OK;
-    }
-    return false;
+    // A one-job engine gives GameBanana the same .part staging, resume and backoff as NexusMods.
+    DownloadEngine engine(1);
+    DownloadJob job;
+    job.url = url;
+    job.path = outputPath;
+    job.label = fs::path(outputPath).filename().string();
+    job.expected_md5 = expectedMd5;
+    engine.add(std::move(job));
+
+    bool success = false;
+    engine.run([&](const DownloadResult& result) { success = result.success; });
+    return success;
 }
 
 std::string sanitizeFilename(const std::string& name)
@@ -97,54 +126,258 @@ std::string extractFileName(const std::string& downloadUrl)
     return (pos != std::string::npos && pos + 1 < downloadUrl.size()) ? downloadUrl.substr(pos + 1) : "downloaded_file";
 }
 
+static SubscriptionPage fetchSubscriptionPage(const std::string& userId, long long page)
+{
+    std::string url = gameBananaApiBase() + "/Member/" + userId + "/Subscriptions?_nPage=" + std::to_string(page)
+        + "&_nPerpage=" + std::to_string(SUBSCRIPTIONS_PER_PAGE);
+    HttpResponse response = HttpClient::instance().get(url, {}).get();
+    SubscriptionPage result;
+    if (response.status_code != 200) {
+        std::cerr << "Failed to fetch page " << page << " of the subscriptions of user " << userId << " (HTTP "
+                  << response.status_code << ")" << std::endl;
+        return result;
+    }
+    try {
+        // Only the paging metadata and three fields of each subscription are used, so skip building the full document.
+        // Whether a page is short goes by its records, not by the ones that hold a
+        // subscription, so the records themselves are matched too and counted.
+        enum { METADATA, RECORD, SUBSCRIPTION };
+        stream_json_objects(response.body, { { "_aMetadata" }, { "_aRecords", "*" }, { "_aRecords", "*", "_aSubscription" } },
+            { "_nRecordCount", "_nPerpage", "_bIsComplete", "_sSingularTitle", "_sProfileUrl", "_sName" },
+            [&](size_t path, const JsonFields& fields) {
+                if (path == RECORD) {
+                    result.records++;
+                    return;
+                }
+                if (path == METADATA) {
+                    auto recordCount = fields.find("_nRecordCount");
+                    if (recordCount != fields.end() && recordCount->second.is_number()) {
+                        result.recordCount = recordCount->second.get<long long>();
+                        auto perPage = fields.find("_nPerpage");
+                        if (perPage != fields.end() && perPage->second.is_number()) {
+                            result.perPage = perPage->second.get<int>();
+                        }
+                        auto complete = fields.find("_bIsComplete");
+                        result.complete = complete != fields.end() && complete->second.is_boolean() && complete->second.get<bool>();
+                    }
+                    return;
+                }
+                auto title = fields.find("_sSingularTitle");
+                auto profileUrl = fields.find("_sProfileUrl");
+                auto name = fields.find("_sName");
+                if (title != fields.end() && title->second == "Mod" && profileUrl != fields.end() && name != fields.end()) {
+                    result.mods.emplace_back(profileUrl->second.get<std::string>(), name->second.get<std::string>());
+                }
+            });
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in page " << page << " of the subscriptions of user " << userId << ": "
+                  << e.what() << std::endl;
+        return result;
+    }
+    result.fetched = true;
+    return result;
+}
+
+/**
+ * Without a record count (an older API, or a proxy that strips the metadata) the pages
+ * are walked one after another until one comes back short or marked complete.
+ */
 std::vector<std::pair<std::string, std::string>> fetchSubscribedMods(const std::string& userId)
 {
-    std::string url = "https://gamebanana.com/apiv11/Member/" + userId + "/Subscriptions";
-    std::string response = httpGet(url);
-    std::vector<std::pair<std::string, std::string>> mods;
-    if (response.empty())
+    SubscriptionPage first = fetchSubscriptionPage(userId, 1);
+    std::vector<std::pair<std::string, std::string>> mods = std::move(first.mods);
+    if (!first.fetched || first.complete) {
         return mods;
-    json subsJson = json::parse(response);
-    if (!subsJson.contains("_aRecords"))
-        return mods;
-    for (const auto& record : subsJson["_aRecords"]) {
-        if (record.contains("_aSubscription")) {
-            json subscription = record["_aSubscription"];
-            if (subscription.contains("_sSingularTitle") && subscription["_sSingularTitle"] == "Mod" && subscription.contains("_sProfileUrl") && subscription.contains("_sName")) {
-                mods.emplace_back(subscription["_sProfileUrl"].get<std::string>(),
-                    subscription["_sName"].get<std::string>());
+    }
+    long long perPage = first.perPage > 0 ? first.perPage : std::max<long long>(1, static_cast<long long>(first.records));
+
+    if (first.recordCount < 0) {
+        if (first.records == 0) {
+            return mods;
+        }
+        for (long long page = 2;; page++) {
+            SubscriptionPage next = fetchSubscriptionPage(userId, page);
+            mods.insert(mods.end(), next.mods.begin(), next.mods.end());
+            if (!next.fetched || next.complete || static_cast<long long>(next.records) < perPage) {
+                break;
             }
         }
+        return mods;
+    }
+
+    long long pageCount = (first.recordCount + perPage - 1) / perPage;
+    if (pageCount <= 1) {
+        return mods;
+    }
+    std::vector<SubscriptionPage> pages(static_cast<size_t>(pageCount - 1));
+    forEachConcurrently(pages.size(), [&](size_t i) {
+        pages[i] = fetchSubscriptionPage(userId, static_cast<long long>(i) + 2);
+    });
+    size_t missing = 0;
+    for (auto& page : pages) {
+        missing += page.fetched ? 0 : 1;
+        mods.insert(mods.end(), std::make_move_iterator(page.mods.begin()), std::make_move_iterator(page.mods.end()));
+    }
+    if (missing > 0) {
+        std::cerr << "Warning: " << missing << " of " << pageCount << " subscription pages could not be fetched; "
+                  << "the list is incomplete." << std::endl;
     }
     return mods;
 }
 
-std::vector<std::string> fetchModFileUrls(const std::string& modId)
+std::vector<GameBananaFile> fetchModFiles(const std::string& modId)
 {
-    std::string url = "https://gamebanana.com/apiv11/Mod/" + modId + "?_csvProperties=_aFiles";
+    std::string url = gameBananaApiBase() + "/Mod/" + modId + "?_csvProperties=_aFiles";
     std::string response = httpGet(url);
-    std::vector<std::string> urls;
+    std::vector<GameBananaFile> files;
     if (response.empty())
-        return urls;
-    json fileListJson = json::parse(response);
-    if (!fileListJson.contains("_aFiles"))
-        return urls;
-    for (const auto& fileEntry : fileListJson["_aFiles"]) {
-        if (fileEntry.contains("_sDownloadUrl")) {
-            urls.push_back(fileEntry["_sDownloadUrl"].get<std::string>());
-        }
+        return files;
+    try {
+        stream_json_objects(response, { { "_aFiles", "*" } }, { "_sDownloadUrl", "_sMd5Checksum", "_nFilesize" },
+            [&](const JsonFields& fileEntry) {
+                auto downloadUrl = fileEntry.find("_sDownloadUrl");
+                if (downloadUrl == fileEntry.end() || !downloadUrl->second.is_string()) {
+                    return;
+                }
+                GameBananaFile file;
+                file.url = downloadUrl->second.get<std::string>();
+                auto md5 = fileEntry.find("_sMd5Checksum");
+                if (md5 != fileEntry.end() && md5->second.is_string()) {
+                    file.md5 = md5->second.get<std::string>();
+                }
+                auto size = fileEntry.find("_nFilesize");
+                if (size != fileEntry.end() && size->second.is_number()) {
+                    file.size = size->second.get<uintmax_t>();
+                }
+                files.push_back(std::move(file));
+            });
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in the files of mod " << modId << ": " << e.what() << std::endl;
+        files.clear();
+    }
+    BufferPool::instance().release(std::move(response));
+    return files;
+}
+
+std::vector<std::string> fetchModFileUrls(const std::string& modId)
+{
+    std::vector<std::string> urls;
+    for (const auto& file : fetchModFiles(modId)) {
+        urls.push_back(file.url);
     }
     return urls;
 }
 
-void downloadModFiles(const std::string& modId, const std::string& modName, const std::string& baseDir)
+/**
+ * Jobs for every file of one mod, numbered in list order inside the mod's folder.
+ * The folder carries the mod ID, so two mods with the same (sanitized) name never
+ * share one and overwrite each other's numbered files. A folder left by an earlier
+ * sync under the bare name is renamed rather than downloaded again beside it.
+ */
+static std::vector<DownloadJob> modFileJobs(const std::string& modId, const std::string& modName,
+    const std::string& baseDir)
 {
-    std::string modFolder = baseDir + "/" + sanitizeFilename(modName);
+    std::vector<GameBananaFile> files = fetchModFiles(modId);
+    std::vector<DownloadJob> jobs;
+    if (files.empty()) {
+        return jobs;
+    }
+    std::string oldFolder = baseDir + "/" + sanitizeFilename(modName);
+    std::string modFolder = oldFolder + " (" + modId + ")";
+    std::error_code ec;
+    if (fs::is_directory(oldFolder, ec) && !fs::exists(modFolder, ec)) {
+        fs::rename(oldFolder, modFolder, ec);
+        if (ec) {
+            std::cerr << "Failed to move " << oldFolder << " to " << modFolder << ": " << ec.message() << std::endl;
+        }
+    }
     fs::create_directories(modFolder);
-    std::vector<std::string> downloadUrls = fetchModFileUrls(modId);
     int fileCount = 0;
-    for (const auto& url : downloadUrls) {
-        std::string outputPath = modFolder + "/" + std::to_string(++fileCount) + "_" + extractFileName(url);
-        downloadFile(url, outputPath);
+    for (const auto& file : files) {
+        DownloadJob job;
+        job.url = file.url;
+        job.path = modFolder + "/" + std::to_string(++fileCount) + "_" + extractFileName(file.url);
+        job.mod_id = std::atoi(modId.c_str());
+        job.file_id = fileCount;
+        job.label = job.path.filename().string();
+        job.expected_md5 = file.md5;
+        job.size_hint = file.size;
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+void downloadModFiles(const std::string& modId, const std::string& modName, const std::string& baseDir,
+    ExtractPool* extractor)
+{
+    DownloadEngine engine(parallel_downloads_from_env());
+    try {
+        for (auto& job : modFileJobs(modId, modName, baseDir)) {
+            engine.add(std::move(job));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to list the files of mod " << modId << ": " << e.what() << std::endl;
+        return;
     }
+    engine.run([&](const DownloadResult& result) {
+        if (result.success && extractor && is_archive(result.job.path)) {
+            extractor->submit(result.job.path);
+        }
+    });
+}
+
+/**
+ * The listing threads feed a bounded queue that the engine drains, so they never run
+ * far ahead of the downloads. Closing the queue is what lets run() return.
+ */
+void downloadSubscribedMods(const std::vector<std::pair<std::string, std::string>>& mods, const std::string& baseDir,
+    ExtractPool* extractor)
+{
+    int parallel = parallel_downloads_from_env();
+    BoundedQueue<DownloadJob> jobs(static_cast<size_t>(parallel));
+
+    std::thread listing([&]() {
+        forEachConcurrently(mods.size(), [&](size_t i) {
+            const auto& [profileUrl, name] = mods[i];
+            std::string modId = extractModId(profileUrl);
+            if (modId.empty()) {
+                std::cerr << "Warning: Failed to extract mod ID from URL: " << profileUrl << "\n";
+                return;
+            }
+            try {
+                for (auto& job : modFileJobs(modId, name, baseDir)) {
+                    if (!jobs.push(std::move(job))) {
+                        return;
+                    }
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Failed to list the files of mod " << modId << ": " << e.what() << std::endl;
+            }
+        });
+        jobs.close();
+    });
+
+    int succeeded = 0;
+    int failed = 0;
+    try {
+        DownloadEngine engine(parallel);
+        engine.set_source(&jobs);
+        engine.run([&](const DownloadResult& result) {
+            if (!result.success) {
+                failed++;
+                return;
+            }
+            succeeded++;
+            if (extractor && is_archive(result.job.path)) {
+                extractor->submit(result.job.path);
+            }
+        });
+    } catch (const std::exception& e) {
+        std::cerr << "GameBanana downloads failed: " << e.what() << std::endl;
+    }
+    // Unblock the listing threads if the engine stopped early.
+    jobs.close();
+    listing.join();
+
+    std::cout << "Finished GameBanana downloads: " << succeeded << " succeeded, " << failed << " failed." << std::endl;
 }
@@ -0,0 +1,389 @@
+#include "HttpClient.h"
+#include "BufferPool.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include <utility>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// A Content-Length above this is not trusted for reserving the body up front.
+const size_t MAX_RESERVE = 64 << 20;
+
+/**
+ * Write callback for libcurl to accumulate the response body in a std::string.
+ */
+size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
+{
+    size_t totalSize = size * nmemb;
+    std::string* str = static_cast<std::string*>(userp);
+    str->append(static_cast<char*>(contents), totalSize);
+    return totalSize;
+}
+
+/**
+ * Header callback for libcurl to collect response headers into a map with lower-case names.
+ * Headers from an earlier response in the same transfer (redirects, 100-continue) are discarded.
+ * A Content-Length reserves the whole body at once, so it never has to grow while it arrives.
+ */
+size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp)
+{
+    size_t totalSize = size * nitems;
+    auto* response = static_cast<HttpResponse*>(userp);
+    std::string_view line(buffer, totalSize);
+
+    if (line.rfind("HTTP/", 0) == 0) {
+        response->headers.clear();
+        return totalSize;
+    }
+
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        return totalSize;
+    }
+    std::string name(line.substr(0, colon));
+    std::transform(name.begin(), name.end(), name.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+    auto first = line.find_first_not_of(" \t", colon + 1);
+    auto last = line.find_last_not_of(" \t\r\n");
+    std::string& value = response->headers[name];
+    if (first != std::string_view::npos && last >= first) {
+        value.assign(line.substr(first, last - first + 1));
+    } else {
+        value.clear();
+    }
+    if (name == "content-length") {
+        unsigned long long length = std::strtoull(value.c_str(), nullptr, 10);
+        response->body.reserve(static_cast<size_t>(std::min<unsigned long long>(length, MAX_RESERVE)));
+    }
+    return totalSize;
+}
+
+} // namespace
+
+unsigned api_concurrency_from_env()
+{
+    const char* env = std::getenv("MODULAR_API_CONCURRENCY");
+    if (env) {
+        int value = std::atoi(env);
+        if (value > 0) {
+            return static_cast<unsigned>(value);
+        }
+    }
+    return 8;
+}
+
+HttpResponse::~HttpResponse()
+{
+    BufferPool::instance().release(std::move(body));
+}
+
+//----------------------------------------------------------------------------------
+// Setup and teardown
+//----------------------------------------------------------------------------------
+
+HttpClient& HttpClient::instance()
+{
+    static HttpClient client;
+    return client;
+}
+
+HttpClient::HttpClient()
+{
+    // Leases go back to the handle pool, so it has to outlive this client.
+    CurlHandlePool::instance();
+
+    multi_ = curl_multi_init();
+    curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#ifdef __linux__
+    epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd_;
+    ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, socket_cb);
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, timer_cb);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+#endif
+
+    thread_ = std::thread([this] { loop(); });
+}
+
+HttpClient::~HttpClient()
+{
+    stop_ = true;
+    wake();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    // Anything still outstanding fails rather than leaving a future unset.
+    for (auto& [easy, request] : active_) {
+        curl_multi_remove_handle(multi_, easy);
+        curl_slist_free_all(request->headers);
+        if (request->on_done) {
+            request->on_done(std::move(request->response));
+        }
+    }
+    active_.clear();
+    for (auto& request : incoming_) {
+        curl_slist_free_all(request->headers);
+        if (request->on_done) {
+            request->on_done(std::move(request->response));
+        }
+    }
+    incoming_.clear();
+
+#ifdef __linux__
+    ::close(wake_fd_);
+    ::close(epoll_fd_);
+#endif
+    curl_multi_cleanup(multi_);
+}
+
+//----------------------------------------------------------------------------------
+// Submitting requests
+//----------------------------------------------------------------------------------
+
+std::future<HttpResponse> HttpClient::get(const std::string& url, const std::vector<std::string>& headers)
+{
+    auto promise = std::make_shared<std::promise<HttpResponse>>();
+    std::future<HttpResponse> future = promise->get_future();
+    get(url, headers, [promise](HttpResponse response) { promise->set_value(std::move(response)); });
+    return future;
+}
+
+void HttpClient::get(const std::string& url, const std::vector<std::string>& headers, Callback on_done)
+{
+    auto request = std::make_unique<Request>();
+    request->url = url;
+    request->on_done = std::move(on_done);
+    request->response.body = BufferPool::instance().acquire();
+    request->lease = CurlHandlePool::instance().acquire();
+
+    CURL* curl = request->lease.get();
+    if (!curl) {
+        std::cerr << "Failed to initialize CURL." << std::endl;
+        request->on_done(std::move(request->response));
+        return;
+    }
+
+    for (const auto& header : headers) {
+        request->headers = curl_slist_append(request->headers, header.c_str());
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, request->url.c_str());
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request->headers);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request->response.body);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &request->response);
+    // Negotiate HTTP/2 over TLS and wait for an existing connection to multiplex onto
+    // rather than opening a new one per request.
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+    {
+        std::lock_guard<std::mutex> lock(incoming_mutex_);
+        incoming_.push_back(std::move(request));
+    }
+    wake();
+}
+
+void HttpClient::wake()
+{
+#ifdef __linux__
+    uint64_t one = 1;
+    ssize_t written = ::write(wake_fd_, &one, sizeof(one));
+    (void)written; // a full counter already means a wakeup is pending
+#else
+    curl_multi_wakeup(multi_);
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// Event loop
+//----------------------------------------------------------------------------------
+
+/**
+ * Moves newly submitted requests onto the multi handle. Runs on the loop thread only.
+ */
+void HttpClient::add_incoming()
+{
+    std::deque<std::unique_ptr<Request>> batch;
+    {
+        std::lock_guard<std::mutex> lock(incoming_mutex_);
+        batch.swap(incoming_);
+    }
+    for (auto& request : batch) {
+        CURL* easy = request->lease.get();
+        active_[easy] = std::move(request);
+        curl_multi_add_handle(multi_, easy);
+    }
+}
+
+void HttpClient::complete(CURL* easy, CURLcode res)
+{
+    auto it = active_.find(easy);
+    if (it == active_.end()) {
+        return;
+    }
+    std::unique_ptr<Request> request = std::move(it->second);
+    active_.erase(it);
+    curl_multi_remove_handle(multi_, easy);
+
+    if (res != CURLE_OK) {
+        std::cerr << "CURL GET failed for " << request->url << ": " << curl_easy_strerror(res) << std::endl;
+    } else {
+        curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &request->response.status_code);
+    }
+    record_curl_transfer(easy, "api");
+    curl_slist_free_all(request->headers);
+    request->headers = nullptr;
+
+    Callback on_done = std::move(request->on_done);
+    HttpResponse response = std::move(request->response);
+    request.reset(); // hands the easy handle back to the pool before the callback runs
+    if (on_done) {
+        on_done(std::move(response));
+    }
+}
+
+void HttpClient::check_completed()
+{
+    CURLMsg* msg;
+    int msgs_left;
+    while ((msg = curl_multi_info_read(multi_, &msgs_left))) {
+        if (msg->msg == CURLMSG_DONE) {
+            complete(msg->easy_handle, msg->data.result);
+        }
+    }
+}
+
+#ifdef __linux__
+
+int HttpClient::socket_cb(CURL*, curl_socket_t s, int what, void* userp, void*)
+{
+    auto* self = static_cast<HttpClient*>(userp);
+    if (what == CURL_POLL_REMOVE) {
+        ::epoll_ctl(self->epoll_fd_, EPOLL_CTL_DEL, s, nullptr);
+        return 0;
+    }
+
+    epoll_event ev {};
+    ev.data.fd = s;
+    if (what & CURL_POLL_IN) {
+        ev.events |= EPOLLIN;
+    }
+    if (what & CURL_POLL_OUT) {
+        ev.events |= EPOLLOUT;
+    }
+    if (::epoll_ctl(self->epoll_fd_, EPOLL_CTL_MOD, s, &ev) != 0 && errno == ENOENT) {
+        ::epoll_ctl(self->epoll_fd_, EPOLL_CTL_ADD, s, &ev);
+    }
+    return 0;
+}
+
+int HttpClient::timer_cb(CURLM*, long timeout_ms, void* userp)
+{
+    auto* self = static_cast<HttpClient*>(userp);
+    self->timer_armed_ = timeout_ms >= 0;
+    if (self->timer_armed_) {
+        self->timer_deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+    return 0;
+}
+
+/**
+ * Sleeps in epoll_wait until a socket curl is watching becomes ready, curl's timer
+ * expires, or another thread submits a request, and tells curl exactly which socket
+ * needs attention so it never has to scan the whole transfer set.
+ */
+void HttpClient::loop()
+{
+    const int max_events = 64;
+    epoll_event events[max_events];
+    int running = 0;
+
+    while (!stop_) {
+        add_incoming();
+
+        int wait_ms = 1000;
+        if (timer_armed_) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                timer_deadline_ - std::chrono::steady_clock::now());
+            wait_ms = static_cast<int>(std::clamp<long long>(remaining.count(), 0, wait_ms));
+        }
+
+        int n = ::epoll_wait(epoll_fd_, events, max_events, wait_ms);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == wake_fd_) {
+                uint64_t count;
+                ssize_t got = ::read(wake_fd_, &count, sizeof(count));
+                (void)got;
+                continue;
+            }
+            int flags = 0;
+            if (events[i].events & EPOLLIN) {
+                flags |= CURL_CSELECT_IN;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flags |= CURL_CSELECT_OUT;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                flags |= CURL_CSELECT_ERR;
+            }
+            curl_multi_socket_action(multi_, events[i].data.fd, flags, &running);
+        }
+
+        if (timer_armed_ && std::chrono::steady_clock::now() >= timer_deadline_) {
+            timer_armed_ = false;
+            curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        check_completed();
+    }
+}
+
+#else
+
+int HttpClient::socket_cb(CURL*, curl_socket_t, int, void*, void*)
+{
+    return 0;
+}
+
+int HttpClient::timer_cb(CURLM*, long, void*)
+{
+    return 0;
+}
+
+/**
+ * Portable fallback: let curl poll its own sockets, woken early by curl_multi_wakeup().
+ */
+void HttpClient::loop()
+{
+    int running = 0;
+    while (!stop_) {
+        add_incoming();
+        curl_multi_perform(multi_, &running);
+        check_completed();
+        curl_multi_poll(multi_, nullptr, 0, 1000, nullptr);
+    }
+}
+
+#endif
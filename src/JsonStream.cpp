@@ -0,0 +1,153 @@
+#include "JsonStream.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <stdexcept>
+
+using json = nlohmann::json;
+
+namespace {
+
+/**
+ * SAX handler that tracks where in the document it is and captures the requested
+ * fields of objects sitting at one of the target paths.
+ */
+class FieldExtractor : public nlohmann::json_sax<json> {
+public:
+    FieldExtractor(const std::vector<JsonPath>& paths, const std::vector<std::string>& fields,
+        const std::function<void(size_t, const JsonFields&)>& on_object)
+        : paths_(paths)
+        , fields_(fields)
+        , on_object_(on_object)
+    {
+    }
+
+    size_t matched() const { return matched_; }
+    const std::string& error() const { return error_; }
+
+    bool null() override { return scalar(nullptr); }
+    bool boolean(bool val) override { return scalar(val); }
+    bool number_integer(number_integer_t val) override { return scalar(val); }
+    bool number_unsigned(number_unsigned_t val) override { return scalar(val); }
+    bool number_float(number_float_t val, const string_t&) override { return scalar(val); }
+    bool string(string_t& val) override { return scalar(val); }
+    bool binary(binary_t&) override { return true; }
+
+    bool start_object(std::size_t) override
+    {
+        size_t path = target();
+        if (path < paths_.size()) {
+            captures_.push_back({ stack_.size(), path, {} });
+        }
+        stack_.push_back({ false, "" });
+        return true;
+    }
+
+    bool end_object() override
+    {
+        stack_.pop_back();
+        if (!captures_.empty() && captures_.back().depth == stack_.size()) {
+            Capture done = std::move(captures_.back());
+            captures_.pop_back();
+            matched_++;
+            on_object_(done.path, done.fields);
+        }
+        return true;
+    }
+
+    bool start_array(std::size_t) override
+    {
+        stack_.push_back({ true, "" });
+        return true;
+    }
+
+    bool end_array() override
+    {
+        stack_.pop_back();
+        return true;
+    }
+
+    bool key(string_t& val) override
+    {
+        stack_.back().key = val;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex) override
+    {
+        error_ = ex.what();
+        return false;
+    }
+
+private:
+    struct Frame {
+        bool array;
+        std::string key; // last key seen, for objects
+    };
+
+    // An object being captured. Targets may nest, so several can be open at once.
+    struct Capture {
+        size_t depth;
+        size_t path; // index into paths_
+        JsonFields fields;
+    };
+
+    // Index of the target path the value about to start sits at, or paths_.size() for none.
+    size_t target() const
+    {
+        for (size_t p = 0; p < paths_.size(); p++) {
+            const JsonPath& path = paths_[p];
+            if (path.size() != stack_.size()) {
+                continue;
+            }
+            bool match = true;
+            for (size_t i = 0; i < path.size() && match; i++) {
+                match = stack_[i].array ? path[i] == "*" : path[i] == stack_[i].key;
+            }
+            if (match) {
+                return p;
+            }
+        }
+        return paths_.size();
+    }
+
+    template <typename T>
+    bool scalar(T&& val)
+    {
+        // Only direct members of the innermost captured object are of interest.
+        if (!captures_.empty() && stack_.size() == captures_.back().depth + 1) {
+            const std::string& name = stack_.back().key;
+            if (std::find(fields_.begin(), fields_.end(), name) != fields_.end()) {
+                captures_.back().fields[name] = json(std::forward<T>(val));
+            }
+        }
+        return true;
+    }
+
+    const std::vector<JsonPath>& paths_;
+    const std::vector<std::string>& fields_;
+    const std::function<void(size_t, const JsonFields&)>& on_object_;
+
+    std::vector<Frame> stack_;
+    std::vector<Capture> captures_;
+    size_t matched_ = 0;
+    std::string error_;
+};
+
+} // namespace
+
+size_t stream_json_objects(const std::string& body, const std::vector<JsonPath>& paths,
+    const std::vector<std::string>& fields, const std::function<void(size_t, const JsonFields&)>& on_object)
+{
+    ScopedTimer timer("modular_json_parse_seconds", { { "parser", "sax" } });
+    FieldExtractor extractor(paths, fields, on_object);
+    if (!json::sax_parse(body, &extractor)) {
+        throw std::runtime_error(extractor.error().empty() ? "invalid JSON" : extractor.error());
+    }
+    return extractor.matched();
+}
+
+size_t stream_json_objects(const std::string& body, const std::vector<JsonPath>& paths,
+    const std::vector<std::string>& fields, const std::function<void(const JsonFields&)>& on_object)
+{
+    return stream_json_objects(body, paths, fields, [&on_object](size_t, const JsonFields& found) { on_object(found); });
+}
@@ -0,0 +1,867 @@
+#include "LibraryIndex.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char MAGIC[8] = { 'M', 'O', 'D', 'I', 'D', 'X', '\0', '\0' };
+const uint32_t VERSION = 1;
+const uint32_t DIRECTORY = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_count;
+    uint64_t names_size;
+};
+
+// Directories modified this recently may change again within the same mtime tick, so
+// their mtime is not trusted by the next scan (git's "racily clean" problem).
+const auto RACY_WINDOW = std::chrono::seconds(2);
+
+// Unsaved changes are written out at most this often; the rest waits for save().
+const auto SAVE_INTERVAL = std::chrono::seconds(30);
+
+std::string join(const std::string& rel, const std::string& name)
+{
+    return rel.empty() ? name : rel + "/" + name;
+}
+
+bool within(const std::string& rel, const std::string& scope)
+{
+    return scope.empty() || rel == scope || (rel.size() > scope.size() && rel.compare(0, scope.size(), scope) == 0 && rel[scope.size()] == '/');
+}
+
+#ifdef __linux__
+
+// The record getdents64 fills in; glibc only declares it with _GNU_SOURCE on newer versions.
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256]; // NUL-terminated within d_reclen
+};
+
+// Large enough that a mod directory usually comes back in one call, which matters on NFS.
+const size_t GETDENTS_BUFFER_SIZE = 256 * 1024;
+
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB
+    | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+/**
+ * std::filesystem reports times on its own clock, which is a fixed offset from the
+ * Unix time stat() returns. Measured once on "/" so index mtimes compare equal to
+ * fs::last_write_time() (and so to what SyncManifest records).
+ */
+long long file_ticks(const struct timespec& ts)
+{
+    using std::chrono::nanoseconds;
+    static const long long offset = [] {
+        struct stat st {};
+        std::error_code ec;
+        auto time = fs::last_write_time("/", ec);
+        if (ec || ::stat("/", &st) != 0) {
+            return 0LL;
+        }
+        long long fs_ns = std::chrono::duration_cast<nanoseconds>(time.time_since_epoch()).count();
+        return fs_ns - (static_cast<long long>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec);
+    }();
+    nanoseconds ns(static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec + offset);
+    return static_cast<long long>(std::chrono::duration_cast<fs::file_time_type::duration>(ns).count());
+}
+
+bool directory_mtime(const fs::path& dir, long long& mtime)
+{
+    struct stat st {};
+    if (::stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+    mtime = file_ticks(st.st_mtim);
+    return true;
+}
+
+/**
+ * Lists dir with getdents64. d_type says which entries are directories without a stat;
+ * only files (for their size and time) and entries of unknown type are stat()ed,
+ * relative to the open directory.
+ */
+bool read_directory(const fs::path& dir, bool skip_hidden, std::vector<IndexEntry>& entries)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    std::vector<char> buffer(GETDENTS_BUFFER_SIZE);
+    bool ok = true;
+    for (;;) {
+        long n = ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = (n == 0);
+            break;
+        }
+        for (long pos = 0; pos < n;) {
+            const auto* d = reinterpret_cast<const linux_dirent64*>(buffer.data() + pos);
+            pos += d->d_reclen;
+            const char* name = d->d_name;
+            if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0 || (skip_hidden && name[0] == '.')) {
+                continue;
+            }
+            IndexEntry entry;
+            entry.name = name;
+            if (d->d_type == DT_DIR) {
+                entry.directory = true;
+            } else {
+                struct stat st {};
+                if (::fstatat(fd, name, &st, 0) != 0) {
+                    continue;
+                }
+                if (S_ISDIR(st.st_mode)) {
+                    if (d->d_type == DT_LNK) {
+                        continue; // following directory symlinks could loop
+                    }
+                    entry.directory = true;
+                } else if (S_ISREG(st.st_mode)) {
+                    entry.size = static_cast<uintmax_t>(st.st_size);
+                    entry.mtime = file_ticks(st.st_mtim);
+                } else {
+                    continue;
+                }
+            }
+            entries.push_back(std::move(entry));
+        }
+    }
+    ::close(fd);
+    return ok;
+}
+
+#else
+
+bool directory_mtime(const fs::path& dir, long long& mtime)
+{
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec)) {
+        return false;
+    }
+    auto time = fs::last_write_time(dir, ec);
+    mtime = ec ? 0 : static_cast<long long>(time.time_since_epoch().count());
+    return !ec;
+}
+
+bool read_directory(const fs::path& dir, bool skip_hidden, std::vector<IndexEntry>& entries)
+{
+    std::error_code ec;
+    for (const auto& item : fs::directory_iterator(dir, ec)) {
+        IndexEntry entry;
+        entry.name = item.path().filename().string();
+        if (skip_hidden && entry.name[0] == '.') {
+            continue;
+        }
+        std::error_code itemEc;
+        if (item.is_directory(itemEc)) {
+            if (item.is_symlink(itemEc)) {
+                continue;
+            }
+            entry.directory = true;
+        } else if (item.is_regular_file(itemEc)) {
+            entry.size = item.file_size(itemEc);
+            entry.mtime = static_cast<long long>(item.last_write_time(itemEc).time_since_epoch().count());
+        } else {
+            continue;
+        }
+        entries.push_back(std::move(entry));
+    }
+    return !ec;
+}
+
+#endif
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// LibraryIndex
+//----------------------------------------------------------------------------------
+
+LibraryIndex::LibraryIndex(fs::path root)
+    : root_(fs::absolute(root).lexically_normal())
+{
+    if (root_.filename().empty()) {
+        root_ = root_.parent_path();
+    }
+    file_ = root_ / ".cache" / "library.idx";
+}
+
+LibraryIndex::~LibraryIndex()
+{
+    stop_watching();
+    unmap();
+}
+
+bool LibraryIndex::relative(const fs::path& path, std::string& rel) const
+{
+    fs::path normal = fs::absolute(path).lexically_normal();
+    if (normal.filename().empty()) {
+        normal = normal.parent_path();
+    }
+    fs::path relative = normal.lexically_relative(root_);
+    if (relative.empty() || *relative.begin() == "..") {
+        return false;
+    }
+    rel = (relative == ".") ? "" : relative.generic_string();
+    return true;
+}
+
+bool LibraryIndex::covers(const fs::path& path) const
+{
+    std::string rel;
+    return relative(path, rel);
+}
+
+std::string_view LibraryIndex::name_at(uint32_t node) const
+{
+    return std::string_view(names_ + nodes_[node].name_offset, nodes_[node].name_length);
+}
+
+IndexEntry LibraryIndex::entry_at(uint32_t node) const
+{
+    IndexEntry entry;
+    entry.name = std::string(name_at(node));
+    entry.directory = (nodes_[node].flags & DIRECTORY) != 0;
+    entry.size = nodes_[node].size;
+    entry.mtime = nodes_[node].mtime;
+    return entry;
+}
+
+std::optional<uint32_t> LibraryIndex::child(uint32_t dir, std::string_view name) const
+{
+    const Node& parent = nodes_[dir];
+    uint32_t lo = parent.first_child;
+    uint32_t hi = parent.first_child + parent.child_count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = name_at(mid).compare(name);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<uint32_t> LibraryIndex::lookup(const std::string& rel) const
+{
+    if (count_ == 0) {
+        return std::nullopt;
+    }
+    uint32_t node = 0;
+    size_t start = 0;
+    while (start < rel.size()) {
+        size_t end = rel.find('/', start);
+        if (end == std::string::npos) {
+            end = rel.size();
+        }
+        if (!(nodes_[node].flags & DIRECTORY)) {
+            return std::nullopt;
+        }
+        auto next = child(node, std::string_view(rel).substr(start, end - start));
+        if (!next) {
+            return std::nullopt;
+        }
+        node = *next;
+        start = end + 1;
+    }
+    return node;
+}
+
+//----------------------------------------------------------------------------------
+// Loading and saving
+//----------------------------------------------------------------------------------
+
+void LibraryIndex::unmap()
+{
+#ifdef __linux__
+    if (mapping_) {
+        ::munmap(mapping_, mapping_size_);
+    }
+#endif
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+}
+
+/**
+ * Rejects a file that would send lookups out of bounds: names outside the string
+ * table, or child ranges that aren't after their parent and inside the node array.
+ */
+bool LibraryIndex::valid_image(const char* data, size_t size)
+{
+    Header header;
+    std::memcpy(&header, data, sizeof(Header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.node_count == 0
+        || size != sizeof(Header) + uint64_t(header.node_count) * sizeof(Node) + header.names_size) {
+        return false;
+    }
+    const Node* nodes = reinterpret_cast<const Node*>(data + sizeof(Header));
+    for (uint32_t i = 0; i < header.node_count; i++) {
+        const Node& node = nodes[i];
+        if (uint64_t(node.name_offset) + node.name_length > header.names_size) {
+            return false;
+        }
+        if (node.child_count && (!(node.flags & DIRECTORY) || node.first_child <= i
+                || uint64_t(node.first_child) + node.child_count > header.node_count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LibraryIndex::load()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    unmap();
+    owned_nodes_.clear();
+    owned_names_.clear();
+    nodes_ = nullptr;
+    names_ = nullptr;
+    count_ = 0;
+    changed_ = false;
+
+#ifdef __linux__
+    int fd = ::open(file_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return true;
+    }
+    struct stat st {};
+    void* data = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+        data = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "Ignoring unreadable library index " << file_.string() << std::endl;
+        return false;
+    }
+    mapping_ = data;
+    mapping_size_ = static_cast<size_t>(st.st_size);
+    const char* base = static_cast<const char*>(data);
+#else
+    std::ifstream ifs(file_.string(), std::ios::binary);
+    if (!ifs.is_open()) {
+        return true;
+    }
+    std::string contents((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    if (contents.size() < sizeof(Header)) {
+        std::cerr << "Ignoring unreadable library index " << file_.string() << std::endl;
+        return false;
+    }
+    owned_names_ = std::move(contents); // holds the whole file until the first rebuild
+    const char* base = owned_names_.data();
+    size_t size = owned_names_.size();
+#endif
+
+#ifdef __linux__
+    size_t size = mapping_size_;
+#endif
+    if (!valid_image(base, size)) {
+        std::cerr << "Ignoring damaged library index " << file_.string() << "; the library will be rescanned." << std::endl;
+        unmap();
+        owned_names_.clear();
+        return false;
+    }
+    Header header;
+    std::memcpy(&header, base, sizeof(Header));
+    nodes_ = reinterpret_cast<const Node*>(base + sizeof(Header));
+    count_ = header.node_count;
+    names_ = base + sizeof(Header) + sizeof(Node) * count_;
+    return true;
+}
+
+bool LibraryIndex::save()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return save_locked();
+}
+
+bool LibraryIndex::save_locked()
+{
+    if (!changed_ || count_ == 0) {
+        return true;
+    }
+    next_save_ = std::chrono::steady_clock::now() + SAVE_INTERVAL;
+    std::error_code ec;
+    fs::create_directories(file_.parent_path(), ec);
+    fs::path tmp = file_;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::binary | std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return false;
+        }
+        Header header {};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.node_count = count_;
+        uint64_t names_size = 0;
+        for (uint32_t i = 0; i < count_; i++) {
+            names_size = std::max<uint64_t>(names_size, uint64_t(nodes_[i].name_offset) + nodes_[i].name_length);
+        }
+        header.names_size = names_size;
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<const char*>(nodes_), static_cast<std::streamsize>(sizeof(Node) * count_));
+        ofs.write(names_, static_cast<std::streamsize>(names_size));
+        if (!ofs) {
+            std::cerr << "Failed to write " << tmp.string() << std::endl;
+            return false;
+        }
+    }
+    fs::rename(tmp, file_, ec);
+    if (ec) {
+        std::cerr << "Failed to save " << file_.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    changed_ = false;
+    return true;
+}
+
+//----------------------------------------------------------------------------------
+// Refreshing
+//----------------------------------------------------------------------------------
+
+void LibraryIndex::refresh(const fs::path& dir)
+{
+    std::string scope;
+    if (!dir.empty() && !relative(dir, scope)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ScopedTimer timer("modular_index_refresh_seconds");
+
+    // A directory the index doesn't know yet is found by reading its closest known parent.
+    while (!scope.empty() && !lookup(scope)) {
+        size_t slash = scope.rfind('/');
+        scope = (slash == std::string::npos) ? "" : scope.substr(0, slash);
+    }
+
+#ifdef __linux__
+    if (inotify_ < 0 && !watch_disabled_) {
+        inotify_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        watch_disabled_ = (inotify_ < 0);
+    }
+#endif
+    drain_events();
+
+    long long racy_after = static_cast<long long>(
+        (fs::file_time_type::clock::now() - RACY_WINDOW).time_since_epoch().count());
+    Listings fresh;
+    if (watching(scope)) {
+        collect_reported(scope, fresh, racy_after);
+    } else {
+        collect_changed(scope, lookup(scope), fresh, racy_after);
+    }
+
+    if (!fresh.empty()) {
+        Metrics::instance().add("modular_index_directories_read_total", static_cast<double>(fresh.size()));
+        rebuild(fresh);
+        changed_ = true;
+    }
+    if (changed_ && std::chrono::steady_clock::now() >= next_save_) {
+        save_locked();
+    }
+}
+
+/**
+ * Delta scan below rel: a directory whose mtime still matches the index keeps its
+ * recorded entries and only its subdirectories are looked at; anything else is read again.
+ */
+void LibraryIndex::collect_changed(const std::string& rel, std::optional<uint32_t> node, Listings& fresh,
+    long long racy_after)
+{
+    // Watch before looking, so a change made while we read is reported rather than lost.
+    watch(rel);
+    long long mtime = 0;
+    if (!directory_mtime(root_ / rel, mtime)) {
+        return; // gone; reading its parent drops it
+    }
+    if (node && nodes_[*node].mtime != 0 && nodes_[*node].mtime == mtime) {
+        const Node& dir = nodes_[*node];
+        for (uint32_t i = dir.first_child; i < dir.first_child + dir.child_count; i++) {
+            if (nodes_[i].flags & DIRECTORY) {
+                collect_changed(join(rel, std::string(name_at(i))), i, fresh, racy_after);
+            }
+        }
+        return;
+    }
+    if (!read_into(rel, mtime, fresh, racy_after)) {
+        return;
+    }
+    // Copied: the recursion below inserts into fresh.
+    std::vector<std::string> subdirectories;
+    for (const auto& entry : fresh[rel].entries) {
+        if (entry.directory) {
+            subdirectories.push_back(entry.name);
+        }
+    }
+    for (const auto& name : subdirectories) {
+        std::optional<uint32_t> old = node ? child(*node, name) : std::nullopt;
+        collect_changed(join(rel, name), old, fresh, racy_after);
+    }
+}
+
+/**
+ * Watched scan: only directories inotify reported are read. Subdirectories that aren't
+ * watched yet (new, renamed or recreated) get a delta scan, which also starts watching them.
+ * The reported directories are taken out of reported_ first: starting a watch can fail
+ * and stop watching altogether, which clears it.
+ */
+void LibraryIndex::collect_reported(const std::string& scope, Listings& fresh, long long racy_after)
+{
+    std::vector<std::string> reported;
+    for (auto it = reported_.begin(); it != reported_.end();) {
+        if (!within(*it, scope)) {
+            ++it;
+            continue;
+        }
+        reported.push_back(*it);
+        it = reported_.erase(it);
+    }
+
+    for (const std::string& rel : reported) {
+        std::optional<uint32_t> node = lookup(rel);
+        long long mtime = 0;
+        if (!node || fresh.count(rel) || !directory_mtime(root_ / rel, mtime) || !read_into(rel, mtime, fresh, racy_after)) {
+            continue; // new directories are found through their parent
+        }
+        std::vector<std::string> subdirectories;
+        for (const auto& entry : fresh[rel].entries) {
+            if (entry.directory && !watches_.count(join(rel, entry.name))) {
+                subdirectories.push_back(entry.name);
+            }
+        }
+        for (const auto& name : subdirectories) {
+            collect_changed(join(rel, name), child(*node, name), fresh, racy_after);
+        }
+    }
+}
+
+bool LibraryIndex::read_into(const std::string& rel, long long mtime, Listings& fresh, long long racy_after)
+{
+    Listing listing;
+    listing.mtime = (mtime > racy_after) ? 0 : mtime;
+    if (!read_directory(root_ / rel, rel.empty(), listing.entries)) {
+        return false;
+    }
+    std::sort(listing.entries.begin(), listing.entries.end(),
+        [](const IndexEntry& a, const IndexEntry& b) { return a.name < b.name; });
+    fresh[rel] = std::move(listing);
+    return true;
+}
+
+/**
+ * Lays the tree out again breadth first, so every directory's children are adjacent:
+ * directories in fresh take their new listing, everything else is copied from the
+ * current image.
+ */
+void LibraryIndex::rebuild(const Listings& fresh)
+{
+    std::vector<Node> nodes;
+    std::string names;
+    struct Pending {
+        uint32_t node;
+        std::optional<uint32_t> old;
+        std::string rel;
+    };
+    std::deque<Pending> queue;
+
+    auto dir_mtime = [&](const std::string& rel, std::optional<uint32_t> old) -> long long {
+        auto it = fresh.find(rel);
+        if (it != fresh.end()) {
+            return it->second.mtime;
+        }
+        return old ? nodes_[*old].mtime : 0;
+    };
+    auto add = [&](std::string_view name, bool directory, uint64_t size, long long mtime) {
+        Node node {};
+        node.size = size;
+        node.mtime = mtime;
+        node.name_offset = static_cast<uint32_t>(names.size());
+        node.name_length = static_cast<uint32_t>(name.size());
+        node.flags = directory ? DIRECTORY : 0;
+        names.append(name.data(), name.size());
+        nodes.push_back(node);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    };
+
+    std::optional<uint32_t> old_root = count_ ? std::optional<uint32_t>(0) : std::nullopt;
+    add("", true, 0, dir_mtime("", old_root));
+    queue.push_back({ 0, old_root, "" });
+
+    while (!queue.empty()) {
+        Pending dir = std::move(queue.front());
+        queue.pop_front();
+        uint32_t first = static_cast<uint32_t>(nodes.size());
+        auto listing = fresh.find(dir.rel);
+        if (listing != fresh.end()) {
+            for (const auto& entry : listing->second.entries) {
+                std::optional<uint32_t> old = dir.old ? child(*dir.old, entry.name) : std::nullopt;
+                if (old && !(nodes_[*old].flags & DIRECTORY) != !entry.directory) {
+                    old.reset();
+                }
+                std::string rel = join(dir.rel, entry.name);
+                uint32_t index = add(entry.name, entry.directory, entry.size,
+                    entry.directory ? dir_mtime(rel, old) : entry.mtime);
+                if (entry.directory) {
+                    queue.push_back({ index, old, rel });
+                }
+            }
+        } else if (dir.old) {
+            const Node& parent = nodes_[*dir.old];
+            for (uint32_t i = parent.first_child; i < parent.first_child + parent.child_count; i++) {
+                bool directory = (nodes_[i].flags & DIRECTORY) != 0;
+                std::string rel = join(dir.rel, std::string(name_at(i)));
+                uint32_t index = add(name_at(i), directory, nodes_[i].size,
+                    directory ? dir_mtime(rel, i) : nodes_[i].mtime);
+                if (directory) {
+                    queue.push_back({ index, i, rel });
+                }
+            }
+        }
+        nodes[dir.node].first_child = first;
+        nodes[dir.node].child_count = static_cast<uint32_t>(nodes.size()) - first;
+    }
+
+    unmap();
+    owned_nodes_ = std::move(nodes);
+    owned_names_ = std::move(names);
+    nodes_ = owned_nodes_.data();
+    names_ = owned_names_.data();
+    count_ = static_cast<uint32_t>(owned_nodes_.size());
+}
+
+//----------------------------------------------------------------------------------
+// Queries
+//----------------------------------------------------------------------------------
+
+std::optional<std::vector<IndexEntry>> LibraryIndex::list(const fs::path& dir) const
+{
+    std::string rel;
+    if (!relative(dir, rel)) {
+        return std::nullopt;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto node = lookup(rel);
+    if (!node || !(nodes_[*node].flags & DIRECTORY)) {
+        return std::nullopt;
+    }
+    std::vector<IndexEntry> entries;
+    const Node& parent = nodes_[*node];
+    for (uint32_t i = parent.first_child; i < parent.first_child + parent.child_count; i++) {
+        entries.push_back(entry_at(i));
+    }
+    return entries;
+}
+
+std::optional<std::vector<std::pair<fs::path, IndexEntry>>> LibraryIndex::walk(const fs::path& dir) const
+{
+    std::string rel;
+    if (!relative(dir, rel)) {
+        return std::nullopt;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto node = lookup(rel);
+    if (!node || !(nodes_[*node].flags & DIRECTORY)) {
+        return std::nullopt;
+    }
+    std::vector<std::pair<fs::path, IndexEntry>> entries;
+    std::deque<std::pair<uint32_t, fs::path>> queue { { *node, fs::path() } };
+    while (!queue.empty()) {
+        auto [index, path] = std::move(queue.front());
+        queue.pop_front();
+        const Node& parent = nodes_[index];
+        for (uint32_t i = parent.first_child; i < parent.first_child + parent.child_count; i++) {
+            IndexEntry entry = entry_at(i);
+            fs::path child_path = path / entry.name;
+            if (entry.directory) {
+                queue.emplace_back(i, child_path);
+            }
+            entries.emplace_back(std::move(child_path), std::move(entry));
+        }
+    }
+    return entries;
+}
+
+std::optional<IndexEntry> LibraryIndex::find(const fs::path& path) const
+{
+    std::string rel;
+    if (!relative(path, rel)) {
+        return std::nullopt;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto node = lookup(rel);
+    if (!node) {
+        return std::nullopt;
+    }
+    return entry_at(*node);
+}
+
+size_t LibraryIndex::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return count_ ? count_ - 1 : 0;
+}
+
+//----------------------------------------------------------------------------------
+// inotify
+//----------------------------------------------------------------------------------
+
+bool LibraryIndex::watching(const std::string& rel) const
+{
+    return inotify_ >= 0 && watches_.count(rel) != 0;
+}
+
+void LibraryIndex::watch(const std::string& rel)
+{
+#ifdef __linux__
+    if (inotify_ < 0 || watches_.count(rel)) {
+        return;
+    }
+    int wd = ::inotify_add_watch(inotify_, (root_ / rel).c_str(), WATCH_MASK);
+    if (wd < 0) {
+        if (errno != ENOENT && errno != ENOTDIR && errno != EACCES) {
+            std::cerr << "Not watching the library for changes (" << std::strerror(errno)
+                      << "); it will be rescanned instead." << std::endl;
+            stop_watching();
+            watch_disabled_ = true;
+        }
+        return;
+    }
+    // The same directory under an older name (it was renamed): forget that name.
+    auto previous = watch_paths_.find(wd);
+    if (previous != watch_paths_.end()) {
+        watches_.erase(previous->second);
+    }
+    watch_paths_[wd] = rel;
+    watches_[rel] = wd;
+#else
+    (void)rel;
+#endif
+}
+
+void LibraryIndex::drain_events()
+{
+#ifdef __linux__
+    if (inotify_ < 0) {
+        return;
+    }
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    bool overflow = false;
+    for (;;) {
+        ssize_t n = ::read(inotify_, buffer, sizeof(buffer));
+        if (n <= 0) {
+            break; // EAGAIN: nothing pending
+        }
+        for (char* p = buffer; p < buffer + n;) {
+            const auto* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            auto it = watch_paths_.find(event->wd);
+            if (it == watch_paths_.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                auto current = watches_.find(it->second);
+                if (current != watches_.end() && current->second == event->wd) {
+                    watches_.erase(current);
+                }
+                watch_paths_.erase(it);
+                continue;
+            }
+            // Our own .cache and .stats writes at the top level aren't part of the index.
+            if (it->second.empty() && event->len && event->name[0] == '.') {
+                continue;
+            }
+            reported_.insert(it->second);
+        }
+    }
+    if (overflow) {
+        // Events were lost; start over with a delta scan, which sets up fresh watches.
+        stop_watching();
+    }
+#endif
+}
+
+void LibraryIndex::stop_watching()
+{
+#ifdef __linux__
+    if (inotify_ >= 0) {
+        ::close(inotify_);
+    }
+#endif
+    inotify_ = -1;
+    watch_paths_.clear();
+    watches_.clear();
+    reported_.clear();
+}
+
+//----------------------------------------------------------------------------------
+// Process-wide index
+//----------------------------------------------------------------------------------
+
+bool library_index_enabled()
+{
+    const char* env = std::getenv("MODULAR_LIBRARY_INDEX");
+    return !(env && std::string(env) == "0");
+}
+
+LibraryIndex* library_index_for(const fs::path& path)
+{
+    if (!library_index_enabled()) {
+        return nullptr;
+    }
+    std::string homeDir = std::string(std::getenv("HOME") ? std::getenv("HOME") : "");
+    fs::path root = fs::path(homeDir) / "Games" / "Mods-Lists";
+
+    // One per library root and never destroyed, like Metrics; the benchmark gives every run its own $HOME.
+    static std::mutex mutex;
+    static auto* indexes = new std::map<fs::path, std::unique_ptr<LibraryIndex>>();
+    LibraryIndex* index;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& slot = (*indexes)[root];
+        if (!slot) {
+            slot = std::make_unique<LibraryIndex>(root);
+            slot->load();
+        }
+        index = slot.get();
+    }
+    return index->covers(path) ? index : nullptr;
+}
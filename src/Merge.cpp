@@ -0,0 +1,574 @@
+#include "Merge.h"
+#include "LibraryIndex.h"
+#include "Md5.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace {
+
+struct AtomicStats {
+    std::atomic<size_t> files { 0 };
+    std::atomic<size_t> reflinked { 0 };
+    std::atomic<size_t> hardlinked { 0 };
+    std::atomic<size_t> rangeCopied { 0 };
+    std::atomic<size_t> copied { 0 };
+    std::atomic<size_t> failed { 0 };
+    std::atomic<uintmax_t> bytes { 0 };
+};
+
+#ifdef __linux__
+// Opens source for reading and a fresh destination for writing with the same permissions.
+bool openPair(const fs::path& source, const fs::path& dest, int& in, int& out)
+{
+    in = ::open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+    struct stat st {};
+    ::fstat(in, &st);
+    out = ::open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    if (out < 0) {
+        ::close(in);
+        return false;
+    }
+    return true;
+}
+
+bool reflinkFile(const fs::path& source, const fs::path& dest)
+{
+    int in, out;
+    if (!openPair(source, dest, in, out)) {
+        return false;
+    }
+    bool ok = ::ioctl(out, FICLONE, in) == 0;
+    ::close(in);
+    ::close(out);
+    if (!ok) {
+        ::unlink(dest.c_str());
+    }
+    return ok;
+}
+
+bool rangeCopyFile(const fs::path& source, const fs::path& dest, uintmax_t size)
+{
+    int in, out;
+    if (!openPair(source, dest, in, out)) {
+        return false;
+    }
+    uintmax_t remaining = size;
+    bool ok = true;
+    while (remaining > 0) {
+        ssize_t n = ::copy_file_range(in, nullptr, out, nullptr, remaining, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        remaining -= static_cast<uintmax_t>(n);
+    }
+    ::close(in);
+    ::close(out);
+    if (!ok) {
+        ::unlink(dest.c_str());
+    }
+    return ok;
+}
+#endif
+
+// A file found in the source, and what the merge will do with it.
+struct SourceFile {
+    enum Action { Place, Retime, Skip };
+
+    fs::path rel; // relative to both source and target
+    uintmax_t size = 0;
+    fs::file_time_type mtime;
+    Action action = Place;
+};
+
+/**
+ * Runs fn(i) for every i below count, spread over up to threads workers.
+ */
+template <typename Fn>
+void parallelFor(size_t count, unsigned threads, Fn fn)
+{
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < std::min<size_t>(threads, count); i++) {
+        pool.emplace_back(worker);
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+/**
+ * Places one file of the given size at dest using the strategy, falling back to cheaper ones on failure.
+ * Any existing dest is unlinked first so a hardlinked target never writes through to a mod's source.
+ * Copies are given the source's modification time, which is how a differential merge recognises them.
+ * Returns whether there was a dest to replace.
+ */
+bool placeFile(const fs::path& source, const fs::path& dest, uintmax_t size, fs::file_time_type mtime,
+    MergeStrategy strategy, AtomicStats& stats)
+{
+    std::error_code ec;
+    bool replaced = fs::remove(dest, ec);
+
+#ifdef __linux__
+    if (strategy == MergeStrategy::Reflink && reflinkFile(source, dest)) {
+        fs::last_write_time(dest, mtime, ec);
+        stats.reflinked++;
+        stats.bytes += size;
+        return replaced;
+    }
+    if (strategy == MergeStrategy::Hardlink) {
+        fs::create_hard_link(source, dest, ec);
+        if (!ec) {
+            stats.hardlinked++;
+            stats.bytes += size;
+            return replaced;
+        }
+    }
+    if (strategy != MergeStrategy::Copy && rangeCopyFile(source, dest, size)) {
+        fs::last_write_time(dest, mtime, ec);
+        stats.rangeCopied++;
+        stats.bytes += size;
+        return replaced;
+    }
+#endif
+
+    fs::copy_file(source, dest, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+        std::cerr << "Failed to merge " << source << " into " << dest << ": " << ec.message() << std::endl;
+        stats.failed++;
+        return replaced;
+    }
+    fs::last_write_time(dest, mtime, ec);
+    stats.copied++;
+    stats.bytes += size;
+    return replaced;
+}
+
+/**
+ * Every file below source, creating the matching directories under target on the way.
+ * A source inside the library comes straight from the library index; anything else is
+ * walked, one directory per worker at a time.
+ */
+std::vector<SourceFile> listSource(const fs::path& target, const fs::path& source, unsigned threads)
+{
+    std::vector<SourceFile> files;
+    if (LibraryIndex* index = library_index_for(source)) {
+        index->refresh(source);
+        if (auto entries = index->walk(source)) {
+            for (const auto& [rel, entry] : *entries) {
+                if (entry.directory) {
+                    std::error_code ec;
+                    fs::create_directories(target / rel, ec);
+                } else {
+                    SourceFile file;
+                    file.rel = rel;
+                    file.size = entry.size;
+                    file.mtime = fs::file_time_type(fs::file_time_type::duration(entry.mtime));
+                    files.push_back(std::move(file));
+                }
+            }
+            return files;
+        }
+    }
+
+    // Work queue of directories (relative to source) shared by the walkers.
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<fs::path> queue { fs::path() };
+    size_t busy = 0;
+
+    auto walker = [&]() {
+        for (;;) {
+            fs::path dir;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&] { return !queue.empty() || busy == 0; });
+                if (queue.empty()) {
+                    return; // nothing queued and nobody left to queue more
+                }
+                dir = std::move(queue.front());
+                queue.pop_front();
+                busy++;
+            }
+
+            std::vector<SourceFile> found;
+            std::error_code iterEc;
+            for (const auto& entry : fs::directory_iterator(source / dir, iterEc)) {
+                fs::path rel = dir / entry.path().filename();
+                std::error_code entryEc;
+                if (entry.is_directory(entryEc)) {
+                    fs::create_directories(target / rel, entryEc);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(rel);
+                    cv.notify_one();
+                } else {
+                    SourceFile file;
+                    file.rel = rel;
+                    file.size = entry.file_size(entryEc);
+                    file.mtime = entry.last_write_time(entryEc);
+                    found.push_back(std::move(file));
+                }
+            }
+            if (iterEc) {
+                std::cerr << "Failed to read directory " << source / dir << ": " << iterEc.message() << std::endl;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            std::move(found.begin(), found.end(), std::back_inserter(files));
+            busy--;
+            if (busy == 0 && queue.empty()) {
+                cv.notify_all();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++) {
+        pool.emplace_back(walker);
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return files;
+}
+
+std::string pathKey(const fs::path& path)
+{
+    fs::path normal = fs::absolute(path).lexically_normal();
+    if (normal.filename().empty()) {
+        normal = normal.parent_path();
+    }
+    return normal.generic_string();
+}
+
+std::string md5Of(const std::string& text)
+{
+    Md5 md5;
+    md5.update(text.data(), text.size());
+    return md5.hex_digest();
+}
+
+/**
+ * Which files each source placed in a target, so a later differential merge can remove
+ * the ones a source no longer has. Kept out of the target, which is often a game's data
+ * directory, in ~/Games/Mods-Lists/.cache/merges/<md5 of target>/<md5 of source>.json.
+ */
+fs::path mergeRecordDirectory(const fs::path& target)
+{
+    std::string homeDir = std::string(std::getenv("HOME") ? std::getenv("HOME") : "");
+    return fs::path(homeDir) / "Games" / "Mods-Lists" / ".cache" / "merges" / md5Of(pathKey(target));
+}
+
+std::set<std::string> loadMergeRecord(const fs::path& path)
+{
+    std::set<std::string> files;
+    std::ifstream ifs(path.string());
+    if (!ifs.is_open()) {
+        return files;
+    }
+    try {
+        json data = json::parse(ifs);
+        files = data.value("files", json::array()).get<std::set<std::string>>();
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in " << path.string() << ": " << e.what() << std::endl;
+    }
+    return files;
+}
+
+void saveMergeRecord(const fs::path& path, const fs::path& source, const std::set<std::string>& files)
+{
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return;
+        }
+        ofs << json { { "source", pathKey(source) }, { "files", files } }.dump();
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        std::cerr << "Failed to save " << path.string() << ": " << ec.message() << std::endl;
+    }
+}
+
+/**
+ * How many of the replaced files another source merged into the same target had placed.
+ */
+size_t countOthersFiles(const fs::path& ownRecord, std::set<std::string> replaced)
+{
+    size_t count = 0;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(ownRecord.parent_path(), ec)) {
+        if (replaced.empty()) {
+            break;
+        }
+        if (entry.path() == ownRecord || entry.path().extension() != ".json") {
+            continue;
+        }
+        for (const auto& rel : loadMergeRecord(entry.path())) {
+            count += replaced.erase(rel);
+        }
+    }
+    return count;
+}
+
+/**
+ * Deletes the dropped files from target, except those another source merged into the
+ * same target still has, and any directories that leaves empty. Returns the count.
+ */
+size_t removeDropped(const fs::path& target, const fs::path& ownRecord, std::set<std::string> dropped)
+{
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(ownRecord.parent_path(), ec)) {
+        if (entry.path() == ownRecord || entry.path().extension() != ".json") {
+            continue;
+        }
+        for (const auto& rel : loadMergeRecord(entry.path())) {
+            dropped.erase(rel);
+        }
+    }
+
+    size_t removed = 0;
+    for (const auto& rel : dropped) {
+        fs::path dest = target / rel;
+        if (!fs::remove(dest, ec)) {
+            continue;
+        }
+        removed++;
+        for (fs::path dir = dest.parent_path(); dir != target && fs::is_empty(dir, ec); dir = dir.parent_path()) {
+            fs::remove(dir, ec);
+        }
+    }
+    return removed;
+}
+
+} // namespace
+
+const char* mergeStrategyName(MergeStrategy strategy)
+{
+    switch (strategy) {
+    case MergeStrategy::Auto:
+        return "auto";
+    case MergeStrategy::Reflink:
+        return "reflink";
+    case MergeStrategy::Hardlink:
+        return "hardlink";
+    case MergeStrategy::CopyFileRange:
+        return "copy_file_range";
+    case MergeStrategy::Copy:
+        return "copy";
+    }
+    return "unknown";
+}
+
+MergeStrategy pickMergeStrategy(const fs::path& target, const fs::path& source)
+{
+#ifdef __linux__
+    // The target may not exist yet; look at the closest ancestor that does.
+    fs::path probe = fs::absolute(target);
+    std::error_code ec;
+    while (!fs::exists(probe, ec) && probe.has_parent_path() && probe != probe.parent_path()) {
+        probe = probe.parent_path();
+    }
+
+    struct stat targetStat {}, sourceStat {};
+    struct statfs targetFs {};
+    if (::stat(probe.c_str(), &targetStat) != 0 || ::stat(source.c_str(), &sourceStat) != 0
+        || ::statfs(probe.c_str(), &targetFs) != 0) {
+        return MergeStrategy::Copy;
+    }
+
+    const auto BTRFS_MAGIC = 0x9123683E;
+    const auto XFS_MAGIC = 0x58465342;
+    bool sameFilesystem = targetStat.st_dev == sourceStat.st_dev;
+    bool cowFilesystem = targetFs.f_type == static_cast<decltype(targetFs.f_type)>(BTRFS_MAGIC)
+        || targetFs.f_type == static_cast<decltype(targetFs.f_type)>(XFS_MAGIC);
+
+    if (sameFilesystem && cowFilesystem) {
+        return MergeStrategy::Reflink;
+    }
+    // Never hardlinks: a game editing a deployed file in place would edit the library's copy too.
+    return MergeStrategy::CopyFileRange;
+#else
+    (void)target;
+    (void)source;
+    return MergeStrategy::Copy;
+#endif
+}
+
+MergeOptions mergeOptionsFromEnv()
+{
+    MergeOptions options;
+    const char* mode = std::getenv("MODULAR_MERGE_MODE");
+    if (mode && std::string(mode) == "full") {
+        options.mode = MergeMode::Full;
+    }
+    const char* verify = std::getenv("MODULAR_MERGE_VERIFY");
+    options.compareContents = verify && std::string(verify) == "1";
+    const char* strategy = std::getenv("MODULAR_MERGE_STRATEGY");
+    if (strategy && *strategy) {
+        for (MergeStrategy candidate : { MergeStrategy::Auto, MergeStrategy::Reflink, MergeStrategy::Hardlink,
+                 MergeStrategy::CopyFileRange, MergeStrategy::Copy }) {
+            if (std::string(strategy) == mergeStrategyName(candidate)) {
+                options.strategy = candidate;
+            }
+        }
+    }
+    return options;
+}
+
+MergeStats mergeDirectories(const fs::path& target, const fs::path& source, const MergeOptions& options)
+{
+    auto started = std::chrono::steady_clock::now();
+    std::error_code ec;
+    fs::create_directories(target, ec);
+
+    MergeStrategy strategy = options.strategy;
+    if (strategy == MergeStrategy::Auto) {
+        strategy = pickMergeStrategy(target, source);
+    }
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    bool differential = options.mode == MergeMode::Differential;
+
+    std::vector<SourceFile> files = listSource(target, source, threads);
+    fs::path record = mergeRecordDirectory(target) / (md5Of(pathKey(source)) + ".json");
+    std::set<std::string> previous = loadMergeRecord(record);
+
+    // Plan: a file this source placed before that still has the source's size and time
+    // is already what a merge would put there. Files another source placed are always
+    // replaced, however alike they look.
+    if (differential) {
+        parallelFor(files.size(), threads, [&](size_t i) {
+            SourceFile& file = files[i];
+            if (!previous.count(file.rel.generic_string())) {
+                return;
+            }
+            fs::path dest = target / file.rel;
+            std::error_code statEc;
+            uintmax_t size = fs::file_size(dest, statEc);
+            if (statEc || size != file.size) {
+                return;
+            }
+            fs::file_time_type mtime = fs::last_write_time(dest, statEc);
+            if (!statEc && mtime == file.mtime) {
+                file.action = SourceFile::Skip;
+            } else if (options.compareContents) {
+                std::string destMd5 = md5_file(dest);
+                if (!destMd5.empty() && destMd5 == md5_file(source / file.rel)) {
+                    file.action = SourceFile::Retime;
+                }
+            }
+        });
+    }
+
+    AtomicStats stats;
+    std::atomic<size_t> unchanged { 0 };
+    std::atomic<uintmax_t> skippedBytes { 0 };
+    std::mutex replacedMutex;
+    std::set<std::string> replaced; // files that were in the target but not from this source
+    parallelFor(files.size(), threads, [&](size_t i) {
+        const SourceFile& file = files[i];
+        stats.files++;
+        fs::path dest = target / file.rel;
+        if (file.action == SourceFile::Place) {
+            if (placeFile(source / file.rel, dest, file.size, file.mtime, strategy, stats)
+                && !previous.count(file.rel.generic_string())) {
+                std::lock_guard<std::mutex> lock(replacedMutex);
+                replaced.insert(file.rel.generic_string());
+            }
+            return;
+        }
+        if (file.action == SourceFile::Retime) {
+            std::error_code timeEc;
+            fs::last_write_time(dest, file.mtime, timeEc);
+        }
+        unchanged++;
+        skippedBytes += file.size;
+    });
+
+    // Remember what this source placed; a differential merge also removes what it dropped.
+    std::set<std::string> placed;
+    for (const auto& file : files) {
+        placed.insert(file.rel.generic_string());
+    }
+    size_t deleted = 0;
+    if (differential) {
+        std::set<std::string> dropped;
+        std::set_difference(previous.begin(), previous.end(), placed.begin(), placed.end(),
+            std::inserter(dropped, dropped.end()));
+        if (!dropped.empty()) {
+            deleted = removeDropped(target, record, std::move(dropped));
+        }
+    }
+    if (placed != previous) {
+        saveMergeRecord(record, source, placed);
+    }
+
+    MergeStats result;
+    result.files = stats.files;
+    result.reflinked = stats.reflinked;
+    result.hardlinked = stats.hardlinked;
+    result.rangeCopied = stats.rangeCopied;
+    result.copied = stats.copied;
+    result.failed = stats.failed;
+    result.bytes = stats.bytes;
+    result.unchanged = unchanged;
+    result.skippedBytes = skippedBytes;
+    result.deleted = deleted;
+    result.overwritten = replaced.empty() ? 0 : countOthersFiles(record, std::move(replaced));
+
+    MetricLabels labels { { "strategy", mergeStrategyName(strategy) } };
+    Metrics::instance().observe_seconds("modular_merge_seconds",
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count(), labels);
+    Metrics::instance().add("modular_merge_files_total", static_cast<double>(result.files), labels);
+    Metrics::instance().add("modular_merge_bytes_total", static_cast<double>(result.bytes), labels);
+    Metrics::instance().add("modular_merge_skipped_bytes_total", static_cast<double>(result.skippedBytes), labels);
+    Metrics::instance().add("modular_merge_deleted_files_total", static_cast<double>(result.deleted), labels);
+    return result;
+}
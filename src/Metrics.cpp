@@ -0,0 +1,350 @@
+#include "Metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <string_view>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+namespace {
+
+const std::vector<double> SECONDS_BUCKETS = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+    1, 2.5, 5, 10, 30, 60, 300 };
+
+const std::vector<double> BYTES_BUCKETS = { 1024, 4096, 16384, 65536, 262144, 1048576, 4194304,
+    16777216, 67108864, 268435456, 1073741824, 4294967296.0, 17179869184.0 };
+
+/**
+ * Writes the map key of one series into key, reusing its storage: recording happens
+ * several times per HTTP request, and the series nearly always exists already.
+ */
+void series_key(std::string& key, const std::string& name, const MetricLabels& labels)
+{
+    key.assign(name);
+    for (const auto& [label, value] : labels) {
+        key += '\n';
+        key += label;
+        key += '=';
+        key += value;
+    }
+}
+
+std::string prometheus_escape(const std::string& value)
+{
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+// {a="1",b="2"}, with an optional extra label (used for "le") appended last.
+std::string prometheus_labels(const MetricLabels& labels, const std::string& extra_name = "",
+    const std::string& extra_value = "")
+{
+    std::string out;
+    for (const auto& [label, value] : labels) {
+        out += (out.empty() ? "" : ",") + label + "=\"" + prometheus_escape(value) + "\"";
+    }
+    if (!extra_name.empty()) {
+        out += (out.empty() ? "" : ",") + extra_name + "=\"" + extra_value + "\"";
+    }
+    return out.empty() ? "" : "{" + out + "}";
+}
+
+std::string format_number(double value)
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+    return buffer;
+}
+
+std::string host_of(const char* url)
+{
+    if (!url) {
+        return "";
+    }
+    std::string_view s = url;
+    auto start = s.find("://");
+    start = (start == std::string_view::npos) ? 0 : start + 3;
+    auto end = s.find_first_of(":/?", start);
+    return std::string(s.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start));
+}
+
+bool write_atomically(const fs::path& path, const std::string& content)
+{
+    fs::path tmp = path;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return false;
+        }
+        ofs << content;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        std::cerr << "Failed to save " << path.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------------------
+// Histogram
+//----------------------------------------------------------------------------------
+
+Histogram::Histogram(std::vector<double> upper_bounds)
+    : bounds(std::move(upper_bounds))
+    , counts(bounds.size() + 1, 0)
+{
+}
+
+void Histogram::observe(double value)
+{
+    auto it = std::lower_bound(bounds.begin(), bounds.end(), value);
+    counts[static_cast<size_t>(it - bounds.begin())]++;
+    count++;
+    sum += value;
+}
+
+//----------------------------------------------------------------------------------
+// Metrics
+//----------------------------------------------------------------------------------
+
+Metrics& Metrics::instance()
+{
+    // Never destroyed: other singletons' threads may still record while statics are torn down.
+    static Metrics* metrics = new Metrics();
+    return *metrics;
+}
+
+void Metrics::observe(const std::string& name, double value, const MetricLabels& labels,
+    const std::vector<double>& bounds)
+{
+    thread_local std::string key;
+    series_key(key, name, labels);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = histograms_.find(key);
+    if (it == histograms_.end()) {
+        it = histograms_.emplace(key, Series { name, labels, Histogram(bounds) }).first;
+    }
+    it->second.histogram.observe(value);
+}
+
+void Metrics::observe_seconds(const std::string& name, double seconds, const MetricLabels& labels)
+{
+    observe(name, seconds, labels, SECONDS_BUCKETS);
+}
+
+void Metrics::observe_bytes(const std::string& name, double bytes, const MetricLabels& labels)
+{
+    observe(name, bytes, labels, BYTES_BUCKETS);
+}
+
+void Metrics::add(const std::string& name, double value, const MetricLabels& labels)
+{
+    thread_local std::string key;
+    series_key(key, name, labels);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = counters_.find(key);
+    if (it == counters_.end()) {
+        it = counters_.emplace(key, Counter { name, labels, 0 }).first;
+    }
+    it->second.value += value;
+}
+
+std::string Metrics::to_json() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    json histograms = json::array();
+    for (const auto& [key, series] : histograms_) {
+        const Histogram& h = series.histogram;
+        json buckets = json::array();
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < h.bounds.size(); i++) {
+            cumulative += h.counts[i];
+            buckets.push_back({ { "le", h.bounds[i] }, { "count", cumulative } });
+        }
+        histograms.push_back({ { "name", series.name }, { "labels", series.labels }, { "count", h.count },
+            { "sum", h.sum }, { "mean", h.count ? h.sum / static_cast<double>(h.count) : 0.0 },
+            { "buckets", buckets } });
+    }
+    json counters = json::array();
+    for (const auto& [key, counter] : counters_) {
+        counters.push_back({ { "name", counter.name }, { "labels", counter.labels }, { "value", counter.value } });
+    }
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return json { { "generated_at", std::chrono::duration_cast<std::chrono::seconds>(now).count() },
+        { "histograms", histograms }, { "counters", counters } }
+        .dump(2);
+}
+
+std::string Metrics::to_prometheus() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::ostringstream out;
+    std::string last_name;
+    for (const auto& [key, series] : histograms_) {
+        if (series.name != last_name) {
+            out << "# TYPE " << series.name << " histogram\n";
+            last_name = series.name;
+        }
+        const Histogram& h = series.histogram;
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < h.bounds.size(); i++) {
+            cumulative += h.counts[i];
+            out << series.name << "_bucket" << prometheus_labels(series.labels, "le", format_number(h.bounds[i]))
+                << " " << cumulative << "\n";
+        }
+        out << series.name << "_bucket" << prometheus_labels(series.labels, "le", "+Inf") << " " << h.count << "\n";
+        out << series.name << "_sum" << prometheus_labels(series.labels) << " " << format_number(h.sum) << "\n";
+        out << series.name << "_count" << prometheus_labels(series.labels) << " " << h.count << "\n";
+    }
+    last_name.clear();
+    for (const auto& [key, counter] : counters_) {
+        if (counter.name != last_name) {
+            out << "# TYPE " << counter.name << " counter\n";
+            last_name = counter.name;
+        }
+        out << counter.name << prometheus_labels(counter.labels) << " " << format_number(counter.value) << "\n";
+    }
+    return out.str();
+}
+
+bool Metrics::write(const fs::path& directory) const
+{
+    std::error_code ec;
+    fs::create_directories(directory, ec);
+    bool ok = write_atomically(directory / "stats.json", to_json());
+    return write_atomically(directory / "stats.prom", to_prometheus()) && ok;
+}
+
+//----------------------------------------------------------------------------------
+// Helpers
+//----------------------------------------------------------------------------------
+
+void record_curl_transfer(CURL* easy, const std::string& kind)
+{
+    char* url = nullptr;
+    long status = 0;
+    curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL, &url);
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &status);
+    // Kept between calls and updated in place: consecutive transfers nearly always carry
+    // the same labels, so this way recording them allocates nothing.
+    thread_local MetricLabels labels { { "kind", "" }, { "host", "" } };
+    thread_local MetricLabels request_labels { { "kind", "" }, { "host", "" }, { "status", "" } };
+    labels["kind"] = kind;
+    labels["host"] = host_of(url);
+    request_labels["kind"] = kind;
+    request_labels["host"] = labels["host"];
+    request_labels["status"] = std::to_string(status);
+
+    Metrics& metrics = Metrics::instance();
+    static const std::string requests_total = "modular_http_requests_total";
+    static const std::string received_total = "modular_http_received_bytes_total";
+    static const std::string response_bytes = "modular_http_response_bytes";
+    static const std::string speed = "modular_http_speed_bytes_per_second";
+    metrics.add(requests_total, 1, request_labels);
+
+    // Each *_TIME_T is microseconds from the start of the transfer to the end of that phase.
+    static const std::pair<CURLINFO, std::string> phases[] = {
+        { CURLINFO_NAMELOOKUP_TIME_T, "modular_http_namelookup_seconds" },
+        { CURLINFO_CONNECT_TIME_T, "modular_http_connect_seconds" },
+        { CURLINFO_APPCONNECT_TIME_T, "modular_http_tls_seconds" },
+        { CURLINFO_STARTTRANSFER_TIME_T, "modular_http_first_byte_seconds" },
+        { CURLINFO_TOTAL_TIME_T, "modular_http_total_seconds" },
+    };
+    for (const auto& [info, name] : phases) {
+        curl_off_t micros = 0;
+        if (curl_easy_getinfo(easy, info, &micros) == CURLE_OK) {
+            metrics.observe_seconds(name, static_cast<double>(micros) / 1e6, labels);
+        }
+    }
+
+    curl_off_t size = 0, bytes_per_second = 0;
+    curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD_T, &size);
+    curl_easy_getinfo(easy, CURLINFO_SPEED_DOWNLOAD_T, &bytes_per_second);
+    metrics.observe_bytes(response_bytes, static_cast<double>(size), labels);
+    metrics.observe_bytes(speed, static_cast<double>(bytes_per_second), labels);
+    metrics.add(received_total, static_cast<double>(size), labels);
+}
+
+ScopedTimer::ScopedTimer(std::string name, MetricLabels labels)
+    : name_(std::move(name))
+    , labels_(std::move(labels))
+    , start_(std::chrono::steady_clock::now())
+{
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+    Metrics::instance().observe_seconds(name_, elapsed.count(), labels_);
+}
+
+fs::path stats_directory()
+{
+    const char* env = std::getenv("MODULAR_STATS_DIR");
+    if (env && *env) {
+        return fs::path(env);
+    }
+    std::string homeDir = std::string(std::getenv("HOME") ? std::getenv("HOME") : "");
+    return fs::path(homeDir) / "Games" / "Mods-Lists" / ".stats";
+}
+
+//----------------------------------------------------------------------------------
+// StatsExporter
+//----------------------------------------------------------------------------------
+
+StatsExporter::StatsExporter()
+{
+    const char* env = std::getenv("MODULAR_STATS_INTERVAL");
+    int interval = env ? std::atoi(env) : 0;
+    if (interval <= 0) {
+        return;
+    }
+    thread_ = std::thread([this, interval] {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!cv_.wait_for(lock, std::chrono::seconds(interval), [this] { return stop_; })) {
+            Metrics::instance().write(stats_directory());
+        }
+    });
+}
+
+StatsExporter::~StatsExporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    flush();
+}
+
+void StatsExporter::flush()
+{
+    fs::path directory = stats_directory();
+    if (Metrics::instance().write(directory)) {
+        std::cout << "Stats written to " << (directory / "stats.json").string() << " and stats.prom." << std::endl;
+    }
+}
@@ -1,7 +1,18 @@
 #include "NexusMods.h"
+#include "DeltaSync.h"
+#include "DownloadEngine.h"
+#include "DownloadScheduler.h"
+#include "HttpClient.h"
+#include "JsonStream.h"
+#include "Metrics.h"
+#include "RateLimiter.h"
+#include "ResponseCache.h"
+#include "SyncManifest.h"
 #include <chrono>
 #include <cstdlib>
-#include <curl/curl.h>
+#include <ctime>
+#include <mutex>
+#include <optional>
 #include <thread>
 
 //----------------------------------------------------------------------------------
@@ -9,54 +20,113 @@
 //----------------------------------------------------------------------------------
 
 /**
- * Write callback for libcurl to accumulate the response body in a std::string.
+ * Perform a single GET request to the specified URL with the specified headers.
+ * Runs on the shared HttpClient, so repeat calls reuse the open connection to api.nexusmods.com.
  */
-static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
+static HttpResponse perform_get(const std::string& url, const std::vector<std::string>& headers)
 {
-    size_t totalSize = size * nmemb;
-    std::string* str = static_cast<std::string*>(userp);
-    str->append(static_cast<char*>(contents), totalSize);
-    return totalSize;
+    return HttpClient::instance().get(url, headers).get();
 }
 
 /**
- * Perform a GET request to the specified URL with the specified headers.
+ * Base URL of the NexusMods API. MODULAR_NEXUS_API_URL points the tool at another
+ * server, such as the benchmark's local stand-in.
  */
-HttpResponse http_get(const std::string& url, const std::vector<std::string>& headers)
+std::string nexus_api_base()
 {
-    HttpResponse response { 0, "" };
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        std::cerr << "Failed to initialize CURL." << std::endl;
-        return response;
+    const char* env = std::getenv("MODULAR_NEXUS_API_URL");
+    if (env && *env) {
+        std::string base = env;
+        while (!base.empty() && base.back() == '/') {
+            base.pop_back();
+        }
+        return base;
     }
+    return "https://api.nexusmods.com/v1";
+}
+
+/**
+ * Perform a GET request to the specified URL with the specified headers.
+ * Requests are paced by the shared Nexus rate limiter, which is fed from each
+ * response's X-RL-* headers; a 429 is retried once its Retry-After has passed.
+ *
+ * Successful responses are kept in the on-disk response cache. A fresh entry is
+ * returned without any network traffic (unless revalidate is set); a stale one is
+ * revalidated with its ETag/Last-Modified and, if the server answers 304, returned as a 200.
+ */
+HttpResponse http_get(const std::string& url, const std::vector<std::string>& headers, bool revalidate)
+{
+    const int max_attempts = 3;
+    RateLimiter& limiter = nexus_rate_limiter();
+    ResponseCache& cache = nexus_response_cache();
 
-    // Build the custom headers
-    struct curl_slist* curl_headers = nullptr;
+    // Responses differ per account, so the key includes the API key the request is made with.
+    std::string cache_key = url;
     for (const auto& header : headers) {
-        curl_headers = curl_slist_append(curl_headers, header.c_str());
+        if (header.rfind("apikey:", 0) == 0) {
+            cache_key += "\n" + header;
+        }
     }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curl_headers);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response.body);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-
-    // Perform the request
-    CURLcode res = curl_easy_perform(curl);
-    if (res != CURLE_OK) {
-        std::cerr << "CURL GET failed: " << curl_easy_strerror(res) << std::endl;
-    } else {
-        // Get HTTP status code
-        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status_code);
+    long long ttl = cache_ttl_for(url);
+    std::optional<CacheEntry> cached;
+    if (ttl >= 0) {
+        cached = cache.load(cache_key);
+    }
+    if (cached && !revalidate && cached->age_seconds() < ttl) {
+        return HttpResponse { 200, std::move(cached->body), {} };
+    }
+
+    std::vector<std::string> request_headers = headers;
+    if (cached) {
+        if (!cached->etag.empty()) {
+            request_headers.push_back("If-None-Match: " + cached->etag);
+        }
+        if (!cached->last_modified.empty()) {
+            request_headers.push_back("If-Modified-Since: " + cached->last_modified);
+        }
     }
 
-    // Cleanup
-    curl_slist_free_all(curl_headers);
-    curl_easy_cleanup(curl);
+    HttpResponse response { 0, "", {} };
+    for (int attempt = 0; attempt < max_attempts; attempt++) {
+        limiter.acquire();
+        response = perform_get(url, request_headers);
+        limiter.update(response.status_code, response.headers);
+        if (response.status_code != 429) {
+            break;
+        }
+        std::cerr << "Rate limited (HTTP 429) on " << url << "." << std::endl;
+    }
 
+    if (response.status_code == 304 && cached) {
+        response.status_code = 200;
+        response.body = cached->body;
+        cache.touch(cache_key, *cached);
+    } else if (response.status_code == 200 && ttl >= 0) {
+        auto etag = response.headers.find("etag");
+        auto last_modified = response.headers.find("last-modified");
+        bool validated = etag != response.headers.end() || last_modified != response.headers.end();
+        if (ttl == 0 && !validated) {
+            // Could never be served fresh nor revalidated, so storing it would only fill the disk.
+            if (cached) {
+                cache.erase(cache_key);
+            }
+            return response;
+        }
+        // The body is lent to the entry while it is stored, not copied into it.
+        CacheEntry entry;
+        entry.url = url;
+        entry.body = std::move(response.body);
+        if (etag != response.headers.end()) {
+            entry.etag = etag->second;
+        }
+        if (last_modified != response.headers.end()) {
+            entry.last_modified = last_modified->second;
+        }
+        entry.stored_at = static_cast<long long>(std::time(nullptr));
+        cache.store(cache_key, entry);
+        response.body = std::move(entry.body);
+    }
     return response;
 }
 
@@ -88,7 +158,7 @@ std::vector<int> get_tracked_mods()
 {
     std::vector<int> mod_ids;
 
-    std::string url = "https://api.nexusmods.com/v1/user/tracked_mods.json";
+    std::string url = nexus_api_base() + "/user/tracked_mods.json";
     std::vector<std::string> local_headers = {
         "accept: application/json",
         "apikey: " + API_KEY
@@ -97,22 +167,16 @@ std::vector<int> get_tracked_mods()
     HttpResponse resp = http_get(url, local_headers);
     if (resp.status_code == 200) {
         try {
-            json data = json::parse(resp.body);
-            // Check if data is a list or an object with "mods"
-            if (data.is_array()) {
-                for (auto& mod : data) {
-                    if (mod.contains("mod_id")) {
-                        mod_ids.push_back(mod["mod_id"].get<int>());
+            // Only mod_id is needed, so pull it out with the SAX parser rather than building
+            // a DOM; the list is either the top-level array or an object's "mods" array.
+            size_t found = stream_json_objects(resp.body, { { "*" }, { "mods", "*" } }, { "mod_id" },
+                [&](const JsonFields& mod) {
+                    auto it = mod.find("mod_id");
+                    if (it != mod.end()) {
+                        mod_ids.push_back(it->second.get<int>());
                     }
-                }
-            } else if (data.contains("mods")) {
-                auto mods_list = data["mods"];
-                for (auto& mod : mods_list) {
-                    if (mod.contains("mod_id")) {
-                        mod_ids.push_back(mod["mod_id"].get<int>());
-                    }
-                }
-            } else {
+                });
+            if (found == 0) {
                 std::cout << "No mods found in the tracked mods response." << std::endl;
                 return {};
             }
@@ -127,59 +191,174 @@ std::vector<int> get_tracked_mods()
     return mod_ids;
 }
 
+//----------------------------------------------------------------------------------
+// files.json metadata kept for the download stage
+//----------------------------------------------------------------------------------
+
+static std::mutex file_info_mutex;
+static std::map<std::pair<int, int>, NexusFileInfo> file_info_catalog;
+
 /**
- * Retrieve file_ids for each mod_id.
+ * Record the md5/size/name fields of one files.json entry.
  */
-std::map<int, std::vector<int>> get_file_ids(const std::vector<int>& mod_ids, const std::string& game_domain)
+static void remember_file_info(int mod_id, const JsonFields& file_json)
 {
-    std::map<int, std::vector<int>> mod_file_ids;
+    NexusFileInfo info;
+    info.mod_id = mod_id;
+    info.file_id = file_json.at("file_id").get<int>();
 
-    for (auto mod_id : mod_ids) {
-        std::ostringstream oss;
-        oss << "https://api.nexusmods.com/v1/games/"
-            << game_domain << "/mods/" << mod_id << "/files.json?category=main";
-        std::string url = oss.str();
-
-        std::vector<std::string> local_headers = {
-            "accept: application/json",
-            "apikey: " + API_KEY
-        };
-
-        HttpResponse resp = http_get(url, local_headers);
-
-        if (resp.status_code == 200) {
-            try {
-                json data = json::parse(resp.body);
-                if (data.contains("files")) {
-                    auto file_list = data["files"];
-                    std::vector<int> file_ids;
-                    for (auto& file_json : file_list) {
-                        if (file_json.contains("file_id")) {
-                            file_ids.push_back(file_json["file_id"].get<int>());
-                        }
-                    }
-                    mod_file_ids[mod_id] = file_ids;
-                    std::cout << "Mod ID " << mod_id << " has " << file_ids.size() << " files." << std::endl;
-                } else {
-                    std::cout << "No files found for mod " << mod_id << "." << std::endl;
-                    mod_file_ids[mod_id] = {};
+    auto field = [&file_json](const char* name) -> const json* {
+        auto it = file_json.find(name);
+        return (it == file_json.end() || it->second.is_null()) ? nullptr : &it->second;
+    };
+    if (const json* name = field("file_name"); name && name->is_string()) {
+        info.file_name = name->get<std::string>();
+    }
+    if (const json* md5 = field("md5"); md5 && md5->is_string()) {
+        info.md5 = md5->get<std::string>();
+    }
+    if (const json* bytes = field("size_in_bytes"); bytes && bytes->is_number()) {
+        info.size_bytes = bytes->get<uintmax_t>();
+        info.size_exact = true;
+    } else if (const json* kb = field("size_kb"); kb && kb->is_number()) {
+        info.size_bytes = kb->get<uintmax_t>() * 1024;
+    }
+
+    remember_file_info(info);
+}
+
+void remember_file_info(const NexusFileInfo& info)
+{
+    std::lock_guard<std::mutex> lock(file_info_mutex);
+    file_info_catalog[{ info.mod_id, info.file_id }] = info;
+}
+
+std::optional<NexusFileInfo> find_file_info(int mod_id, int file_id)
+{
+    std::lock_guard<std::mutex> lock(file_info_mutex);
+    auto it = file_info_catalog.find({ mod_id, file_id });
+    if (it == file_info_catalog.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+/**
+ * Retrieve the main-category file_ids of one mod. Empty if the request or parse failed.
+ * revalidate is for mods known to have changed, whose cached list may be out of date.
+ */
+std::vector<int> get_mod_file_ids(int mod_id, const std::string& game_domain, bool revalidate)
+{
+    std::ostringstream oss;
+    oss << nexus_api_base() << "/games/"
+        << game_domain << "/mods/" << mod_id << "/files.json?category=main";
+    std::string url = oss.str();
+
+    std::vector<std::string> local_headers = {
+        "accept: application/json",
+        "apikey: " + API_KEY
+    };
+
+    HttpResponse resp = http_get(url, local_headers, revalidate);
+
+    if (resp.status_code != 200) {
+        std::cout << "Error fetching files for mod " << mod_id << ": " << resp.status_code << std::endl;
+        return {};
+    }
+
+    std::vector<int> file_ids;
+    try {
+        size_t found = stream_json_objects(resp.body, { { "files", "*" } },
+            { "file_id", "file_name", "md5", "size_kb", "size_in_bytes" },
+            [&](const JsonFields& file_json) {
+                auto it = file_json.find("file_id");
+                if (it != file_json.end()) {
+                    file_ids.push_back(it->second.get<int>());
+                    remember_file_info(mod_id, file_json);
                 }
-            } catch (const std::exception& e) {
-                std::cerr << "JSON parse error in get_file_ids: " << e.what() << std::endl;
-                mod_file_ids[mod_id] = {};
-            }
+            });
+        if (found > 0) {
+            std::cout << "Mod ID " << mod_id << " has " << file_ids.size() << " files." << std::endl;
         } else {
-            std::cout << "Error fetching files for mod " << mod_id << ": " << resp.status_code << std::endl;
-            mod_file_ids[mod_id] = {};
+            std::cout << "No files found for mod " << mod_id << "." << std::endl;
         }
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in get_file_ids: " << e.what() << std::endl;
+        return {};
+    }
+    return file_ids;
+}
+
+/**
+ * Retrieve file_ids for each mod_id. Mods unchanged since the last sync reuse what
+ * that sync listed (see DeltaSync.h).
+ */
+std::map<int, std::vector<int>> get_file_ids(const std::vector<int>& mod_ids, const std::string& game_domain)
+{
+    std::map<int, std::vector<int>> mod_file_ids;
+    DeltaSync delta(game_domain);
+    delta.begin(mod_ids);
 
-        // Respect rate limit
-        std::this_thread::sleep_for(std::chrono::seconds(1));
+    for (auto mod_id : mod_ids) {
+        mod_file_ids[mod_id] = delta.mod_file_ids(mod_id);
     }
 
+    delta.finish();
     return mod_file_ids;
 }
 
+/**
+ * Ask the API for a download link for one file. std::nullopt if none was returned.
+ */
+std::optional<std::string> generate_download_link(int mod_id, int file_id, const std::string& game_domain)
+{
+    std::ostringstream oss;
+    oss << nexus_api_base() << "/games/"
+        << game_domain << "/mods/" << mod_id
+        << "/files/" << file_id << "/download_link.json?expires=999999";
+
+    std::string url = oss.str();
+    std::vector<std::string> local_headers = {
+        "accept: application/json",
+        "apikey: " + API_KEY
+    };
+
+    HttpResponse resp = http_get(url, local_headers);
+
+    if (resp.status_code != 200) {
+        std::cout << "Error generating download link for Mod ID "
+                  << mod_id << ", File ID " << file_id << ": "
+                  << resp.status_code << std::endl;
+        return std::nullopt;
+    }
+
+    try {
+        // Expecting a list of links; only the first one's URI is read out of the body.
+        std::optional<std::string> uri;
+        size_t links = stream_json_objects(resp.body, { { "*" } }, { "URI" }, [&](const JsonFields& fields) {
+            auto it = fields.find("URI");
+            if (!uri && it != fields.end() && it->second.is_string()) {
+                uri = it->second.get<std::string>();
+            }
+        });
+        if (links > 0) {
+            if (uri) {
+                std::cout << "Generated download link for Mod ID "
+                          << mod_id << ", File ID " << file_id << "." << std::endl;
+                return uri;
+            }
+            std::cout << "No 'URI' field found for Mod ID "
+                      << mod_id << ", File ID " << file_id << "." << std::endl;
+        } else {
+            std::cout << "No download links found for Mod ID "
+                      << mod_id << ", File ID " << file_id << "." << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in generate_download_links: " << e.what() << std::endl;
+    }
+    return std::nullopt;
+}
+
 /**
  * Generate download links for each (mod_id, file_id) pair.
  */
@@ -191,54 +370,64 @@ std::map<std::pair<int, int>, std::string> generate_download_links(
 
     for (auto& [mod_id, file_ids] : mod_file_ids) {
         for (auto file_id : file_ids) {
-            std::ostringstream oss;
-            oss << "https://api.nexusmods.com/v1/games/"
-                << game_domain << "/mods/" << mod_id
-                << "/files/" << file_id << "/download_link.json?expires=999999";
-
-            std::string url = oss.str();
-            std::vector<std::string> local_headers = {
-                "accept: application/json",
-                "apikey: " + API_KEY
-            };
-
-            HttpResponse resp = http_get(url, local_headers);
-
-            if (resp.status_code == 200) {
-                try {
-                    json data = json::parse(resp.body);
-                    // Expecting a list of links
-                    if (data.is_array() && !data.empty()) {
-                        if (data[0].contains("URI")) {
-                            std::string download_url = data[0]["URI"].get<std::string>();
-                            download_links[{ mod_id, file_id }] = download_url;
-                            std::cout << "Generated download link for Mod ID "
-                                      << mod_id << ", File ID " << file_id << "." << std::endl;
-                        } else {
-                            std::cout << "No 'URI' field found for Mod ID "
-                                      << mod_id << ", File ID " << file_id << "." << std::endl;
-                        }
-                    } else {
-                        std::cout << "No download links found for Mod ID "
-                                  << mod_id << ", File ID " << file_id << "." << std::endl;
-                    }
-                } catch (const std::exception& e) {
-                    std::cerr << "JSON parse error in generate_download_links: " << e.what() << std::endl;
-                }
-            } else {
-                std::cout << "Error generating download link for Mod ID "
-                          << mod_id << ", File ID " << file_id << ": "
-                          << resp.status_code << std::endl;
+            if (auto link = generate_download_link(mod_id, file_id, game_domain)) {
+                download_links[{ mod_id, file_id }] = *link;
             }
-
-            // Respect rate limit
-            std::this_thread::sleep_for(std::chrono::seconds(1));
         }
     }
 
     return download_links;
 }
 
+/**
+ * Build the job that downloads one file into <base_directory>/<mod_id>/.
+ * The filename is taken from the URL; the expected hash and size come from files.json.
+ */
+DownloadJob make_download_job(int mod_id, int file_id, const std::string& url, const fs::path& base_directory)
+{
+    // Get filename from URL
+    // e.g. ... /filename.ext?some=param
+    std::string filename;
+    {
+        // Extract substring after last '/'
+        auto pos = url.rfind('/');
+        if (pos != std::string::npos && pos < url.size() - 1) {
+            filename = url.substr(pos + 1);
+        }
+        // Remove query string if present
+        pos = filename.find('?');
+        if (pos != std::string::npos) {
+            filename = filename.substr(0, pos);
+        }
+        // Fallback if empty
+        if (filename.empty()) {
+            std::ostringstream fallback;
+            fallback << "mod_" << mod_id << "_file_" << file_id << ".zip";
+            filename = fallback.str();
+        }
+    }
+
+    // Create a directory for the mod_id
+    fs::path mod_directory = base_directory / std::to_string(mod_id);
+    fs::create_directories(mod_directory);
+
+    DownloadJob job;
+    job.url = escape_spaces(url); // escape only spaces in the URL
+    job.path = mod_directory / filename;
+    job.mod_id = mod_id;
+    job.file_id = file_id;
+    job.label = filename + " (Mod ID " + std::to_string(mod_id) + ", File ID " + std::to_string(file_id) + ")";
+
+    // Verify against files.json while the bytes stream in, if get_file_ids() (or the
+    // delta sync's remembered listing) saw this file
+    if (auto info = find_file_info(mod_id, file_id)) {
+        job.expected_md5 = info->md5;
+        job.expected_size = info->size_exact ? info->size_bytes : 0;
+        job.size_hint = info->size_bytes;
+    }
+    return job;
+}
+
 /**
  * Save the download links to a text file in the base directory.
  */
@@ -273,6 +462,9 @@ void save_download_links(const std::map<std::pair<int, int>, std::string>& downl
 
 /**
  * Download files from the list of URLs in download_links.txt with retry logic.
+ * Transfers run concurrently through a DownloadEngine (see MODULAR_PARALLEL_DOWNLOADS).
+ * Files the domain's manifest already lists as downloaded are skipped, and each
+ * completed file is added to it.
  */
 void download_files(const std::string& game_domain)
 {
@@ -298,67 +490,15 @@ void download_files(const std::string& game_domain)
         }
     }
 
-    // Utility function to download a file with retries
-    auto download_with_retries = [&](const std::string& url_in, const fs::path& file_path,
-                                     int mod_id, int file_id) {
-        const int retries = 5;
-        // Escape only spaces in the URL
-        std::string safe_url = escape_spaces(url_in);
-
-        for (int attempt = 0; attempt < retries; attempt++) {
-            std::cout << "Downloading Mod ID " << mod_id << ", File ID "
-                      << file_id << " (Attempt " << (attempt + 1) << ")..." << std::endl;
-
-            CURL* curl = curl_easy_init();
-            if (!curl) {
-                std::cerr << "Failed to initialize CURL for download." << std::endl;
-                return;
-            }
+    SyncManifest manifest(base_directory);
+    manifest.load();
 
-            FILE* fp = std::fopen(file_path.string().c_str(), "wb");
-            if (!fp) {
-                std::cerr << "Failed to open file for writing: "
-                          << file_path.string() << std::endl;
-                curl_easy_cleanup(curl);
-                return;
-            }
+    int parallel = parallel_downloads_from_env();
+    DownloadEngine engine(parallel);
+    int skipped = 0;
 
-            // Set the (space-escaped) URL
-            curl_easy_setopt(curl, CURLOPT_URL, safe_url.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, nullptr);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-
-            // Perform the request
-            CURLcode res = curl_easy_perform(curl);
-            long http_code = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-
-            std::fclose(fp);
-            curl_easy_cleanup(curl);
-
-            if (res == CURLE_OK && http_code == 200) {
-                std::cout << "Downloaded " << file_path.filename().string()
-                          << " to " << file_path.parent_path().string() << std::endl;
-                return; // success
-            } else {
-                std::cerr << "Error downloading Mod ID " << mod_id << ", File ID "
-                          << file_id << ": CURL code " << res
-                          << ", HTTP code " << http_code << std::endl;
-                if (attempt < retries - 1) {
-                    std::cout << "Retrying..." << std::endl;
-                    std::this_thread::sleep_for(std::chrono::seconds(5));
-                } else {
-                    std::cerr << "Failed to download Mod ID " << mod_id
-                              << ", File ID " << file_id << " after " << retries
-                              << " attempts." << std::endl;
-                }
-            }
-        }
-    };
-
-    // Process each line
+    // Collect each line
+    std::vector<DownloadJob> jobs;
     for (auto& line : lines) {
         std::stringstream ss(line);
         std::string mod_id_str, file_id_str, url;
@@ -366,40 +506,38 @@ void download_files(const std::string& game_domain)
             int mod_id = std::stoi(mod_id_str);
             int file_id = std::stoi(file_id_str);
 
-            // Get filename from URL
-            // e.g. ... /filename.ext?some=param
-            std::string filename;
-            {
-                // Extract substring after last '/'
-                auto pos = url.rfind('/');
-                if (pos != std::string::npos && pos < url.size() - 1) {
-                    filename = url.substr(pos + 1);
-                }
-                // Remove query string if present
-                pos = filename.find('?');
-                if (pos != std::string::npos) {
-                    filename = filename.substr(0, pos);
-                }
-                // Fallback if empty
-                if (filename.empty()) {
-                    std::ostringstream fallback;
-                    fallback << "mod_" << mod_id << "_file_" << file_id << ".zip";
-                    filename = fallback.str();
-                }
+            if (manifest.is_current(mod_id, file_id)) {
+                skipped++;
+                continue;
             }
 
-            // Create a directory for the mod_id
-            fs::path mod_directory = base_directory / std::to_string(mod_id);
-            fs::create_directories(mod_directory);
-
-            // Define the full path
-            fs::path file_path = mod_directory / filename;
+            jobs.push_back(make_download_job(mod_id, file_id, url, base_directory));
+        }
+    }
 
-            // Download with retry
-            download_with_retries(url, file_path, mod_id, file_id);
+    // The scheduler orders by size; links saved by an earlier run come without files.json sizes.
+    probe_download_sizes(jobs, parallel);
+    for (auto& job : jobs) {
+        engine.add(std::move(job));
+    }
 
-            // Optional: Sleep to respect server load
-            std::this_thread::sleep_for(std::chrono::seconds(1));
+    int succeeded = 0;
+    int failed = 0;
+    engine.run([&](const DownloadResult& result) {
+        if (!result.success) {
+            failed++;
+            return;
         }
+        succeeded++;
+        // Checkpointed as files finish so an interrupted run still remembers most of what it finished.
+        manifest.record(result.job.mod_id, result.job.file_id, result.job.path, result.md5);
+        manifest.checkpoint();
+    });
+    if (succeeded > 0) {
+        manifest.save();
     }
+
+    std::cout << "Finished downloads for " << game_domain << ": " << succeeded
+              << " succeeded, " << failed << " failed, " << skipped
+              << " already up to date." << std::endl;
 }
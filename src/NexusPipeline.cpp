@@ -0,0 +1,137 @@
+#include "NexusPipeline.h"
+#include "BoundedQueue.h"
+#include "DeltaSync.h"
+#include "DownloadEngine.h"
+#include "Extract.h"
+#include "NexusMods.h"
+#include "SyncManifest.h"
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace {
+
+// How many (mod, file) pairs the metadata stage may run ahead of the link stage.
+const size_t FILE_QUEUE_CAPACITY = 64;
+
+struct FileRef {
+    int mod_id;
+    int file_id;
+};
+
+} // namespace
+
+//--------------------------------------------------
+// Pipelined metadata -> link -> download sync
+//--------------------------------------------------
+
+/**
+ * Each stage closes its output queue when it runs out of input (or fails), which is
+ * what lets the next stage finish. The link queue is kept about as deep as the number
+ * of parallel downloads, so a generated link waits for at most one round of transfers.
+ */
+void sync_domain_pipelined(const std::vector<int>& mod_ids, const std::string& game_domain)
+{
+    SyncManifest manifest = SyncManifest::for_domain(game_domain);
+    manifest.load();
+    // The metadata stage reads this copy while the download stage updates the real one.
+    const SyncManifest previous = manifest;
+
+    int parallel = parallel_downloads_from_env();
+    BoundedQueue<FileRef> files(FILE_QUEUE_CAPACITY);
+    BoundedQueue<DownloadJob> jobs(static_cast<size_t>(parallel));
+
+    int skipped = 0;
+    std::map<std::pair<int, int>, std::string> download_links;
+
+    std::thread metadata([&]() {
+        try {
+            DeltaSync delta(game_domain);
+            delta.begin(mod_ids);
+            for (auto mod_id : mod_ids) {
+                for (auto file_id : delta.mod_file_ids(mod_id)) {
+                    // Skip files a previous run already downloaded, so they don't cost a download link request
+                    if (previous.is_current(mod_id, file_id)) {
+                        skipped++;
+                        continue;
+                    }
+                    if (!files.push({ mod_id, file_id })) {
+                        // Saved all the same; stopping early keeps the last sync time.
+                        delta.finish();
+                        return;
+                    }
+                }
+            }
+            delta.finish();
+        } catch (const std::exception& e) {
+            std::cerr << "Metadata stage failed for " << game_domain << ": " << e.what() << std::endl;
+        }
+        files.close();
+    });
+
+    std::thread links([&]() {
+        try {
+            while (auto file = files.pop()) {
+                auto link = generate_download_link(file->mod_id, file->file_id, game_domain);
+                if (!link) {
+                    continue;
+                }
+                download_links[{ file->mod_id, file->file_id }] = *link;
+                if (!jobs.push(make_download_job(file->mod_id, file->file_id, *link, manifest.domain_directory()))) {
+                    break;
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Link stage failed for " << game_domain << ": " << e.what() << std::endl;
+        }
+        // Unblock the metadata stage if this one stopped early.
+        files.close();
+        jobs.close();
+    });
+
+    // Archives are unpacked (and merged, with MODULAR_MERGE_TARGET) while later ones download.
+    std::unique_ptr<ExtractPool> extractor;
+    if (extraction_enabled()) {
+        extractor = std::make_unique<ExtractPool>(merge_target_from_env());
+    }
+
+    int succeeded = 0;
+    int failed = 0;
+    try {
+        DownloadEngine engine(parallel);
+        engine.set_source(&jobs);
+        engine.run([&](const DownloadResult& result) {
+            if (!result.success) {
+                failed++;
+                return;
+            }
+            succeeded++;
+            // Checkpointed as files finish so an interrupted run still remembers most of what it finished.
+            manifest.record(result.job.mod_id, result.job.file_id, result.job.path, result.md5);
+            manifest.checkpoint();
+            if (extractor && is_archive(result.job.path)) {
+                extractor->submit(result.job.path);
+            }
+        });
+    } catch (const std::exception& e) {
+        std::cerr << "Download stage failed for " << game_domain << ": " << e.what() << std::endl;
+    }
+    jobs.close();
+    files.close();
+    links.join();
+    metadata.join();
+    if (extractor) {
+        extractor->finish();
+    }
+
+    if (succeeded > 0) {
+        manifest.save();
+    }
+    save_download_links(download_links, game_domain);
+
+    std::cout << "Finished downloads for " << game_domain << ": " << succeeded
+              << " succeeded, " << failed << " failed, " << skipped
+              << " already up to date." << std::endl;
+}
@@ -0,0 +1,235 @@
+#include "RateLimiter.h"
+#include "Metrics.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <curl/curl.h>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+//----------------------------------------------------------------------------------
+// Header parsing helpers
+//----------------------------------------------------------------------------------
+
+/**
+ * Days since 1970-01-01 for a proleptic Gregorian date (avoids timegm, which MinGW lacks).
+ */
+static long long days_from_civil(int y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const long long era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<long long>(doe) - 719468;
+}
+
+/**
+ * Parse an ISO 8601 timestamp such as "2019-02-06T12:00:00+00:00" into Unix time.
+ * Returns -1 if the value is not in that form.
+ */
+static long long parse_iso8601(const std::string& value)
+{
+    int y, mo, d, h, mi, s;
+    int consumed = 0;
+    if (std::sscanf(value.c_str(), "%d-%d-%d%*1[T ]%d:%d:%d%n", &y, &mo, &d, &h, &mi, &s, &consumed) < 6) {
+        return -1;
+    }
+    long long t = days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s;
+
+    // Optional fractional seconds, then "Z", "+HH:MM" or "+HHMM"
+    size_t pos = static_cast<size_t>(consumed);
+    while (pos < value.size() && (value[pos] == '.' || std::isdigit(static_cast<unsigned char>(value[pos])))) {
+        pos++;
+    }
+    if (pos < value.size() && (value[pos] == '+' || value[pos] == '-')) {
+        int oh = 0, om = 0;
+        if (std::sscanf(value.c_str() + pos + 1, "%2d:%2d", &oh, &om) == 2 || std::sscanf(value.c_str() + pos + 1, "%2d%2d", &oh, &om) >= 1) {
+            long long offset = oh * 3600 + om * 60;
+            t += (value[pos] == '+') ? -offset : offset;
+        }
+    }
+    return t;
+}
+
+/**
+ * Parse a whole header value as a decimal integer. Returns false for anything else,
+ * including values too large for a long long.
+ */
+static bool parse_integer(const std::string& value, long long& out)
+{
+    if (value.empty()) {
+        return false;
+    }
+    errno = 0;
+    char* end = nullptr;
+    long long parsed = std::strtoll(value.c_str(), &end, 10);
+    if (errno == ERANGE || end != value.c_str() + value.size()) {
+        return false;
+    }
+    out = parsed;
+    return true;
+}
+
+// Longest Retry-After honoured; NexusMods' daily window is the longest it ever needs.
+static const long long MAX_RETRY_AFTER_SECONDS = 24 * 3600;
+
+long parse_retry_after(const std::string& value)
+{
+    if (value.empty()) {
+        return -1;
+    }
+    if (std::all_of(value.begin(), value.end(), [](unsigned char c) { return std::isdigit(c); })) {
+        long long seconds = 0;
+        if (!parse_integer(value, seconds)) {
+            // All digits but out of range: as long a wait as we ever honour.
+            return static_cast<long>(MAX_RETRY_AFTER_SECONDS);
+        }
+        return static_cast<long>(std::min(seconds, MAX_RETRY_AFTER_SECONDS));
+    }
+    time_t when = curl_getdate(value.c_str(), nullptr);
+    if (when < 0) {
+        return -1;
+    }
+    long long seconds = static_cast<long long>(when) - static_cast<long long>(std::time(nullptr));
+    return static_cast<long>(std::clamp<long long>(seconds, 0, MAX_RETRY_AFTER_SECONDS));
+}
+
+static long header_long(const std::map<std::string, std::string>& headers, const std::string& name, long fallback)
+{
+    auto it = headers.find(name);
+    long long value = 0;
+    if (it == headers.end() || !parse_integer(it->second, value)
+        || value < std::numeric_limits<long>::min() || value > std::numeric_limits<long>::max()) {
+        return fallback;
+    }
+    return static_cast<long>(value);
+}
+
+/**
+ * Seconds until the window named by the given reset header rolls over.
+ */
+static long long seconds_until_reset(const std::map<std::string, std::string>& headers,
+    const std::string& name, long long fallback)
+{
+    auto it = headers.find(name);
+    if (it == headers.end()) {
+        return fallback;
+    }
+    long long when = parse_iso8601(it->second);
+    if (when < 0) {
+        return fallback;
+    }
+    return std::max<long long>(0, when - static_cast<long long>(std::time(nullptr)));
+}
+
+//----------------------------------------------------------------------------------
+// RateLimiter
+//----------------------------------------------------------------------------------
+
+RateLimiter::RateLimiter(double reserve_fraction)
+    : reserve_fraction_(reserve_fraction)
+{
+}
+
+RateLimiter::Clock::duration RateLimiter::wait_time(Clock::time_point now)
+{
+    if (blocked_until_ > now) {
+        return blocked_until_ - now;
+    }
+    if (!known_) {
+        return Clock::duration::zero();
+    }
+    if (now >= reset_at_) {
+        // The window rolled over; burst again until the next response tells us otherwise.
+        tokens_ = limit_;
+        known_ = false;
+        return Clock::duration::zero();
+    }
+    if (tokens_ >= 1 && tokens_ > limit_ * reserve_fraction_) {
+        return Clock::duration::zero();
+    }
+    if (tokens_ < 1) {
+        return reset_at_ - now;
+    }
+
+    // Inside the reserve: spread what's left evenly over the rest of the window.
+    auto interval = std::chrono::duration_cast<Clock::duration>((reset_at_ - now) / tokens_);
+    auto next = last_grant_ + interval;
+    return next > now ? next - now : Clock::duration::zero();
+}
+
+void RateLimiter::acquire()
+{
+    bool announced = false;
+    bool slept = false;
+    auto started = Clock::now();
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto now = Clock::now();
+        auto wait = wait_time(now);
+        if (wait <= Clock::duration::zero()) {
+            if (known_) {
+                tokens_ -= 1;
+            }
+            last_grant_ = now;
+            if (slept) {
+                Metrics::instance().observe_seconds("modular_rate_limit_sleep_seconds",
+                    std::chrono::duration<double>(now - started).count());
+            }
+            return;
+        }
+        lock.unlock();
+
+        if (!announced && wait > std::chrono::seconds(5)) {
+            std::cout << "Rate limit budget low; waiting "
+                      << std::chrono::duration_cast<std::chrono::seconds>(wait).count()
+                      << "s before the next API request." << std::endl;
+            announced = true;
+        }
+        // Re-check at least once a second in case a response refreshes the budget.
+        std::this_thread::sleep_for(std::min<Clock::duration>(wait, std::chrono::seconds(1)));
+        slept = true;
+    }
+}
+
+void RateLimiter::update(long status_code, const std::map<std::string, std::string>& headers)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+
+    if (status_code == 429) {
+        auto it = headers.find("retry-after");
+        long retry_after = (it != headers.end()) ? parse_retry_after(it->second) : -1;
+        if (retry_after < 0) {
+            retry_after = 60;
+        }
+        blocked_until_ = std::max(blocked_until_, now + std::chrono::seconds(retry_after));
+    }
+
+    long daily_remaining = header_long(headers, "x-rl-daily-remaining", -1);
+    long hourly_remaining = header_long(headers, "x-rl-hourly-remaining", -1);
+
+    // Nexus grants a daily allowance; once that is spent, requests draw from the hourly one.
+    if (daily_remaining > 0) {
+        tokens_ = static_cast<double>(daily_remaining);
+        limit_ = static_cast<double>(header_long(headers, "x-rl-daily-limit", daily_remaining));
+        reset_at_ = now + std::chrono::seconds(seconds_until_reset(headers, "x-rl-daily-reset", 24 * 3600));
+        known_ = true;
+    } else if (hourly_remaining >= 0) {
+        tokens_ = static_cast<double>(hourly_remaining);
+        limit_ = static_cast<double>(header_long(headers, "x-rl-hourly-limit", hourly_remaining));
+        reset_at_ = now + std::chrono::seconds(seconds_until_reset(headers, "x-rl-hourly-reset", 3600));
+        known_ = true;
+    }
+}
+
+RateLimiter& nexus_rate_limiter()
+{
+    static RateLimiter limiter;
+    return limiter;
+}
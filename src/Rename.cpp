@@ -1,121 +1,287 @@
 #include "Rename.h"
-#include <curl/curl.h>
+#include "BufferPool.h"
+#include "HttpClient.h"
+#include "JsonStream.h"
+#include "LibraryIndex.h"
+#include "Merge.h"
+#include "Metrics.h"
+#include "NexusMods.h"
+#include "SyncManifest.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <nlohmann/json.hpp>
+#include <thread>
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
 
-// This callback will be used by libcurl to write received data into a std::string.
-size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp)
+/**
+ * Names of the subdirectories of dir that keep() accepts, from the library index when
+ * dir is part of it.
+ */
+static std::vector<std::string> listDirectories(const fs::path& dir, const std::function<bool(const std::string&)>& keep)
 {
-    std::string* str = static_cast<std::string*>(userp);
-    size_t totalSize = size * nmemb;
-    str->append(static_cast<char*>(contents), totalSize);
-    return totalSize;
-}
+    std::vector<std::string> names;
 
-std::vector<std::string> getGameDomainNames(const fs::path& modsListsDir)
-{
-    std::vector<std::string> domains;
+    if (!fs::exists(dir)) {
+        std::cerr << "Directory does not exist: " << dir << std::endl;
+        return names;
+    }
 
-    if (!fs::exists(modsListsDir)) {
-        std::cerr << "Directory does not exist: " << modsListsDir << std::endl;
-        return domains;
+    if (LibraryIndex* index = library_index_for(dir)) {
+        index->refresh(dir);
+        if (auto entries = index->list(dir)) {
+            for (const auto& entry : *entries) {
+                if (entry.directory && keep(entry.name)) {
+                    names.push_back(entry.name);
+                }
+            }
+            return names;
+        }
     }
 
-    for (const auto& entry : fs::directory_iterator(modsListsDir)) {
-        if (entry.is_directory()) {
-            domains.push_back(entry.path().filename().string());
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        std::string name = entry.path().filename().string();
+        if (entry.is_directory() && keep(name)) {
+            names.push_back(name);
         }
     }
-    return domains;
+    return names;
 }
 
-std::vector<std::string> getModIDs(const fs::path& gameDomainPath)
+static bool visible(const std::string& name)
 {
-    std::vector<std::string> modIDs;
-
-    if (!fs::exists(gameDomainPath)) {
-        std::cerr << "Directory does not exist: " << gameDomainPath << std::endl;
-        return modIDs;
-    }
+    return name.rfind('.', 0) != 0;
+}
 
-    for (const auto& entry : fs::directory_iterator(gameDomainPath)) {
-        if (entry.is_directory()) {
-            modIDs.push_back(entry.path().filename().string());
-        }
-    }
-    return modIDs;
+std::vector<std::string> getGameDomainNames(const fs::path& modsListsDir)
+{
+    // Hidden directories (e.g. the .cache response cache) are not game domains.
+    return listDirectories(modsListsDir, visible);
 }
 
-std::string fetchModName(const std::string& gameDomain, const std::string& modID)
+std::vector<std::string> getModIDs(const fs::path& gameDomainPath)
 {
-    CURL* curl = curl_easy_init();
-    std::string readBuffer;
-
-    if (curl) {
-        // Construct the API URL.
-        std::string url = "https://api.nexusmods.com/v1/games/" + gameDomain + "/mods/" + modID;
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-
-        // Retrieve the API key from the environment variable.
-        const char* envApiKey = std::getenv("API_KEY");
-        std::string apiKey = (envApiKey ? std::string(envApiKey) : "");
-        if (apiKey.empty()) {
-            std::cerr << "API_KEY environment variable is not set. Please set it before running the program.\n";
-            curl_easy_cleanup(curl);
-            return "";
-        }
+    return listDirectories(gameDomainPath, [](const std::string& name) {
+        return !name.empty() && std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isdigit(c); });
+    });
+}
 
-        // Set the API key as an HTTP header.
-        std::string headerStr = "apikey: " + apiKey;
-        struct curl_slist* headers = nullptr;
-        headers = curl_slist_append(headers, headerStr.c_str());
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+std::vector<std::string> getModDirectoryNames(const fs::path& gameDomainPath)
+{
+    return listDirectories(gameDomainPath, visible);
+}
 
-        // Perform the API request.
-        CURLcode res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            std::cerr << "curl_easy_perform() failed: " << curl_easy_strerror(res) << "\n";
-        }
+std::string fetchModName(const std::string& gameDomain, const std::string& modID)
+{
+    if (API_KEY.empty()) {
+        std::cerr << "API_KEY is not set. Please set it before running the program.\n";
+        return "";
+    }
 
-        // Cleanup.
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
+    // Goes through http_get so lookups share the Nexus rate limiter, connection pool and response cache.
+    std::string url = nexus_api_base() + "/games/" + gameDomain + "/mods/" + modID;
+    HttpResponse resp = http_get(url, { "accept: application/json", "apikey: " + API_KEY });
+    if (resp.status_code != 200) {
+        std::cerr << "Failed to fetch the name of mod " << modID << " in " << gameDomain
+                  << " (HTTP " << resp.status_code << ")" << std::endl;
+        return "";
     }
-    return readBuffer;
+    return std::move(resp.body);
 }
 
+/**
+ * The "name" of a mod document. Only that field is copied out; the description and
+ * the rest of the (often large) document stream past without being built.
+ */
 std::string extractModName(const std::string& jsonResponse)
 {
     try {
-        auto j = json::parse(jsonResponse);
-        if (j.contains("name")) {
-            return j["name"].get<std::string>();
-        }
+        std::string name;
+        stream_json_objects(jsonResponse, { {} }, { "name" }, [&name](const JsonFields& fields) {
+            auto it = fields.find("name");
+            if (it != fields.end() && it->second.is_string()) {
+                name = it->second.get<std::string>();
+            }
+        });
+        return name;
     } catch (const std::exception& e) {
         std::cerr << "JSON parse error: " << e.what() << std::endl;
     }
     return "";
 }
 
-void combineDirectories(const fs::path& target, const fs::path& source)
+//----------------------------------------------------------------------------------
+// ModNameCache
+//----------------------------------------------------------------------------------
+
+ModNameCache::ModNameCache(fs::path file)
+    : file_(std::move(file))
+{
+}
+
+fs::path ModNameCache::defaultPath(const fs::path& modsListsDir)
+{
+    return modsListsDir / ".cache" / "mod_names.json";
+}
+
+bool ModNameCache::load()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    names_.clear();
+    std::ifstream ifs(file_.string());
+    if (!ifs.is_open()) {
+        return true;
+    }
+    try {
+        json data = json::parse(ifs);
+        names_ = data.value("domains", json::object()).get<std::map<std::string, std::map<std::string, std::string>>>();
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in " << file_.string() << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ModNameCache::save() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::error_code ec;
+    fs::create_directories(file_.parent_path(), ec);
+    fs::path tmp = file_;
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return false;
+        }
+        ofs << json { { "domains", names_ } }.dump(2);
+    }
+    fs::rename(tmp, file_, ec);
+    if (ec) {
+        std::cerr << "Failed to save " << file_.string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::optional<std::string> ModNameCache::find(const std::string& gameDomain, const std::string& modID) const
 {
-    if (!fs::exists(target)) {
-        fs::create_directories(target);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto domain = names_.find(gameDomain);
+    if (domain == names_.end()) {
+        return std::nullopt;
+    }
+    auto it = domain->second.find(modID);
+    if (it == domain->second.end()) {
+        return std::nullopt;
     }
-    // Iterate over every item in the source directory.
-    for (const auto& entry : fs::directory_iterator(source)) {
-        fs::path dest = target / entry.path().filename();
-        if (entry.is_directory()) {
-            // Recursively merge subdirectories.
-            combineDirectories(dest, entry.path());
+    return it->second;
+}
+
+void ModNameCache::store(const std::string& gameDomain, const std::string& modID, const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    names_[gameDomain][modID] = name;
+}
+
+//----------------------------------------------------------------------------------
+// Batch rename
+//----------------------------------------------------------------------------------
+
+/**
+ * Lookups run on a few threads that each block in http_get(); the shared HttpClient
+ * multiplexes them onto one connection and the rate limiter paces them, so the
+ * thread count only bounds how many requests are outstanding at once.
+ */
+std::map<std::string, std::string> resolveModNames(const std::string& gameDomain,
+    const std::vector<std::string>& modIDs, ModNameCache& cache)
+{
+    std::map<std::string, std::string> names;
+    std::vector<std::string> missing;
+    for (const auto& modID : modIDs) {
+        if (auto name = cache.find(gameDomain, modID)) {
+            names[modID] = *name;
         } else {
-            // Copy (or overwrite) the file.
-            fs::copy(entry.path(), dest, fs::copy_options::overwrite_existing);
+            missing.push_back(modID);
         }
     }
+    if (missing.empty()) {
+        return names;
+    }
+    std::cout << "Looking up " << missing.size() << " mod name(s) for " << gameDomain << " ("
+              << names.size() << " already known)..." << std::endl;
+
+    std::mutex mutex;
+    std::atomic<size_t> next { 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < missing.size(); i = next++) {
+            const std::string& modID = missing[i];
+            std::string body = fetchModName(gameDomain, modID);
+            if (body.empty()) {
+                continue;
+            }
+            std::string name = extractModName(body);
+            BufferPool::instance().release(std::move(body));
+            if (name.empty()) {
+                std::cerr << "No mod name found for modID: " << modID << std::endl;
+                continue;
+            }
+            cache.store(gameDomain, modID, name);
+            std::lock_guard<std::mutex> lock(mutex);
+            names[modID] = name;
+        }
+    };
+
+    size_t threads = std::min<size_t>(api_concurrency_from_env(), missing.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    cache.save();
+    return names;
+}
+
+size_t renameModDirectories(const fs::path& gameDomainPath, const std::map<std::string, std::string>& newNames)
+{
+    std::map<std::string, std::string> renamed;
+    for (const auto& [modID, modName] : newNames) {
+        fs::path oldPath = gameDomainPath / modID;
+        fs::path newPath = gameDomainPath / modName;
+        std::error_code ec;
+        fs::rename(oldPath, newPath, ec);
+        if (ec) {
+            std::cerr << "Failed to rename " << oldPath << " to " << newPath << ": " << ec.message() << std::endl;
+            continue;
+        }
+        std::cout << "Renamed " << modID << " to " << modName << std::endl;
+        renamed[modID] = modName;
+    }
+
+    // Keep the sync manifest pointing at the renamed folders
+    if (!renamed.empty()) {
+        SyncManifest manifest(gameDomainPath);
+        manifest.load();
+        manifest.rename_directories(renamed);
+        manifest.save();
+    }
+    return renamed.size();
+}
+
+void combineDirectories(const fs::path& target, const fs::path& source)
+{
+    // Reflinks or in-kernel copies depending on the target filesystem (MODULAR_MERGE_STRATEGY overrides).
+    MergeStats stats = mergeDirectories(target, source, mergeOptionsFromEnv());
+    std::cout << "Merged " << source.filename().string() << ": " << stats.files - stats.unchanged << " placed, "
+              << stats.unchanged << " unchanged (" << stats.skippedBytes / (1024 * 1024) << " MiB not copied), "
+              << stats.deleted << " removed." << std::endl;
 }
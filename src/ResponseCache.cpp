@@ -0,0 +1,211 @@
+#include "ResponseCache.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+long long CacheEntry::age_seconds() const
+{
+    return static_cast<long long>(std::time(nullptr)) - stored_at;
+}
+
+//----------------------------------------------------------------------------------
+// ResponseCache
+//----------------------------------------------------------------------------------
+
+ResponseCache::ResponseCache(fs::path directory)
+    : directory_(std::move(directory))
+{
+}
+
+/**
+ * Keys are hashed (FNV-1a) into a flat directory of small JSON files.
+ */
+fs::path ResponseCache::path_for(const std::string& key) const
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    std::ostringstream oss;
+    oss << std::hex << hash << ".json";
+    return directory_ / oss.str();
+}
+
+std::optional<CacheEntry> ResponseCache::load(const std::string& key)
+{
+    fs::path path = path_for(key);
+    std::ifstream ifs(path.string());
+    if (!ifs.is_open()) {
+        return std::nullopt;
+    }
+    try {
+        json data = json::parse(ifs);
+        CacheEntry entry;
+        entry.url = data.value("url", "");
+        entry.body = data.value("body", "");
+        entry.etag = data.value("etag", "");
+        entry.last_modified = data.value("last_modified", "");
+        entry.stored_at = data.value("stored_at", 0LL);
+        return entry;
+    } catch (const std::exception& e) {
+        std::cerr << "Ignoring unreadable cache entry " << path.string() << ": " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+void ResponseCache::store(const std::string& key, const CacheEntry& entry)
+{
+    json data = {
+        { "url", entry.url },
+        { "body", entry.body },
+        { "etag", entry.etag },
+        { "last_modified", entry.last_modified },
+        { "stored_at", entry.stored_at }
+    };
+
+    fs::path path = path_for(key);
+    std::ostringstream tmp_name;
+    tmp_name << path.filename().string() << ".tmp" << std::this_thread::get_id();
+    fs::path tmp = directory_ / tmp_name.str();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::error_code ec;
+    fs::create_directories(directory_, ec);
+    {
+        std::ofstream ofs(tmp.string(), std::ios::binary | std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open cache file for writing: " << tmp.string() << std::endl;
+            return;
+        }
+        ofs << data.dump();
+    }
+    // Readers only ever see a complete entry.
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        std::cerr << "Failed to update cache entry " << path.string() << ": " << ec.message() << std::endl;
+        fs::remove(tmp, ec);
+    }
+}
+
+void ResponseCache::touch(const std::string& key, CacheEntry entry)
+{
+    entry.stored_at = static_cast<long long>(std::time(nullptr));
+    store(key, entry);
+}
+
+void ResponseCache::erase(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::error_code ec;
+    fs::remove(path_for(key), ec);
+}
+
+/**
+ * Entries are rewritten on every store and touch, so a file's mtime is when the
+ * response was last fetched or confirmed. Leftover temporary files age out the same way.
+ */
+size_t ResponseCache::prune(long long max_age_seconds, uintmax_t max_bytes)
+{
+    struct File {
+        fs::path path;
+        fs::file_time_type written;
+        uintmax_t size;
+    };
+    std::vector<File> files;
+    uintmax_t total = 0;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::error_code ec;
+    for (fs::directory_iterator it(directory_, ec), end; !ec && it != end; it.increment(ec)) {
+        std::error_code entry_ec;
+        if (!it->is_regular_file(entry_ec)) {
+            continue;
+        }
+        File file { it->path(), it->last_write_time(entry_ec), it->file_size(entry_ec) };
+        if (entry_ec) {
+            continue;
+        }
+        total += file.size;
+        files.push_back(std::move(file));
+    }
+
+    // Oldest first, so both limits delete from the front.
+    std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.written < b.written; });
+    auto cutoff = fs::file_time_type::clock::now() - std::chrono::seconds(max_age_seconds);
+    size_t removed = 0;
+    for (const File& file : files) {
+        if (file.written >= cutoff && total <= max_bytes) {
+            break;
+        }
+        if (fs::remove(file.path, ec)) {
+            removed++;
+            total -= file.size;
+        }
+    }
+    return removed;
+}
+
+//----------------------------------------------------------------------------------
+// Defaults
+//----------------------------------------------------------------------------------
+
+static long long ttl_from_env(const char* name, long long fallback)
+{
+    const char* env = std::getenv(name);
+    if (env && *env) {
+        char* end = nullptr;
+        long long value = std::strtoll(env, &end, 10);
+        if (end && *end == '\0') {
+            return value;
+        }
+    }
+    return fallback;
+}
+
+ResponseCache& nexus_response_cache()
+{
+    static ResponseCache cache([] {
+        std::string homeDir = std::string(std::getenv("HOME") ? std::getenv("HOME") : "");
+        return fs::path(homeDir) / "Games" / "Mods-Lists" / ".cache" / "nexus";
+    }());
+    static const size_t pruned = [] {
+        long long max_mb = std::max(0LL, ttl_from_env("MODULAR_CACHE_MAX_MB", 256));
+        return cache.prune(ttl_from_env("MODULAR_CACHE_MAX_AGE", 30 * 24 * 3600), static_cast<uintmax_t>(max_mb) << 20);
+    }();
+    (void)pruned;
+    return cache;
+}
+
+long long cache_ttl_for(const std::string& url)
+{
+    if (std::getenv("MODULAR_NO_CACHE")) {
+        return -1;
+    }
+    if (url.find("/tracked_mods.json") != std::string::npos) {
+        return ttl_from_env("MODULAR_CACHE_TTL_TRACKED", 900);
+    }
+    if (url.find("/files.json") != std::string::npos) {
+        return ttl_from_env("MODULAR_CACHE_TTL_FILES", 21600);
+    }
+    if (url.find("/updated.json") != std::string::npos) {
+        // Delta sync trusts this list to name every changed mod, so it must never be stale.
+        return ttl_from_env("MODULAR_CACHE_TTL_UPDATED", 0);
+    }
+    if (url.find("/download_link.json") != std::string::npos) {
+        // Links are signed and expire, so only ever reuse one the server has just confirmed.
+        return ttl_from_env("MODULAR_CACHE_TTL_LINKS", 0);
+    }
+    return ttl_from_env("MODULAR_CACHE_TTL_MODS", 21600);
+}
@@ -0,0 +1,166 @@
+#include "SyncManifest.h"
+#include "LibraryIndex.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+static long long mtime_of(const fs::path& path, std::error_code& ec)
+{
+    auto time = fs::last_write_time(path, ec);
+    return ec ? 0 : static_cast<long long>(time.time_since_epoch().count());
+}
+
+SyncManifest::SyncManifest(fs::path domain_directory)
+    : domain_directory_(std::move(domain_directory))
+{
+}
+
+SyncManifest SyncManifest::for_domain(const std::string& game_domain)
+{
+    std::string homeDir = std::string(std::getenv("HOME") ? std::getenv("HOME") : "");
+    return SyncManifest(fs::path(homeDir) / "Games" / "Mods-Lists" / game_domain);
+}
+
+fs::path SyncManifest::manifest_path() const
+{
+    return domain_directory_ / "manifest.json";
+}
+
+bool SyncManifest::load()
+{
+    entries_.clear();
+    std::ifstream ifs(manifest_path().string());
+    if (!ifs.is_open()) {
+        return true;
+    }
+    try {
+        json data = json::parse(ifs);
+        for (const auto& item : data.value("files", json::array())) {
+            ManifestEntry entry;
+            entry.mod_id = item.value("mod_id", 0);
+            entry.file_id = item.value("file_id", 0);
+            entry.path = item.value("path", "");
+            entry.size = item.value("size", uintmax_t { 0 });
+            entry.md5 = item.value("md5", "");
+            entry.mtime = item.value("mtime", 0LL);
+            entries_[{ entry.mod_id, entry.file_id }] = entry;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "JSON parse error in " << manifest_path().string() << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    // One refresh of the domain instead of two stats per recorded file in is_current().
+    index_ = library_index_for(domain_directory_);
+    if (index_) {
+        index_->refresh(domain_directory_);
+    }
+    return true;
+}
+
+bool SyncManifest::save() const
+{
+    json files = json::array();
+    for (const auto& [key, entry] : entries_) {
+        files.push_back({
+            { "mod_id", entry.mod_id },
+            { "file_id", entry.file_id },
+            { "path", entry.path },
+            { "size", entry.size },
+            { "md5", entry.md5 },
+            { "mtime", entry.mtime } });
+    }
+
+    std::error_code ec;
+    fs::create_directories(domain_directory_, ec);
+    fs::path tmp = manifest_path();
+    tmp += ".tmp";
+    {
+        std::ofstream ofs(tmp.string(), std::ios::trunc);
+        if (!ofs.is_open()) {
+            std::cerr << "Failed to open file for writing: " << tmp.string() << std::endl;
+            return false;
+        }
+        ofs << json { { "files", files } }.dump(2);
+    }
+    fs::rename(tmp, manifest_path(), ec);
+    if (ec) {
+        std::cerr << "Failed to save " << manifest_path().string() << ": " << ec.message() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool SyncManifest::checkpoint()
+{
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_checkpoint_) {
+        return true;
+    }
+    bool saved = save();
+    // Large manifests take a while to write; keep that under a tenth of the run.
+    auto took = std::chrono::steady_clock::now() - now;
+    next_checkpoint_ = now + std::max<std::chrono::steady_clock::duration>(std::chrono::seconds(1), took * 10);
+    return saved;
+}
+
+const ManifestEntry* SyncManifest::find(int mod_id, int file_id) const
+{
+    auto it = entries_.find({ mod_id, file_id });
+    return it == entries_.end() ? nullptr : &it->second;
+}
+
+bool SyncManifest::is_current(int mod_id, int file_id) const
+{
+    const ManifestEntry* entry = find(mod_id, file_id);
+    if (!entry) {
+        return false;
+    }
+    fs::path file = domain_directory_ / entry->path;
+    if (index_) {
+        auto indexed = index_->find(file);
+        return indexed && !indexed->directory && indexed->size == entry->size && indexed->mtime == entry->mtime;
+    }
+    std::error_code ec;
+    uintmax_t size = fs::file_size(file, ec);
+    if (ec || size != entry->size) {
+        return false;
+    }
+    long long mtime = mtime_of(file, ec);
+    return !ec && mtime == entry->mtime;
+}
+
+void SyncManifest::record(int mod_id, int file_id, const fs::path& file, const std::string& md5)
+{
+    std::error_code ec;
+    ManifestEntry entry;
+    entry.mod_id = mod_id;
+    entry.file_id = file_id;
+    entry.path = fs::relative(file, domain_directory_, ec).generic_string();
+    if (ec || entry.path.empty()) {
+        entry.path = file.generic_string();
+    }
+    entry.size = fs::file_size(file, ec);
+    entry.md5 = md5;
+    entry.mtime = mtime_of(file, ec);
+    entries_[{ mod_id, file_id }] = entry;
+}
+
+void SyncManifest::rename_directories(const std::map<std::string, std::string>& renames)
+{
+    for (auto& [key, entry] : entries_) {
+        auto slash = entry.path.find('/');
+        if (slash == std::string::npos) {
+            continue;
+        }
+        auto it = renames.find(entry.path.substr(0, slash));
+        if (it != renames.end()) {
+            entry.path = it->second + entry.path.substr(slash);
+        }
+    }
+}
@@ -1,9 +1,18 @@
+#include "Deploy.h"
+#include "Extract.h"
 #include "GameBanana.h"
+#include "LibraryIndex.h"
+#include "Metrics.h"
 #include "NexusMods.h"
+#include "NexusPipeline.h"
 #include "Rename.h"
+#include "SyncManifest.h"
+#include <algorithm>
 #include <cstdlib> // for std::getenv
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <sstream> // for std::istringstream if we parse user input
 #include <string>
 #include <vector>
@@ -38,6 +47,16 @@ std::string getDefaultModsDirectory()
     return defaultPath.string();
 }
 
+//--------------------------------------------------
+// Keep what this run learned about the library for the next start
+//--------------------------------------------------
+void saveLibraryIndex()
+{
+    if (LibraryIndex* index = library_index_for(getDefaultModsDirectory())) {
+        index->save();
+    }
+}
+
 //--------------------------------------------------
 // Run all GameBanana steps in one sequence
 //--------------------------------------------------
@@ -80,22 +99,17 @@ void runGameBananaSequence()
         baseDir = defaultModsDir;
     }
 
-    // 5) Download all detected mods
+    // 5) Download all detected mods, extracting each archive while the others download
     std::cout << "\nStarting download of all subscribed mods...\n";
+    std::unique_ptr<ExtractPool> extractor;
+    if (extraction_enabled()) {
+        extractor = std::make_unique<ExtractPool>(merge_target_from_env());
+    }
 
-    for (const auto& mod : mods) {
-        std::string modUrl = mod.first;
-        std::string modName = sanitizeFileName(mod.second);
-
-        // Extract Mod ID from URL
-        std::string modId = extractModId(modUrl);
-        if (modId.empty()) {
-            std::cerr << "Warning: Failed to extract mod ID from URL: " << modUrl << "\n";
-            continue;
-        }
-
-        std::cout << "Downloading Mod: " << modName << " (ID: " << modId << ")...\n";
-        downloadModFiles(modId, modName, baseDir);
+    // File lists are fetched several at a time and files of different mods download side by side.
+    downloadSubscribedMods(mods, baseDir, extractor.get());
+    if (extractor) {
+        extractor->finish();
     }
 
     std::cout << "\nAll subscribed mods have been downloaded to: " << baseDir << "\n";
@@ -119,24 +133,8 @@ std::string detectApiKeyFromEnv()
 //--------------------------------------------------
 void runNexusModsForOneDomain(const std::vector<int>& trackedMods, const std::string& gameDomain)
 {
-    // Get file IDs
-    auto fileIdsMap = get_file_ids(trackedMods, gameDomain);
-
-    // Generate download links
-    auto downloadLinks = generate_download_links(fileIdsMap, gameDomain);
-    std::cout << "\nGenerated Download Links for domain '" << gameDomain << "':\n";
-    for (auto& [modFilePair, url] : downloadLinks) {
-        std::cout << "  ModID: " << modFilePair.first
-                  << ", FileID: " << modFilePair.second
-                  << " => " << url << "\n";
-    }
-
-    // Save download links
-    save_download_links(downloadLinks, gameDomain);
-    std::cout << "Download links saved for domain '" << gameDomain << "'.\n";
-
-    // Download files
-    download_files(gameDomain);
+    // Fetch file lists, generate links and download, with all three stages overlapping
+    sync_domain_pipelined(trackedMods, gameDomain);
     std::cout << "Files downloaded for domain '" << gameDomain << "'.\n";
 }
 
@@ -186,6 +184,18 @@ void runRenameSequence()
         return;
     }
 
+    if (API_KEY.empty()) {
+        API_KEY = detectApiKeyFromEnv();
+    }
+    if (API_KEY.empty()) {
+        std::cerr << "API_KEY is not set. Please set it before running the program.\n";
+        return;
+    }
+
+    // Names looked up on earlier runs; only new mod IDs go to the API.
+    ModNameCache names(ModNameCache::defaultPath(modsDir));
+    names.load();
+
     for (const auto& gameDomain : gameDomains) {
         fs::path gameDomainPath = modsDir / gameDomain;
         std::cout << "\nProcessing game domain: " << gameDomain << "\n";
@@ -196,30 +206,76 @@ void runRenameSequence()
             continue;
         }
 
-        for (const auto& modID : modIDs) {
-            std::cout << "\nFetching mod name for modID: " << modID << "\n";
-            std::string jsonResponse = fetchModName(gameDomain, modID);
-            std::cout << "JSON response: " << jsonResponse << "\n";
+        // Folders renamed on an earlier run are no longer numeric and were left out above.
+        auto modNames = resolveModNames(gameDomain, modIDs, names);
+        std::map<std::string, std::string> newNames;
+        for (const auto& [modID, rawModName] : modNames) {
+            newNames[modID] = sanitizeFileName(rawModName);
+        }
+        size_t renamed = renameModDirectories(gameDomainPath, newNames);
+        std::cout << "Renamed " << renamed << " of " << modIDs.size() << " mod folder(s) in " << gameDomain << "\n";
+    }
+}
 
-            std::string rawModName = extractModName(jsonResponse);
-            if (rawModName.empty()) {
-                std::cerr << "No mod name found for modID: " << modID << "\n";
-                continue;
-            }
+//--------------------------------------------------
+// Deploy a profile (an ordered list of mod folders) into a game folder
+//--------------------------------------------------
+void runDeploySequence()
+{
+    fs::path modsDir = getDefaultModsDirectory();
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
-            std::string modName = sanitizeFileName(rawModName);
-            fs::path oldPath = gameDomainPath / modID;
-            fs::path newPath = gameDomainPath / modName;
-            std::cout << "Renaming: " << oldPath << " -> " << newPath << "\n";
+    std::cout << "Enter the game domain: ";
+    std::string gameDomain;
+    std::getline(std::cin, gameDomain);
+    if (gameDomain.empty() || !fs::is_directory(modsDir / gameDomain)) {
+        std::cerr << "No mods found for game domain '" << gameDomain << "' in: " << modsDir << "\n";
+        return;
+    }
 
-            try {
-                fs::rename(oldPath, newPath);
-                std::cout << "Renamed " << modID << " to " << modName << " in " << gameDomain << "\n";
-            } catch (const fs::filesystem_error& e) {
-                std::cerr << "Failed to rename " << oldPath << " to " << newPath << ": " << e.what() << "\n";
-            }
+    auto profiles = listProfiles(gameDomain);
+    if (!profiles.empty()) {
+        std::cout << "Profiles for " << gameDomain << ":\n";
+        for (const auto& name : profiles) {
+            std::cout << "  " << name << "\n";
         }
     }
+    std::cout << "Enter a profile name (a new name starts with every mod folder in " << gameDomain << "): ";
+    std::string profileName;
+    std::getline(std::cin, profileName);
+
+    DeployProfile profile;
+    if (!loadProfile(gameDomain, profileName, profile)) {
+        profile.gameDomain = gameDomain;
+        profile.name = sanitizeFileName(profileName);
+        profile.mods = getModDirectoryNames(modsDir / gameDomain);
+        std::sort(profile.mods.begin(), profile.mods.end());
+        if (!saveProfile(profile)) {
+            return;
+        }
+        std::cout << "Created profile " << (profileDirectory(gameDomain) / (profile.name + ".txt")).string()
+                  << "; edit it to choose mods and their order.\n";
+    }
+
+    fs::path defaultTarget = deployTargetFromEnv();
+    std::cout << "Enter the directory to deploy to"
+              << (defaultTarget.empty() ? std::string(": ") : " (Press ENTER for default: " + defaultTarget.string() + "): ");
+    std::string target;
+    std::getline(std::cin, target);
+    if (target.empty()) {
+        target = defaultTarget.string();
+    }
+    if (target.empty()) {
+        std::cout << "No directory given. Returning to main menu.\n";
+        return;
+    }
+
+    auto result = deployProfile(profile, target);
+    if (result) {
+        std::cout << "Deployed profile '" << profile.name << "' to " << target << ": " << result->files << " file(s), "
+                  << result->linked << " linked, " << result->unchanged << " unchanged, " << result->removed
+                  << " removed, " << result->failed << " failed.\n";
+    }
 }
 
 //--------------------------------------------------
@@ -227,6 +283,9 @@ void runRenameSequence()
 //--------------------------------------------------
 int main(int argc, char* argv[])
 {
+    // Request timings, rate-limit waits, parse and merge times; see MODULAR_STATS_DIR / MODULAR_STATS_INTERVAL.
+    StatsExporter stats;
+
     bool running = true;
     while (running) {
         std::cout << "\n---------------------------------------\n";
@@ -236,9 +295,10 @@ int main(int argc, char* argv[])
         std::cout << "1. Run GameBanana Sequence - Requires GB_USER_ID set in Environment\n";
         std::cout << "2. Run NexusMods Sequence - Requires API_KEY set in Environment\n";
         std::cout << "3. Run Rename Sequence - Typically only required after running NexusMods Sequence\n";
+        std::cout << "4. Deploy a Profile - Link a chosen set of mods into a game folder\n";
         std::cout << "0. Exit\n";
         std::cout << "=======================================\n";
-        std::cout << "Enter your choice (0/1/2/3): ";
+        std::cout << "Enter your choice (0/1/2/3/4): ";
 
         int choice;
         std::cin >> choice;
@@ -259,6 +319,8 @@ int main(int argc, char* argv[])
         case 1: {
             // Run everything for GameBanana
             runGameBananaSequence();
+            stats.flush();
+            saveLibraryIndex();
             break;
         }
         case 2: {
@@ -303,6 +365,8 @@ int main(int argc, char* argv[])
 
             // Now we have a list of domains. Pass them all to runNexusModsSequence
             runNexusModsSequence(gameDomains);
+            stats.flush();
+            saveLibraryIndex();
 
             // Optionally, stop the loop
             // running = false;
@@ -310,6 +374,14 @@ int main(int argc, char* argv[])
         }
         case 3: {
             runRenameSequence();
+            stats.flush();
+            saveLibraryIndex();
+            break;
+        }
+        case 4: {
+            runDeploySequence();
+            stats.flush();
+            saveLibraryIndex();
             break;
         }
         default: {